@@ -0,0 +1,532 @@
+// bench.cpp
+// Microbenchmarks for the compiler front end: Lexer::tokenize, Parser::parse
+// and SymbolTable::addSymbol, run over a corpus grown from src/script.py or
+// produced by the synthetic generator.
+//
+//   compiler_bench [--corpus FILE | --synthetic] [--size MB] [--warmup N] [--reps N] [--json] [--threads N]
+//   compiler_bench --scaling [--max-exponent X] [--json]
+//   compiler_bench --generate FILE [--size MB]
+//
+// --threads N adds a parse-mt row: Parser::parseParallel on N threads.
+// The pipeline row times lexAndParse, the lexer and parser on two threads.
+// lex-z and parse-z do the same work through a CompressedTokens store; the
+// lex rows also report the memory their tokens hold.
+// --trace FILE records every lex/parse run as Chrome trace_event JSON.
+//
+// Generator knobs (--synthetic, --scaling, --generate):
+//   [--scopes N] [--depth N] [--density D] [--literal-length N] [--seed N]
+#include "corpus_gen.h"
+#include "main.h"
+#include "token_store.h"
+#include "trace.h"
+#include "utils.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+
+#ifndef BENCH_CORPUS
+#define BENCH_CORPUS "src/script.py"
+#endif
+
+namespace
+{
+struct BenchOptions
+{
+    string corpus = BENCH_CORPUS;
+    double sizeMB = 4.0;
+    int warmup = 2;
+    int reps = 10;
+    bool json = false;
+    bool synthetic = false;
+    bool scaling = false;
+    double maxExponent = 1.3; // --scaling fails above this growth exponent
+    unsigned threads = 0;     // --threads: also time parseParallel with this many
+    string generate;          // --generate: write a corpus here and exit
+    string trace;             // --trace: write Chrome trace JSON here
+    CorpusOptions gen;
+};
+
+struct BenchResult
+{
+    string name;
+    vector<double> samples; // seconds per repetition
+    double items = 0;       // tokens or symbols handled per repetition
+    double bytes = 0;       // source bytes handled per repetition
+    string itemUnit;
+    double heapBytes = 0; // memory the result holds, where that is the point
+
+    double median() const
+    {
+        vector<double> s = samples;
+        sort(s.begin(), s.end());
+        size_t n = s.size();
+        return n % 2 ? s[n / 2] : (s[n / 2 - 1] + s[n / 2]) / 2;
+    }
+    double best() const { return *min_element(samples.begin(), samples.end()); }
+};
+
+volatile size_t sink = 0; // results feed this so the optimizer can't drop the work
+
+// Runs `body` warmup + reps times and keeps the timed repetitions. `setup`
+// runs before each repetition outside the timed region.
+BenchResult measure(const string &name, const BenchOptions &opt,
+                    const function<void()> &setup, const function<void()> &body)
+{
+    BenchResult result;
+    result.name = name;
+    for (int i = 0; i < opt.warmup + opt.reps; i++)
+    {
+        setup();
+        auto start = chrono::steady_clock::now();
+        body();
+        auto end = chrono::steady_clock::now();
+        if (i >= opt.warmup)
+            result.samples.push_back(chrono::duration<double>(end - start).count());
+    }
+    return result;
+}
+
+// Repeats the seed file until the corpus reaches the requested size. Each
+// copy gets its identifiers suffixed with the copy number, so the symbol
+// table grows with the corpus instead of seeing the same names again.
+string buildCorpus(const string &seed, size_t targetBytes)
+{
+    vector<Error> errors;
+    vector<Token> tokens = Lexer().tokenize(seed, errors);
+
+    string corpus;
+    corpus.reserve(targetBytes + seed.size() * 2);
+    for (int copy = 0; corpus.size() < targetBytes; copy++)
+    {
+        string suffix = "_" + to_string(copy);
+        size_t pos = 0;
+        for (const Token &tk : tokens)
+        {
+            if (tk.type != TokenType::IDENTIFIER)
+                continue;
+            size_t end = tk.offset + tk.lexeme.size();
+            corpus.append(seed, pos, end - pos);
+            corpus += suffix;
+            pos = end;
+        }
+        corpus.append(seed, pos, string::npos);
+        if (!corpus.empty() && corpus.back() != '\n')
+            corpus += '\n';
+    }
+    return corpus;
+}
+
+bool parseOptions(int argc, char **argv, BenchOptions &opt)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--corpus" && hasValue)
+            opt.corpus = argv[++i];
+        else if (arg == "--size" && hasValue)
+            opt.sizeMB = atof(argv[++i]);
+        else if (arg == "--warmup" && hasValue)
+            opt.warmup = atoi(argv[++i]);
+        else if (arg == "--reps" && hasValue)
+            opt.reps = max(1, atoi(argv[++i]));
+        else if (arg == "--json")
+            opt.json = true;
+        else if (arg == "--synthetic")
+            opt.synthetic = true;
+        else if (arg == "--scaling")
+            opt.scaling = true;
+        else if (arg == "--max-exponent" && hasValue)
+            opt.maxExponent = atof(argv[++i]);
+        else if (arg == "--generate" && hasValue)
+            opt.generate = argv[++i];
+        else if (arg == "--trace" && hasValue)
+            opt.trace = argv[++i];
+        else if (arg == "--threads" && hasValue)
+            opt.threads = static_cast<unsigned>(max(1, atoi(argv[++i])));
+        else if (arg == "--scopes" && hasValue)
+            opt.gen.scopeCount = max(1, atoi(argv[++i]));
+        else if (arg == "--depth" && hasValue)
+            opt.gen.maxDepth = max(0, atoi(argv[++i]));
+        else if (arg == "--density" && hasValue)
+            opt.gen.literalDensity = atof(argv[++i]);
+        else if (arg == "--literal-length" && hasValue)
+            opt.gen.literalLength = max(1, atoi(argv[++i]));
+        else if (arg == "--seed" && hasValue)
+            opt.gen.seed = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+        else
+        {
+            cerr << "usage: " << argv[0]
+                 << " [--corpus FILE | --synthetic] [--size MB] [--warmup N] [--reps N] [--json] [--threads N] [--trace FILE]\n"
+                 << "       " << argv[0] << " --scaling [--max-exponent X] [--json]\n"
+                 << "       " << argv[0] << " --generate FILE [--size MB]\n"
+                 << "  generator: [--scopes N] [--depth N] [--density D] [--literal-length N] [--seed N]\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+void printText(const vector<BenchResult> &results, size_t corpusBytes)
+{
+    printf("corpus: %.2f MB\n", corpusBytes / 1e6);
+    printf("%-10s %12s %12s %14s %16s\n", "benchmark", "median ms", "best ms", "MB/s", "throughput");
+    for (const auto &r : results)
+    {
+        double med = r.median();
+        char rate[64];
+        if (r.itemUnit == "ns/symbol")
+            snprintf(rate, sizeof(rate), "%.1f ns/symbol", med * 1e9 / r.items);
+        else
+            snprintf(rate, sizeof(rate), "%.2fM %s", r.items / med / 1e6, r.itemUnit.c_str());
+        char mbps[32] = "-";
+        if (r.bytes > 0)
+            snprintf(mbps, sizeof(mbps), "%.2f", r.bytes / med / 1e6);
+        printf("%-10s %12.3f %12.3f %14s %16s\n", r.name.c_str(), med * 1e3, r.best() * 1e3, mbps, rate);
+    }
+    for (const auto &r : results)
+    {
+        if (r.heapBytes > 0)
+            printf("%-10s holds %.2f MB, %.2f bytes per %s\n", r.name.c_str(), r.heapBytes / 1e6,
+                   r.heapBytes / r.items, r.itemUnit.substr(0, r.itemUnit.size() - 1).c_str());
+    }
+}
+
+void printJson(const vector<BenchResult> &results, size_t corpusBytes, const BenchOptions &opt)
+{
+    printf("{\n  \"corpus_bytes\": %zu,\n  \"warmup\": %d,\n  \"reps\": %d,\n  \"benchmarks\": [\n",
+           corpusBytes, opt.warmup, opt.reps);
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const auto &r = results[i];
+        double med = r.median();
+        printf("    {\"name\": \"%s\", \"median_ns\": %.0f, \"best_ns\": %.0f, \"items\": %.0f",
+               r.name.c_str(), med * 1e9, r.best() * 1e9, r.items);
+        if (r.bytes > 0)
+            printf(", \"mb_per_s\": %.3f", r.bytes / med / 1e6);
+        if (r.heapBytes > 0)
+            printf(", \"heap_bytes\": %.0f", r.heapBytes);
+        if (r.itemUnit == "ns/symbol")
+            printf(", \"ns_per_symbol\": %.3f", med * 1e9 / r.items);
+        else
+            printf(", \"%s_per_s\": %.0f", r.itemUnit.c_str(), r.items / med);
+        printf("}%s\n", i + 1 < results.size() ? "," : "");
+    }
+    printf("  ]\n}\n");
+}
+
+// ----------------------------------------------
+// Complexity regression: time each phase as the input doubles from 1x to
+// 64x and fit the growth exponent k in time ~ size^k. A linear front end
+// stays near 1; anything quadratic shows up as k close to 2.
+// ----------------------------------------------
+struct ScalingShape
+{
+    const char *name;
+    function<CorpusOptions(int factor)> options;
+};
+
+struct ScalingPoint
+{
+    int factor;
+    size_t bytes;
+    double lexSeconds;
+    double parseSeconds;
+};
+
+// Least-squares slope of log(time) against log(bytes)
+double growthExponent(const vector<ScalingPoint> &points, double ScalingPoint::*phase)
+{
+    double n = static_cast<double>(points.size()), sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for (const auto &p : points)
+    {
+        double x = log(static_cast<double>(p.bytes)), y = log(max(p.*phase, 1e-9));
+        sx += x;
+        sy += y;
+        sxx += x * x;
+        sxy += x * y;
+    }
+    return (n * sxy - sx * sy) / (n * sxx - sx * sx);
+}
+
+bool finishTrace(const BenchOptions &opt)
+{
+    if (opt.trace.empty() || writeTraceJson(opt.trace))
+        return true;
+    cerr << "Could not write file: " << opt.trace << "\n";
+    return false;
+}
+
+int runScaling(const BenchOptions &opt)
+{
+    const size_t baseBytes = 48 * 1024;
+    const double pointBudget = 1.0; // seconds per phase at one size
+    const CorpusOptions base = opt.gen;
+    const vector<ScalingShape> shapes = {
+        // Longer function bodies, fixed number of scopes
+        {"statements", [&](int f)
+         {
+             CorpusOptions o = base;
+             o.targetBytes = baseBytes * f;
+             return o;
+         }},
+        // More top-level scopes of the same size
+        {"scopes", [&](int f)
+         {
+             CorpusOptions o = base;
+             o.targetBytes = baseBytes * f;
+             o.scopeCount = base.scopeCount * f;
+             return o;
+         }},
+        // Longer literals and argument lists, same statement count
+        {"literals", [&](int f)
+         {
+             CorpusOptions o = base;
+             o.targetBytes = baseBytes * f;
+             o.literalLength = base.literalLength * f;
+             o.literalDensity = max(base.literalDensity, 0.5);
+             return o;
+         }},
+    };
+
+    BenchOptions timing = opt;
+    timing.warmup = 1;
+    timing.reps = min(opt.reps, 3);
+
+    bool failed = false;
+    if (opt.json)
+        printf("{\n  \"max_exponent\": %.2f,\n  \"shapes\": [\n", opt.maxExponent);
+    else
+        printf("%-11s %7s %12s %12s %12s\n", "shape", "factor", "bytes", "lex ms", "parse ms");
+    for (size_t s = 0; s < shapes.size(); s++)
+    {
+        vector<ScalingPoint> points;
+        bool aborted = false;
+        for (int factor = 1; factor <= 64 && !aborted; factor *= 2)
+        {
+            try
+            {
+                const string corpus = generateCorpus(shapes[s].options(factor));
+                vector<Token> tokens;
+                auto lex = measure("lex", timing, [] {}, [&]
+                                   {
+                                       vector<Error> errors;
+                                       tokens = Lexer().tokenize(corpus, errors);
+                                       sink += errors.size();
+                                   });
+                SymbolTable parsed;
+                auto parse = measure("parse", timing, [&]
+                                     { parsed = SymbolTable(); },
+                                     [&]
+                                     { Parser(tokens, parsed).parse(); });
+                sink += parsed.table.size();
+                points.push_back({factor, corpus.size(), lex.best(), parse.best()});
+                if (!opt.json)
+                    printf("%-11s %6dx %12zu %12.3f %12.3f\n", shapes[s].name, factor, corpus.size(),
+                           lex.best() * 1e3, parse.best() * 1e3);
+                // A linear front end handles the largest size in well under a
+                // second; past that, the remaining doublings only burn time.
+                aborted = max(lex.best(), parse.best()) > pointBudget;
+            }
+            catch (const bad_alloc &)
+            {
+                aborted = true;
+            }
+            if (aborted && !opt.json)
+                printf("%-11s %6dx  stopped: over the %.0f s budget or out of memory\n",
+                       shapes[s].name, factor, pointBudget);
+        }
+
+        double lexK = points.size() > 1 ? growthExponent(points, &ScalingPoint::lexSeconds) : 0;
+        double parseK = points.size() > 1 ? growthExponent(points, &ScalingPoint::parseSeconds) : 0;
+        bool bad = aborted || lexK > opt.maxExponent || parseK > opt.maxExponent;
+        failed = failed || bad;
+        if (opt.json)
+        {
+            printf("    {\"name\": \"%s\", \"lex_exponent\": %.3f, \"parse_exponent\": %.3f, \"aborted\": %s, \"points\": [",
+                   shapes[s].name, lexK, parseK, aborted ? "true" : "false");
+            for (size_t i = 0; i < points.size(); i++)
+                printf("%s{\"bytes\": %zu, \"lex_ns\": %.0f, \"parse_ns\": %.0f}", i ? ", " : "",
+                       points[i].bytes, points[i].lexSeconds * 1e9, points[i].parseSeconds * 1e9);
+            printf("]}%s\n", s + 1 < shapes.size() ? "," : "");
+        }
+        else
+        {
+            printf("%-11s exponent: lex %.2f, parse %.2f%s\n\n", shapes[s].name, lexK, parseK,
+                   bad ? "  <-- above limit" : "");
+        }
+    }
+    if (opt.json)
+        printf("  ],\n  \"passed\": %s\n}\n", failed ? "false" : "true");
+    else
+        printf("%s (limit %.2f)\n", failed ? "FAILED: superlinear growth" : "passed", opt.maxExponent);
+    return failed ? 1 : 0;
+}
+}
+
+int main(int argc, char **argv)
+{
+    BenchOptions opt;
+    if (!parseOptions(argc, argv, opt))
+        return 2;
+
+    if (!opt.trace.empty())
+    {
+        setTraceThreadName("bench");
+        setTraceEnabled(true);
+    }
+    if (opt.scaling)
+    {
+        int status = runScaling(opt);
+        return finishTrace(opt) ? status : 1;
+    }
+
+    CorpusOptions gen = opt.gen;
+    gen.targetBytes = static_cast<size_t>(opt.sizeMB * 1e6);
+    if (!opt.generate.empty())
+    {
+        ofstream out(opt.generate, ios::binary);
+        out << generateCorpus(gen);
+        if (!out)
+        {
+            cerr << "Could not write file: " << opt.generate << "\n";
+            return 1;
+        }
+        return 0;
+    }
+
+    string corpus;
+    if (opt.synthetic)
+    {
+        corpus = generateCorpus(gen);
+    }
+    else
+    {
+        string seed;
+        try
+        {
+            seed = readFile(opt.corpus);
+        }
+        catch (const exception &e)
+        {
+            cerr << e.what() << "\n";
+            return 1;
+        }
+        corpus = buildCorpus(seed, gen.targetBytes);
+    }
+    vector<BenchResult> results;
+
+    // Lexer
+    vector<Token> tokens;
+    auto lex = measure("lex", opt, [&]
+                       { tokens.clear(); },
+                       [&]
+                       {
+                           vector<Error> errors;
+                           tokens = Lexer().tokenize(corpus, errors);
+                           sink += errors.size();
+                       });
+    lex.items = static_cast<double>(tokens.size());
+    lex.bytes = static_cast<double>(corpus.size());
+    lex.itemUnit = "tokens";
+    lex.heapBytes = static_cast<double>(tokens.capacity() * sizeof(Token));
+    results.push_back(lex);
+
+    // Parser, over the token stream produced above
+    SymbolTable parsed;
+    auto parse = measure("parse", opt, [&]
+                         { parsed = SymbolTable(); },
+                         [&]
+                         { Parser(tokens, parsed).parse(); });
+    sink += parsed.table.size();
+    parse.items = static_cast<double>(tokens.size());
+    parse.bytes = static_cast<double>(corpus.size());
+    parse.itemUnit = "tokens";
+    results.push_back(parse);
+
+    if (opt.threads > 0)
+    {
+        auto parseMt = measure("parse-mt", opt, [&]
+                               { parsed = SymbolTable(); },
+                               [&]
+                               { Parser(tokens, parsed).parseParallel(opt.threads); });
+        sink += parsed.table.size();
+        parseMt.items = static_cast<double>(tokens.size());
+        parseMt.bytes = static_cast<double>(corpus.size());
+        parseMt.itemUnit = "tokens";
+        results.push_back(parseMt);
+    }
+
+    // Lexer and parser on two threads, source to symbols; compare with lex + parse
+    auto pipeline = measure("pipeline", opt, [&]
+                            { parsed = SymbolTable(); },
+                            [&]
+                            {
+                                vector<Error> errors;
+                                sink += lexAndParse(corpus, errors, parsed).size();
+                            });
+    sink += parsed.table.size();
+    pipeline.items = static_cast<double>(tokens.size());
+    pipeline.bytes = static_cast<double>(corpus.size());
+    pipeline.itemUnit = "tokens";
+    results.push_back(pipeline);
+
+    // The same through a compressed store: lexing into it, then parsing from it
+    CompressedTokens store;
+    auto lexZ = measure("lex-z", opt, [&]
+                        { store = CompressedTokens(); },
+                        [&]
+                        {
+                            vector<Error> errors;
+                            Lexer().tokenize(corpus, errors, store);
+                            sink += errors.size();
+                        });
+    lexZ.items = static_cast<double>(store.size());
+    lexZ.bytes = static_cast<double>(corpus.size());
+    lexZ.itemUnit = "tokens";
+    lexZ.heapBytes = static_cast<double>(store.bytes());
+    results.push_back(lexZ);
+
+    auto parseZ = measure("parse-z", opt, [&]
+                          { parsed = SymbolTable(); },
+                          [&]
+                          {
+                              TokenStream stream(store);
+                              Parser(stream, parsed).parse();
+                          });
+    sink += parsed.table.size();
+    parseZ.items = static_cast<double>(store.size());
+    parseZ.bytes = static_cast<double>(corpus.size());
+    parseZ.itemUnit = "tokens";
+    results.push_back(parseZ);
+
+    // SymbolTable::addSymbol, replaying every identifier occurrence
+    vector<const Token *> identifiers;
+    for (const Token &tk : tokens)
+    {
+        if (tk.type == TokenType::IDENTIFIER)
+            identifiers.push_back(&tk);
+    }
+    SymbolTable symbols;
+    auto symtab = measure("symtab", opt, [&]
+                          { symbols = SymbolTable(); },
+                          [&]
+                          {
+                              for (const Token *tk : identifiers)
+                                  symbols.addSymbol(tk->lexeme, "unknown", tk->lineNumber, tk->scope);
+                          });
+    sink += symbols.table.size();
+    symtab.items = static_cast<double>(identifiers.size());
+    symtab.itemUnit = "ns/symbol";
+    results.push_back(symtab);
+
+    if (opt.json)
+        printJson(results, corpus.size(), opt);
+    else
+        printText(results, corpus.size());
+    return finishTrace(opt) ? 0 : 1;
+}
@@ -0,0 +1,478 @@
+// binary_format.cpp
+#include "binary_format.h"
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <unordered_map>
+#include "trace.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+constexpr size_t headerSize = 16;
+constexpr size_t directoryEntrySize = 24;
+constexpr size_t tokenRecordSize = 16;
+constexpr size_t checkpointSize = 8;
+constexpr size_t symbolRecordSize = 32;
+constexpr size_t errorRecordSize = 16;
+
+// Byte-wise little-endian access: correct on any host, and a plain load on
+// the little-endian ones after optimization.
+uint32_t loadU32(const uint8_t *p)
+{
+    return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24;
+}
+
+uint64_t loadU64(const uint8_t *p)
+{
+    return uint64_t(loadU32(p)) | uint64_t(loadU32(p + 4)) << 32;
+}
+
+void putU32(std::string &out, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+        out += static_cast<char>(v >> (8 * i));
+}
+
+void putU64(std::string &out, uint64_t v)
+{
+    putU32(out, static_cast<uint32_t>(v));
+    putU32(out, static_cast<uint32_t>(v >> 32));
+}
+
+void putVarint(std::string &out, uint32_t v)
+{
+    while (v >= 0x80)
+    {
+        out += static_cast<char>(v | 0x80);
+        v >>= 7;
+    }
+    out += static_cast<char>(v);
+}
+
+uint32_t zigzag(int32_t v)
+{
+    return (static_cast<uint32_t>(v) << 1) ^ static_cast<uint32_t>(v >> 31);
+}
+
+int32_t unzigzag(uint32_t v)
+{
+    return static_cast<int32_t>(v >> 1) ^ -static_cast<int32_t>(v & 1);
+}
+
+uint32_t checkedU32(size_t v, const char *what)
+{
+    if (v > UINT32_MAX)
+        throw std::runtime_error(std::string("Binary output: ") + what + " exceeds 4 GB");
+    return static_cast<uint32_t>(v);
+}
+
+// Deduplicating string table; index 0 is always the empty string
+class StringTableBuilder
+{
+public:
+    StringTableBuilder() { intern(""); }
+
+    uint32_t intern(const std::string &s)
+    {
+        auto [it, inserted] = indices.try_emplace(s, static_cast<uint32_t>(strings.size()));
+        if (inserted)
+            strings.push_back(&it->first);
+        return it->second;
+    }
+
+    // Pooled text sits at one address per distinct string, so most lookups
+    // stop at the pointer and never hash the text
+    uint32_t intern(InternedString s)
+    {
+        auto found = byText.find(s.data());
+        if (found != byText.end())
+            return found->second;
+        uint32_t index = intern(s.str());
+        byText.emplace(s.data(), index);
+        return index;
+    }
+
+    std::string encode() const
+    {
+        std::string out;
+        putU32(out, checkedU32(strings.size(), "string count"));
+        size_t offset = 0;
+        for (const std::string *s : strings)
+        {
+            putU32(out, checkedU32(offset, "string table"));
+            offset += s->size();
+        }
+        putU32(out, checkedU32(offset, "string table"));
+        for (const std::string *s : strings)
+            out += *s;
+        return out;
+    }
+
+private:
+    std::unordered_map<std::string, uint32_t> indices;
+    std::vector<const std::string *> strings; // keys of `indices`, in index order
+    std::unordered_map<const char *, uint32_t> byText;
+};
+}
+
+// ----------------------------------------------
+// Writer
+// ----------------------------------------------
+std::string writeBinaryOutput(const std::vector<Token> &tokens,
+                              const std::vector<SymbolTable::SymbolRecord> &symbols,
+                              const std::vector<Error> &errors,
+                              const SourceView &source)
+{
+    StringTableBuilder strings;
+
+    std::string tokenSection;
+    tokenSection.reserve(4 + tokens.size() * tokenRecordSize);
+    putU32(tokenSection, checkedU32(tokens.size(), "token count"));
+    for (const Token &tk : tokens)
+    {
+        putU32(tokenSection, strings.intern(tk.lexeme));
+        putU32(tokenSection, strings.intern(tk.scope));
+        putU32(tokenSection, checkedU32(tk.offset, "source offset"));
+        putU32(tokenSection, static_cast<uint32_t>(tk.type));
+    }
+
+    std::string checkpoints, lineStream;
+    size_t checkpointCount = (tokens.size() + binfmt::lineCheckpointInterval - 1) / binfmt::lineCheckpointInterval;
+    putU32(checkpoints, static_cast<uint32_t>(checkpointCount));
+    int previousLine = 0;
+    for (size_t i = 0; i < tokens.size(); i++)
+    {
+        if (i % binfmt::lineCheckpointInterval == 0)
+        {
+            putU32(checkpoints, static_cast<uint32_t>(tokens[i].lineNumber));
+            putU32(checkpoints, checkedU32(lineStream.size(), "line stream"));
+            previousLine = tokens[i].lineNumber;
+            continue; // the checkpoint holds this token's line
+        }
+        putVarint(lineStream, zigzag(tokens[i].lineNumber - previousLine));
+        previousLine = tokens[i].lineNumber;
+    }
+    std::string lineSection = checkpoints + lineStream;
+
+    std::string symbolSection;
+    putU32(symbolSection, checkedU32(symbols.size(), "symbol count"));
+    for (const auto &rec : symbols)
+    {
+        putU32(symbolSection, strings.intern(rec.name));
+        putU32(symbolSection, strings.intern(rec.info.scope));
+        putU32(symbolSection, strings.intern(rec.info.type));
+        putU32(symbolSection, strings.intern(spanText(source, rec.info.value)));
+        putU32(symbolSection, static_cast<uint32_t>(rec.info.entry));
+        putU32(symbolSection, static_cast<uint32_t>(rec.info.firstAppearance));
+        putU32(symbolSection, static_cast<uint32_t>(rec.info.usageCount));
+        putU32(symbolSection, 0);
+    }
+
+    std::string errorSection;
+    putU32(errorSection, checkedU32(errors.size(), "error count"));
+    for (const Error &e : errors)
+    {
+        putU32(errorSection, strings.intern(e.message));
+        putU32(errorSection, static_cast<uint32_t>(e.line));
+        putU64(errorSection, e.position);
+    }
+
+    const std::pair<binfmt::SectionId, const std::string *> sections[] = {
+        {binfmt::SectionId::Strings, nullptr}, // encoded last, once complete
+        {binfmt::SectionId::Tokens, &tokenSection},
+        {binfmt::SectionId::Lines, &lineSection},
+        {binfmt::SectionId::Symbols, &symbolSection},
+        {binfmt::SectionId::Errors, &errorSection},
+    };
+    const std::string stringSection = strings.encode();
+    const size_t sectionCount = sizeof(sections) / sizeof(sections[0]);
+
+    std::string out(binfmt::magic, sizeof(binfmt::magic));
+    putU32(out, binfmt::version);
+    putU32(out, static_cast<uint32_t>(sectionCount));
+    putU32(out, 0);
+
+    auto align = [](size_t n)
+    { return (n + 7) & ~size_t(7); };
+    size_t offset = align(headerSize + sectionCount * directoryEntrySize);
+    for (const auto &[id, body] : sections)
+    {
+        const std::string &bytes = body ? *body : stringSection;
+        putU32(out, static_cast<uint32_t>(id));
+        putU32(out, 0);
+        putU64(out, offset);
+        putU64(out, bytes.size());
+        offset = align(offset + bytes.size());
+    }
+    for (const auto &[id, body] : sections)
+    {
+        const std::string &bytes = body ? *body : stringSection;
+        out.resize(align(out.size()), '\0');
+        out += bytes;
+    }
+    return out;
+}
+
+bool saveBinaryOutput(const std::string &path, const std::vector<Token> &tokens,
+                      const std::vector<SymbolTable::SymbolRecord> &symbols,
+                      const std::vector<Error> &errors, const SourceView &source)
+{
+    TraceScope trace("saveBinaryOutput", path);
+    const std::string bytes = writeBinaryOutput(tokens, symbols, errors, source);
+    std::ofstream file(path, std::ios::binary);
+    file.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+    return static_cast<bool>(file);
+}
+
+// ----------------------------------------------
+// Reader
+// ----------------------------------------------
+BinaryOutputReader::BinaryOutputReader(const uint8_t *data, size_t size)
+    : data(data), size(size)
+{
+    parse();
+}
+
+BinaryOutputReader BinaryOutputReader::open(const std::string &path)
+{
+    TraceScope trace("BinaryOutputReader::open", path);
+    BinaryOutputReader reader;
+#ifndef _WIN32
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("Could not open file: " + path);
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        ::close(fd);
+        throw std::runtime_error("Not a binary compile output: " + path);
+    }
+    void *p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED)
+        throw std::runtime_error("Could not map file: " + path);
+    reader.mapping = p;
+    reader.mapped = true;
+    reader.data = static_cast<const uint8_t *>(p);
+    reader.size = static_cast<size_t>(st.st_size);
+#else
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        throw std::runtime_error("Could not open file: " + path);
+    std::string *bytes = new std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    reader.mapping = bytes;
+    reader.data = reinterpret_cast<const uint8_t *>(bytes->data());
+    reader.size = bytes->size();
+#endif
+    reader.parse(); // on failure the reader's destructor releases the bytes
+    return reader;
+}
+
+BinaryOutputReader::BinaryOutputReader(BinaryOutputReader &&other) noexcept
+{
+    *this = std::move(other);
+}
+
+BinaryOutputReader &BinaryOutputReader::operator=(BinaryOutputReader &&other) noexcept
+{
+    if (this != &other)
+    {
+        release();
+        data = other.data;
+        size = other.size;
+        mapping = other.mapping;
+        mapped = other.mapped;
+        strings = other.strings;
+        stringBytes = other.stringBytes;
+        tokens = other.tokens;
+        lineCheckpoints = other.lineCheckpoints;
+        lineStream = other.lineStream;
+        lineStreamEnd = other.lineStreamEnd;
+        symbols = other.symbols;
+        errors = other.errors;
+        other.mapping = nullptr;
+        other.mapped = false;
+    }
+    return *this;
+}
+
+BinaryOutputReader::~BinaryOutputReader()
+{
+    release();
+}
+
+void BinaryOutputReader::release()
+{
+    if (!mapping)
+        return;
+#ifndef _WIN32
+    if (mapped)
+        munmap(mapping, size);
+#else
+    delete static_cast<std::string *>(mapping);
+#endif
+    mapping = nullptr;
+    mapped = false;
+}
+
+void BinaryOutputReader::parse()
+{
+    auto fail = [](const char *why)
+    { throw std::runtime_error(std::string("Invalid binary compile output: ") + why); };
+
+    if (size < headerSize || memcmp(data, binfmt::magic, sizeof(binfmt::magic)) != 0)
+        fail("bad magic");
+    if (loadU32(data + 4) != binfmt::version)
+        fail("unsupported version");
+    size_t sectionCount = loadU32(data + 8);
+    if (sectionCount > (size - headerSize) / directoryEntrySize)
+        fail("truncated directory");
+
+    // Each table is a u32 count followed by `count` records of `recordSize`
+    auto table = [&](const uint8_t *begin, const uint8_t *end, size_t recordSize)
+    {
+        if (end - begin < 4)
+            fail("truncated section");
+        Table t;
+        t.count = loadU32(begin);
+        t.records = begin + 4;
+        if (t.count > static_cast<size_t>(end - t.records) / recordSize)
+            fail("truncated section");
+        return t;
+    };
+
+    bool haveStrings = false;
+    for (size_t s = 0; s < sectionCount; s++)
+    {
+        const uint8_t *entry = data + headerSize + s * directoryEntrySize;
+        uint32_t id = loadU32(entry);
+        uint64_t offset = loadU64(entry + 8);
+        uint64_t length = loadU64(entry + 16);
+        if (offset > size || length > size - offset)
+            fail("section out of bounds");
+        const uint8_t *begin = data + offset;
+        const uint8_t *end = begin + length;
+
+        switch (static_cast<binfmt::SectionId>(id))
+        {
+        case binfmt::SectionId::Strings:
+        {
+            // count + 1 offsets, then the bytes they index
+            strings = table(begin, end, 4);
+            if (static_cast<size_t>(end - strings.records) < (strings.count + 1) * 4)
+                fail("truncated string table");
+            stringBytes = strings.records + (strings.count + 1) * 4;
+            if (loadU32(strings.records + strings.count * 4) > static_cast<size_t>(end - stringBytes))
+                fail("truncated string table");
+            for (size_t i = 0; i < strings.count; i++)
+            {
+                if (loadU32(strings.records + i * 4) > loadU32(strings.records + (i + 1) * 4))
+                    fail("unordered string offsets");
+            }
+            haveStrings = true;
+            break;
+        }
+        case binfmt::SectionId::Tokens:
+            tokens = table(begin, end, tokenRecordSize);
+            break;
+        case binfmt::SectionId::Lines:
+            lineCheckpoints = table(begin, end, checkpointSize);
+            lineStream = lineCheckpoints.records + lineCheckpoints.count * checkpointSize;
+            lineStreamEnd = end;
+            break;
+        case binfmt::SectionId::Symbols:
+            symbols = table(begin, end, symbolRecordSize);
+            break;
+        case binfmt::SectionId::Errors:
+            errors = table(begin, end, errorRecordSize);
+            break;
+        default:
+            break; // newer optional section
+        }
+    }
+    if (!haveStrings)
+        fail("missing string table");
+    if (lineCheckpoints.count * binfmt::lineCheckpointInterval < tokens.count)
+        fail("missing line checkpoints");
+
+    // Every string reference must resolve, so the accessors need no checks
+    auto checkRef = [&](const uint8_t *p)
+    {
+        if (loadU32(p) >= strings.count)
+            fail("string index out of range");
+    };
+    for (size_t i = 0; i < tokens.count; i++)
+    {
+        checkRef(tokens.records + i * tokenRecordSize);
+        checkRef(tokens.records + i * tokenRecordSize + 4);
+        if (loadU32(tokens.records + i * tokenRecordSize + 12) > static_cast<uint32_t>(TokenType::DEDENT))
+            fail("unknown token type");
+    }
+    for (size_t i = 0; i < symbols.count; i++)
+    {
+        for (size_t field = 0; field < 4; field++)
+            checkRef(symbols.records + i * symbolRecordSize + field * 4);
+    }
+    for (size_t i = 0; i < errors.count; i++)
+        checkRef(errors.records + i * errorRecordSize);
+    for (size_t c = 0; c < lineCheckpoints.count; c++)
+    {
+        if (loadU32(lineCheckpoints.records + c * checkpointSize + 4) > static_cast<size_t>(lineStreamEnd - lineStream))
+            fail("line checkpoint out of range");
+    }
+}
+
+std::string_view BinaryOutputReader::string(uint32_t index) const
+{
+    uint32_t begin = loadU32(strings.records + index * 4);
+    uint32_t end = loadU32(strings.records + (index + 1) * 4);
+    return {reinterpret_cast<const char *>(stringBytes) + begin, end - begin};
+}
+
+int BinaryOutputReader::tokenLine(size_t index) const
+{
+    size_t checkpoint = index / binfmt::lineCheckpointInterval;
+    const uint8_t *cp = lineCheckpoints.records + checkpoint * checkpointSize;
+    int line = static_cast<int>(loadU32(cp));
+    const uint8_t *p = lineStream + loadU32(cp + 4);
+    for (size_t i = checkpoint * binfmt::lineCheckpointInterval; i < index; i++)
+    {
+        uint32_t v = 0;
+        for (int shift = 0; p < lineStreamEnd && shift < 35; shift += 7)
+        {
+            uint8_t byte = *p++;
+            v |= uint32_t(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+                break;
+        }
+        line += unzigzag(v);
+    }
+    return line;
+}
+
+BinaryOutputReader::TokenView BinaryOutputReader::token(size_t index) const
+{
+    const uint8_t *r = tokens.records + index * tokenRecordSize;
+    return {static_cast<TokenType>(loadU32(r + 12)), string(loadU32(r)), string(loadU32(r + 4)),
+            loadU32(r + 8), tokenLine(index)};
+}
+
+BinaryOutputReader::SymbolView BinaryOutputReader::symbol(size_t index) const
+{
+    const uint8_t *r = symbols.records + index * symbolRecordSize;
+    return {string(loadU32(r)), string(loadU32(r + 4)), string(loadU32(r + 8)), string(loadU32(r + 12)),
+            static_cast<int>(loadU32(r + 16)), static_cast<int>(loadU32(r + 20)), static_cast<int>(loadU32(r + 24))};
+}
+
+BinaryOutputReader::ErrorView BinaryOutputReader::error(size_t index) const
+{
+    const uint8_t *r = errors.records + index * errorRecordSize;
+    return {string(loadU32(r)), static_cast<int>(loadU32(r + 4)), loadU64(r + 8)};
+}
@@ -0,0 +1,136 @@
+// binary_format.h
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "main.h"
+
+// ----------------------------------------------
+// Binary compile output
+// ----------------------------------------------
+// Little-endian file holding the token stream, the symbol table and the
+// errors of one compile:
+//
+//   header     magic "PYCB", u32 version, u32 section count, u32 reserved
+//   directory  per section: u32 id, u32 reserved, u64 offset, u64 size
+//   sections   each starts on an 8-byte boundary
+//
+// Every string (lexemes, scopes, names, types, values, messages) is stored
+// once in the string table and referenced by index. Tokens, symbols and
+// errors are fixed-size records, so the reader can index them in place;
+// token line numbers are the exception and live in a zigzag varint stream
+// of deltas with an absolute checkpoint every lineCheckpointInterval tokens.
+// Readers must reject a major version they don't know; unknown section ids
+// are skipped, so sections can be added without a version bump.
+namespace binfmt
+{
+constexpr char magic[4] = {'P', 'Y', 'C', 'B'};
+constexpr uint32_t version = 1;
+constexpr uint32_t lineCheckpointInterval = 64;
+
+enum class SectionId : uint32_t
+{
+    Strings = 1, // u32 count, u32 offsets[count + 1], bytes
+    Tokens = 2,  // u32 count, records[count]: u32 lexeme, u32 scope, u32 offset, u32 type
+    Lines = 3,   // u32 count, checkpoints[count]: u32 line, u32 stream offset, varint stream
+    Symbols = 4, // u32 count, records[count]: u32 name, scope, type, value; i32 entry, first line, uses; u32 pad
+    Errors = 5   // u32 count, records[count]: u32 message, i32 line, u64 position
+};
+}
+
+// Encodes one compile's results. Symbols are written in the given order,
+// their values cut out of `source`, the text that was compiled.
+std::string writeBinaryOutput(const std::vector<Token> &tokens,
+                              const std::vector<SymbolTable::SymbolRecord> &symbols,
+                              const std::vector<Error> &errors,
+                              const SourceView &source);
+bool saveBinaryOutput(const std::string &path, const std::vector<Token> &tokens,
+                      const std::vector<SymbolTable::SymbolRecord> &symbols,
+                      const std::vector<Error> &errors, const SourceView &source);
+
+// ----------------------------------------------
+// BinaryOutputReader: zero-copy view of an encoded file
+// ----------------------------------------------
+// Validates the header and directory up front, then answers every query
+// straight from the bytes: strings come back as string_views into the
+// buffer. The buffer must outlive the reader; open() maps the file
+// (or reads it, where mmap is unavailable) and keeps it alive itself.
+class BinaryOutputReader
+{
+public:
+    struct TokenView
+    {
+        TokenType type;
+        std::string_view lexeme;
+        std::string_view scope;
+        uint32_t offset;
+        int lineNumber;
+    };
+
+    struct SymbolView
+    {
+        std::string_view name;
+        std::string_view scope;
+        std::string_view type;
+        std::string_view value;
+        int entry;
+        int firstAppearance;
+        int usageCount;
+    };
+
+    struct ErrorView
+    {
+        std::string_view message;
+        int line;
+        uint64_t position;
+    };
+
+    // Throws std::runtime_error if the bytes are not a valid file
+    BinaryOutputReader(const uint8_t *data, size_t size);
+    static BinaryOutputReader open(const std::string &path);
+
+    BinaryOutputReader(BinaryOutputReader &&other) noexcept;
+    BinaryOutputReader &operator=(BinaryOutputReader &&other) noexcept;
+    BinaryOutputReader(const BinaryOutputReader &) = delete;
+    BinaryOutputReader &operator=(const BinaryOutputReader &) = delete;
+    ~BinaryOutputReader();
+
+    size_t stringCount() const { return strings.count; }
+    std::string_view string(uint32_t index) const;
+
+    size_t tokenCount() const { return tokens.count; }
+    TokenView token(size_t index) const;
+    int tokenLine(size_t index) const; // decodes at most one checkpoint interval
+
+    size_t symbolCount() const { return symbols.count; }
+    SymbolView symbol(size_t index) const;
+
+    size_t errorCount() const { return errors.count; }
+    ErrorView error(size_t index) const;
+
+private:
+    struct Table
+    {
+        const uint8_t *records = nullptr; // first record, after the count
+        size_t count = 0;
+    };
+
+    BinaryOutputReader() = default;
+    void parse();
+    void release();
+
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+    void *mapping = nullptr; // set when open() mapped or allocated the bytes
+    bool mapped = false;
+
+    Table strings; // records point at the offsets array
+    const uint8_t *stringBytes = nullptr;
+    Table tokens;
+    Table lineCheckpoints;
+    const uint8_t *lineStream = nullptr;
+    const uint8_t *lineStreamEnd = nullptr;
+    Table symbols;
+    Table errors;
+};
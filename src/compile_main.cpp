@@ -0,0 +1,315 @@
+// compile_main.cpp
+// Command-line compile of one file: errors to stderr, the symbol table to
+// stdout.
+//
+//   compiler_cli FILE [--max-memory MB] [--stats] [--quiet] [--binary OUT]
+//
+// The source is mapped rather than read onto the heap.
+// --max-memory MB caps the job's memory for shared build hosts. Tokens are
+// lexed into a CompressedTokens store rather than a vector. Once the
+// process's resident set passes three quarters of the budget, the source
+// pages already lexed are given back and the store's completed blocks go to
+// an unlinked temporary file; the Parser pages them back in through a
+// mapped window as it reads them. Past the same mark the symbol table moves
+// scopes the Parser has left to the file too, paging one back in if it is
+// reopened. Cross-references are not recorded, since nothing here reads
+// them, and lexing and parsing run one after the other rather than
+// pipelined. What stays resident (the string pool, the store's index, the
+// symbols of open scopes) sets a floor below which no budget can go: if the
+// peak resident set ends up over budget the compile says so on stderr and
+// exits with status 3.
+// --stats writes the compile metrics, with peak RSS and spill statistics,
+// to stderr as JSON.
+// --binary OUT also writes the tokens, symbols and errors as a PYCB file
+// (see binary_format.h), as the GUI's Export Binary does, then reads it
+// back through BinaryOutputReader and fails if any record differs. It
+// needs the token vector, so it can't be combined with --max-memory.
+#include "binary_format.h"
+#include "main.h"
+#include "metrics.h"
+#include "spill.h"
+#include "token_store.h"
+#include "utils.h"
+#include <cstdlib>
+#include <cstring>
+
+namespace
+{
+struct CliOptions
+{
+    string path;
+    size_t maxMemory = 0; // bytes; 0 is unlimited
+    bool stats = false;
+    bool quiet = false;
+    string binary; // PYCB output path; empty writes none
+
+    // Resident bytes past which memory is given back
+    size_t spillAt() const { return maxMemory / 4 * 3; }
+};
+
+bool parseOptions(int argc, char **argv, CliOptions &opt)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];
+        if (strcmp(arg, "--max-memory") == 0 && i + 1 < argc)
+        {
+            char *end = nullptr;
+            double mb = strtod(argv[++i], &end);
+            if (*end != '\0' || !(mb > 0))
+                return false;
+            opt.maxMemory = static_cast<size_t>(mb * 1024 * 1024);
+        }
+        else if (strcmp(arg, "--stats") == 0)
+            opt.stats = true;
+        else if (strcmp(arg, "--quiet") == 0)
+            opt.quiet = true;
+        else if (strcmp(arg, "--binary") == 0 && i + 1 < argc)
+            opt.binary = argv[++i];
+        else if (arg[0] != '-' && opt.path.empty())
+            opt.path = arg;
+        else
+            return false;
+    }
+    return !opt.path.empty() && (opt.binary.empty() || opt.maxMemory == 0);
+}
+
+// Lexes all of `source` into a store that spills to `spill`, then parses
+// from the store
+void compileWithBudget(MappedFile &file, const SourceView &source, vector<Error> &errors, SymbolTable &symbols,
+                       SpillFile &spill, const CliOptions &opt, CompileMetrics &metrics)
+{
+    PhaseTimer timer;
+    CompressedTokens store;
+    if (spill.open())
+    {
+        store.spillTo(spill, opt.spillAt(), &file);
+        symbols.spillTo(spill, opt.spillAt());
+    }
+    else
+    {
+        cerr << "warning: no spill file; everything stays in memory" << endl;
+    }
+    symbols.recordReferences = false;
+    vector<Error> lexErrors;
+    Lexer(symbols.strings()).tokenize(source, lexErrors, store);
+    metrics.lexMs = timer.lap();
+    metrics.tokens = store.size();
+    file.release(source.size()); // only printed values read it from here on
+
+    if (lexErrors.empty())
+    {
+        TokenStream stream(store);
+        Parser(stream, symbols).parse();
+    }
+    metrics.parseMs = timer.lap();
+    errors.insert(errors.end(), lexErrors.begin(), lexErrors.end());
+}
+
+// Writes `path` and checks that every record reads back as it went in
+bool exportBinary(const string &path, const vector<Token> &tokens,
+                  const vector<SymbolTable::SymbolRecord> &symbols, const vector<Error> &errors,
+                  const SourceView &source)
+{
+    try
+    {
+        if (!saveBinaryOutput(path, tokens, symbols, errors, source))
+        {
+            cerr << "error: could not write " << path << endl;
+            return false;
+        }
+        BinaryOutputReader reader = BinaryOutputReader::open(path);
+        auto differs = [&](const char *what, size_t index)
+        {
+            cerr << "error: " << path << ": " << what << " " << index << " reads back differently" << endl;
+            return false;
+        };
+        if (reader.tokenCount() != tokens.size() || reader.symbolCount() != symbols.size() ||
+            reader.errorCount() != errors.size())
+            return differs("record counts of compile", 0);
+        for (size_t i = 0; i < tokens.size(); i++)
+        {
+            const Token &tk = tokens[i];
+            const BinaryOutputReader::TokenView read = reader.token(i);
+            if (read.type != tk.type || read.lexeme != tk.lexeme.view() || read.scope != tk.scope.view() ||
+                read.offset != tk.offset || read.lineNumber != tk.lineNumber)
+                return differs("token", i);
+        }
+        for (size_t i = 0; i < symbols.size(); i++)
+        {
+            const SymbolTable::SymbolRecord &rec = symbols[i];
+            const BinaryOutputReader::SymbolView read = reader.symbol(i);
+            if (read.name != rec.name || read.scope != rec.info.scope || read.type != rec.info.type ||
+                read.value != spanText(source, rec.info.value) || read.entry != rec.info.entry ||
+                read.firstAppearance != rec.info.firstAppearance || read.usageCount != rec.info.usageCount)
+                return differs("symbol", i);
+        }
+        for (size_t i = 0; i < errors.size(); i++)
+        {
+            const BinaryOutputReader::ErrorView read = reader.error(i);
+            if (read.message != errors[i].message || read.line != errors[i].line ||
+                read.position != errors[i].position)
+                return differs("error", i);
+        }
+    }
+    catch (const exception &e)
+    {
+        cerr << "error: " << path << ": " << e.what() << endl;
+        return false;
+    }
+    return true;
+}
+
+// Passes output on to `out`. Printed values read the source, faulting its
+// pages back in, so every releaseStep bytes of output, if the process is
+// over `limit`, the file's pages are given back again.
+class ReleasingOutput : public streambuf
+{
+public:
+    ReleasingOutput(streambuf *out, MappedFile &file, size_t limit)
+        : out(out), file(file), limit(limit) {}
+
+protected:
+    int overflow(int c) override
+    {
+        if (c == traits_type::eof())
+            return traits_type::not_eof(c);
+        wrote(1);
+        return out->sputc(static_cast<char>(c));
+    }
+    streamsize xsputn(const char *s, streamsize n) override
+    {
+        wrote(static_cast<size_t>(n));
+        return out->sputn(s, n);
+    }
+    int sync() override { return out->pubsync(); }
+
+private:
+    static constexpr size_t releaseStep = 1 << 20;
+
+    streambuf *out;
+    MappedFile &file;
+    size_t limit;
+    size_t untilCheck = releaseStep;
+
+    void wrote(size_t n)
+    {
+        if (n < untilCheck)
+        {
+            untilCheck -= n;
+            return;
+        }
+        untilCheck = releaseStep;
+        if (residentBytes() >= limit)
+            file.release(file.text().size());
+    }
+};
+} // namespace
+
+int main(int argc, char **argv)
+{
+    CliOptions opt;
+    if (!parseOptions(argc, argv, opt))
+    {
+        cerr << "usage: compiler_cli FILE [--max-memory MB] [--stats] [--quiet] [--binary OUT]" << endl;
+        return 2;
+    }
+
+    CompileMetrics metrics;
+    metrics.memoryBudget = opt.maxMemory;
+    const AllocationCounts allocationsBefore = threadAllocations();
+    AllocationCounts lexAllocations; // made on lexAndParse's lexer thread
+    PhaseTimer timer;
+    unique_ptr<MappedFile> file;
+    try
+    {
+        file = make_unique<MappedFile>(opt.path);
+    }
+    catch (const exception &e)
+    {
+        cerr << e.what() << endl;
+        return 1;
+    }
+    SourceView source{file->text()};
+    metrics.sourceBytes = source.size();
+    metrics.loadMs = timer.lap();
+
+    vector<Error> errors;
+    SymbolTable symbols;
+    SpillFile spill;
+    vector<Token> tokens; // kept only for --binary
+    try
+    {
+        if (opt.maxMemory > 0)
+        {
+            compileWithBudget(*file, source, errors, symbols, spill, opt, metrics);
+        }
+        else
+        {
+            double lexMs = 0;
+            vector<Token> lexed = lexAndParse(source, errors, symbols, &lexMs, &lexAllocations);
+            metrics.tokens = lexed.size();
+            if (!opt.binary.empty())
+                tokens = move(lexed);
+            metrics.lexMs = lexMs;
+            metrics.parseMs = max(timer.lap() - lexMs, 0.0);
+        }
+    }
+    catch (const UnterminatedStringError &e)
+    {
+        errors.push_back({"Unterminated string literal", e.line_number, e.index});
+    }
+    catch (const exception &e)
+    {
+        errors.push_back({e.what(), -1, 0});
+    }
+    timer.lap();
+
+    for (const Error &error : errors)
+        error.print();
+    // Symbols only count if tokenization succeeded
+    if (errors.empty())
+    {
+        metrics.symbols = symbols.symbolCount();
+        if (!opt.quiet && opt.maxMemory > 0)
+        {
+            ReleasingOutput releasing(cout.rdbuf(), *file, opt.spillAt());
+            ostream out(&releasing);
+            symbols.printSymbols(out, source);
+        }
+        else if (!opt.quiet)
+        {
+            symbols.printSymbols(cout, source);
+        }
+    }
+    // As in the GUI, symbols are exported only from a compile without errors
+    bool exported = true;
+    if (!opt.binary.empty())
+    {
+        vector<SymbolTable::SymbolRecord> records;
+        if (errors.empty())
+            records = symbols.records();
+        exported = exportBinary(opt.binary, tokens, records, errors, source);
+    }
+    metrics.reportMs = timer.lap();
+    metrics.peakResidentBytes = peakResidentBytes();
+
+    if (opt.stats)
+    {
+        metrics.errors = errors.size();
+        const AllocationCounts allocationsAfter = threadAllocations();
+        metrics.allocations.count = allocationsAfter.count - allocationsBefore.count + lexAllocations.count;
+        metrics.allocations.bytes = allocationsAfter.bytes - allocationsBefore.bytes + lexAllocations.bytes;
+        metrics.spill = spill.stats();
+        cerr << metrics.toJson();
+    }
+    if (!errors.empty() || !exported)
+        return 1;
+    if (opt.maxMemory > 0 && metrics.peakResidentBytes > opt.maxMemory)
+    {
+        cerr << "error: peak resident memory " << metrics.peakResidentBytes / (1024 * 1024)
+             << " MB exceeded the budget of " << opt.maxMemory / (1024 * 1024) << " MB" << endl;
+        return 3;
+    }
+    return 0;
+}
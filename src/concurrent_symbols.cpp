@@ -0,0 +1,114 @@
+// concurrent_symbols.cpp
+#include "concurrent_symbols.h"
+#include <algorithm>
+#include <functional>
+
+ConcurrentSymbolTable::ConcurrentSymbolTable(size_t stripeCount)
+    : stripes(new Stripe[std::max<size_t>(stripeCount, 1)]),
+      stripeCount(std::max<size_t>(stripeCount, 1))
+{
+}
+
+int ConcurrentSymbolTable::add(const std::string &name, SymbolTable::SymbolInfo info, Order order)
+{
+    return insert(name + "@" + info.scope, std::move(info), order);
+}
+
+int ConcurrentSymbolTable::insert(std::string key, SymbolTable::SymbolInfo &&info, Order order)
+{
+    Stripe &stripe = stripes[std::hash<std::string>()(key) % stripeCount];
+
+    Slot *slot;
+    {
+        std::lock_guard<std::mutex> hold(stripe.lock);
+        auto [it, inserted] = stripe.slots.try_emplace(std::move(key));
+        slot = &it->second;
+        if (inserted)
+            slot->id = nextId.fetch_add(1, std::memory_order_relaxed);
+        if (order < slot->created)
+        {
+            slot->created = order;
+            slot->firstAppearance = info.firstAppearance;
+        }
+        if (info.type != "unknown" && !(order < slot->typeSet))
+        {
+            slot->typeSet = order;
+            slot->type = std::move(info.type);
+        }
+        if (!info.value.empty() && !(order < slot->valueSet))
+        {
+            slot->valueSet = order;
+            slot->value = std::move(info.value);
+        }
+    }
+    // Slots are never erased while adds run, so the node outlives the lock
+    slot->usageCount.fetch_add(info.usageCount, std::memory_order_relaxed);
+    return slot->id;
+}
+
+std::vector<int> ConcurrentSymbolTable::publish(SymbolTable &part, uint32_t segment)
+{
+    return publish(part, {{1, segment}});
+}
+
+std::vector<int> ConcurrentSymbolTable::publish(SymbolTable &part,
+                                                const std::vector<std::pair<int, uint32_t>> &segmentStarts)
+{
+    std::vector<int> ids(part.nextEntry, 0);
+    while (!part.table.empty())
+    {
+        auto node = part.table.extract(part.table.begin());
+        int entry = node.mapped().entry;
+        // The last part to begin at or before this entry created it
+        auto next = std::upper_bound(segmentStarts.begin(), segmentStarts.end(),
+                                     std::make_pair(entry, UINT32_MAX));
+        uint32_t segment = next == segmentStarts.begin() ? 0 : (next - 1)->second;
+        ids[entry] = insert(std::move(node.key()), std::move(node.mapped()),
+                            {segment, static_cast<uint32_t>(entry)});
+    }
+    return ids;
+}
+
+std::vector<int> ConcurrentSymbolTable::merge(std::vector<SymbolTable::SymbolRecord> &out)
+{
+    struct Created
+    {
+        Order order;
+        const std::string *key;
+        Slot *slot;
+    };
+    std::vector<Created> ordered;
+    ordered.reserve(size());
+    for (size_t s = 0; s < stripeCount; s++)
+    {
+        for (auto &[key, slot] : stripes[s].slots)
+            ordered.push_back({slot.created, &key, &slot});
+    }
+    // Creation orders are distinct: one part never creates a key twice.
+    // Sorting copies of them keeps the comparisons out of the scattered slots.
+    std::sort(ordered.begin(), ordered.end(),
+              [](const Created &a, const Created &b)
+              { return a.order < b.order; });
+
+    std::vector<int> entryOf(ordered.size(), 0);
+    out.clear();
+    out.reserve(ordered.size());
+    for (auto &[order, key, slot] : ordered)
+    {
+        size_t at = key->find('@');
+        SymbolTable::SymbolRecord row;
+        row.name = key->substr(0, at);
+        row.info.entry = static_cast<int>(out.size()) + 1;
+        row.info.type = std::move(slot->type);
+        row.info.scope = key->substr(at + 1);
+        row.info.firstAppearance = slot->firstAppearance;
+        row.info.usageCount = slot->usageCount.load(std::memory_order_relaxed);
+        row.info.value = std::move(slot->value);
+        entryOf[slot->id] = row.info.entry;
+        out.push_back(std::move(row));
+    }
+    for (size_t s = 0; s < stripeCount; s++)
+        stripes[s].slots.clear();
+    nextId.store(0, std::memory_order_relaxed);
+    return entryOf;
+}
@@ -0,0 +1,87 @@
+// concurrent_symbols.h
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "main.h"
+
+// ----------------------------------------------
+// ConcurrentSymbolTable: one symbol table shared by parallel workers
+// ----------------------------------------------
+// Workers that analyse separate parts of a file each fill a private
+// SymbolTable, then add its symbols here, tagged with the Order in which a
+// serial run would have created them: the part's index in source order,
+// then the creation sequence inside the part. Keys are spread over
+// independently locked stripes and use counts are atomic, so workers only
+// contend when they hash to the same stripe at the same moment. merge()
+// numbers the symbols by Order, which makes its output identical to a
+// serial run no matter how the workers were scheduled.
+class ConcurrentSymbolTable
+{
+public:
+    struct Order
+    {
+        uint32_t segment;  // part of the file, in source order
+        uint32_t sequence; // creation order within the part
+
+        bool operator<(const Order &other) const
+        {
+            return segment != other.segment ? segment < other.segment : sequence < other.sequence;
+        }
+    };
+
+    explicit ConcurrentSymbolTable(size_t stripeCount = 64);
+
+    // Adds one part's view of `name` in `info.scope`: created there at
+    // `order`, used `info.usageCount` times, left with `info`'s type and
+    // value. The earliest creation supplies the first appearance; type and
+    // value come from the latest part that knows one, as the last
+    // assignment would in a serial run. Returns an id for the symbol that
+    // stays valid until merge(). Thread-safe.
+    int add(const std::string &name, SymbolTable::SymbolInfo info, Order order);
+    // add()s every symbol of a table that analysed the single part
+    // `segment`, moving them out of `part.table`; returns the id of each of
+    // its entries (index 0 unused)
+    std::vector<int> publish(SymbolTable &part, uint32_t segment);
+    // Same for a table that analysed several parts in order: each
+    // (first entry, segment) pair says where the entries of a part begin
+    std::vector<int> publish(SymbolTable &part,
+                             const std::vector<std::pair<int, uint32_t>> &segmentStarts);
+
+    size_t size() const { return nextId.load(std::memory_order_relaxed); }
+
+    // Moves the symbols, numbered from 1 in creation Order, into `out`
+    // (sorted by entry, like SymbolTable::records()) and returns the entry
+    // of each id. Call once every add() has returned; leaves the table empty.
+    std::vector<int> merge(std::vector<SymbolTable::SymbolRecord> &out);
+
+private:
+    struct Slot
+    {
+        int id = 0;
+        std::atomic<int> usageCount{0};
+        // The rest is guarded by the stripe's lock
+        Order created{UINT32_MAX, UINT32_MAX};
+        int firstAppearance = -1;
+        Order typeSet{0, 0};
+        std::string type = "unknown";
+        Order valueSet{0, 0};
+        SourceSpan value;
+    };
+
+    struct alignas(64) Stripe
+    {
+        std::mutex lock;
+        std::unordered_map<std::string, Slot> slots; // keyed "name@scope"
+    };
+
+    std::unique_ptr<Stripe[]> stripes;
+    size_t stripeCount;
+    std::atomic<int> nextId{0};
+
+    int insert(std::string key, SymbolTable::SymbolInfo &&info, Order order);
+};
@@ -0,0 +1,228 @@
+// corpus_gen.cpp
+#include "corpus_gen.h"
+#include <algorithm>
+#include <vector>
+
+namespace
+{
+class CorpusGenerator
+{
+public:
+    explicit CorpusGenerator(const CorpusOptions &options)
+        : opt(options), state(options.seed ? options.seed : 1) {}
+
+    // Emits the global header, `units` top-level def/class blocks of
+    // `statements` statements each, and a trailer that calls the functions.
+    std::string run(int units, int statements)
+    {
+        globals = {"counter", "items", "names", "limit"};
+        line(0, "\"\"\"");
+        line(0, "Generated corpus (seed " + std::to_string(opt.seed) + ")");
+        line(0, "\"\"\"");
+        line(0, "import math");
+        line(0, "counter = 0");
+        line(0, "items = " + literalOf(0, globals));
+        line(0, "names = " + literalOf(2, globals));
+        line(0, "limit = 100");
+        for (int unit = 0; unit < units; unit++)
+            emitUnit(unit, statements);
+        for (int unit = 0; unit < units; unit += 2)
+            line(0, "unit_" + std::to_string(unit) + "(counter, limit)");
+        return out;
+    }
+
+private:
+    uint32_t next()
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+    int below(int n) { return static_cast<int>(next() % static_cast<uint32_t>(n)); }
+    bool chance(double p) { return (next() & 0xFFFFFF) < p * 0x1000000; }
+
+    void line(int indent, const std::string &text)
+    {
+        out.append(static_cast<size_t>(indent) * 4, ' ');
+        out += text;
+        out += '\n';
+    }
+
+    std::string freshName() { return "v" + std::to_string(nameCounter++); }
+
+    const std::string &pick(const std::vector<std::string> &names)
+    {
+        return names[static_cast<size_t>(below(static_cast<int>(names.size())))];
+    }
+
+    std::string element(const std::vector<std::string> &locals)
+    {
+        switch (below(3))
+        {
+        case 0:
+            return std::to_string(below(1000));
+        case 1:
+            return "\"s" + std::to_string(below(100)) + "\"";
+        default:
+            return pick(locals);
+        }
+    }
+
+    std::string elements(const std::vector<std::string> &locals)
+    {
+        std::string text;
+        for (int k = 0; k < opt.literalLength; k++)
+        {
+            if (k)
+                text += ", ";
+            text += element(locals);
+        }
+        return text;
+    }
+
+    // kind: 0 list, 1 dict, 2 set, 3 tuple, 4 string, 5 float, 6 int
+    std::string literalOf(int kind, const std::vector<std::string> &locals)
+    {
+        switch (kind)
+        {
+        case 0:
+            return "[" + elements(locals) + "]";
+        case 1:
+        {
+            std::string text = "{";
+            for (int k = 0; k < opt.literalLength; k++)
+            {
+                if (k)
+                    text += ", ";
+                text += "\"k" + std::to_string(k) + "\": " + element(locals);
+            }
+            return text + "}";
+        }
+        case 2:
+            return "{" + elements(locals) + "}";
+        case 3:
+            return "(" + elements(locals) + ")";
+        case 4:
+            return "\"text " + std::to_string(below(10000)) + "\"";
+        case 5:
+            return std::to_string(below(100)) + "." + std::to_string(below(100));
+        default:
+            return std::to_string(below(100000));
+        }
+    }
+
+    // One simple or compound statement; new names are appended to `locals`
+    void emitStatement(int indent, std::vector<std::string> &locals)
+    {
+        if (chance(opt.literalDensity))
+        {
+            std::string name = freshName();
+            line(indent, name + " = " + literalOf(below(7), locals));
+            locals.push_back(name);
+            return;
+        }
+        switch (below(8))
+        {
+        case 0:
+        case 1:
+        {
+            std::string name = freshName();
+            line(indent, name + " = " + pick(locals) + " + " + pick(locals) + " * " + std::to_string(below(10) + 1));
+            locals.push_back(name);
+            break;
+        }
+        case 2:
+        {
+            std::string a = freshName(), b = freshName();
+            line(indent, a + ", " + b + " = " + pick(locals) + ", " + std::to_string(below(100)));
+            locals.push_back(a);
+            locals.push_back(b);
+            break;
+        }
+        case 3:
+            line(indent, "print(" + elements(locals) + ")");
+            break;
+        case 4:
+        {
+            std::string name = freshName();
+            line(indent, "if " + pick(locals) + " > " + pick(globals) + ":");
+            line(indent + 1, name + " = " + pick(locals) + " - 1");
+            line(indent, "else:");
+            line(indent + 1, name + " = 0");
+            locals.push_back(name);
+            break;
+        }
+        case 5:
+        {
+            std::string name = freshName();
+            line(indent, "for " + name + " in " + pick(globals) + ":");
+            line(indent + 1, "counter += " + name);
+            break;
+        }
+        case 6:
+            line(indent, "# note " + std::to_string(below(1000)));
+            break;
+        default:
+            line(indent, "counter = counter + " + pick(locals));
+            break;
+        }
+    }
+
+    // Statements are shared between this level and the nested defs below it
+    void emitBody(int indent, int depth, int statements, std::vector<std::string> locals)
+    {
+        int here = depth < opt.maxDepth ? std::max(1, statements / (opt.maxDepth - depth + 1)) : statements;
+        for (int k = 0; k < here; k++)
+            emitStatement(indent, locals);
+        if (depth < opt.maxDepth && statements > here)
+        {
+            std::string inner = "inner_" + std::to_string(depth) + "_" + std::to_string(nameCounter++);
+            std::vector<std::string> params = {"a", "b"};
+            line(indent, "def " + inner + "(a, b):");
+            emitBody(indent + 1, depth + 1, statements - here, params);
+            line(indent, pick(locals) + " = " + inner + "(" + pick(locals) + ", " + pick(locals) + ")");
+        }
+        line(indent, "return " + pick(locals));
+    }
+
+    void emitUnit(int unit, int statements)
+    {
+        std::string id = std::to_string(unit);
+        if (unit % 2 == 0)
+        {
+            line(0, "def unit_" + id + "(x, y):");
+            line(1, "\"\"\"Unit " + id + "\"\"\"");
+            emitBody(1, 0, statements, {"x", "y"});
+        }
+        else
+        {
+            line(0, "class Unit" + id + ":");
+            line(1, "scale = " + id);
+            line(1, "def method_" + id + "(self, x, y):");
+            emitBody(2, 1, statements, {"x", "y"});
+        }
+        line(0, "");
+    }
+
+    const CorpusOptions &opt;
+    uint32_t state;
+    int nameCounter = 0;
+    std::vector<std::string> globals;
+    std::string out;
+};
+}
+
+std::string generateCorpus(const CorpusOptions &options)
+{
+    int units = std::max(1, options.scopeCount);
+
+    // A small trial run gives the average bytes per statement, which sets
+    // how many statements each unit needs to reach the target size.
+    const int trialStatements = 64;
+    size_t header = CorpusGenerator(options).run(0, 0).size();
+    size_t trial = CorpusGenerator(options).run(1, trialStatements).size() - header;
+    size_t perUnit = options.targetBytes > header ? (options.targetBytes - header) / units : 0;
+    int statements = static_cast<int>(std::max<size_t>(1, perUnit * trialStatements / std::max<size_t>(1, trial)));
+    return CorpusGenerator(options).run(units, statements);
+}
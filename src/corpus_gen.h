@@ -0,0 +1,22 @@
+// corpus_gen.h
+#pragma once
+#include <cstdint>
+#include <string>
+
+// ----------------------------------------------
+// Synthetic Python-subset corpus generator
+// ----------------------------------------------
+// Produces deterministic source in the subset the compiler understands, for
+// benchmarks and scaling checks. The same options and seed always give the
+// same text.
+struct CorpusOptions
+{
+    size_t targetBytes = 64 * 1024; // approximate output size
+    int scopeCount = 16;            // top-level def/class units
+    int maxDepth = 2;               // nested def levels inside each unit
+    double literalDensity = 0.3;    // share of statements assigning a literal
+    int literalLength = 6;          // elements per literal and arguments per call
+    uint32_t seed = 1;
+};
+
+std::string generateCorpus(const CorpusOptions &options);
@@ -1,4 +1,6 @@
 #include "gui.h"
+#include <algorithm>
+#include <cmath>
 #include <fstream>
 #include <cstring>
 #include <sstream>
@@ -12,6 +14,8 @@
 // Your compiler components
 #include "utils.h"
 #include "main.h"
+#include "binary_format.h"
+#include "trace.h"
 #include "ImGuiFileDialog.h"
 
 CompilerGUI::CompilerGUI() : window(nullptr)
@@ -31,6 +35,7 @@ CompilerGUI::CompilerGUI() : window(nullptr)
     }
     glfwMakeContextCurrent(window);
     glfwSwapInterval(1); // Enable vsync
+    setTraceThreadName("main");
 
     // Initialize ImGui
     IMGUI_CHECKVERSION();
@@ -41,11 +46,20 @@ CompilerGUI::CompilerGUI() : window(nullptr)
     // Setup Platform/Renderer backends
     ImGui_ImplGlfw_InitForOpenGL(window, true);
     ImGui_ImplOpenGL3_Init("#version 130");
+
+    workspace.onUpdate = []
+    { glfwPostEmptyEvent(); }; // redraw with the new index
+    search.onProgress = []
+    { glfwPostEmptyEvent(); };
 }
 
 CompilerGUI::~CompilerGUI()
 {
     // Cleanup
+    if (compileThread.joinable())
+        compileThread.join();
+    search.cancel(); // these threads post GLFW events too
+    workspace.close(); // its thread posts GLFW events
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();
@@ -68,233 +82,768 @@ void CompilerGUI::loadFile()
         config);
 }
 
-void printtokens(auto tokens, auto symbols)
+void CompilerGUI::openFile(const std::string &filePath)
+{
+    TraceScope trace("open file", filePath);
+    try
+    {
+        std::ifstream file(filePath);
+        if (file)
+        {
+            codeBuffer.assign(
+                (std::istreambuf_iterator<char>(file)),
+                std::istreambuf_iterator<char>());
+            document.assign(codeBuffer);
+            highlighter.setText(codeBuffer);
+            sourceChangedSinceCompile = true;
+            errors.clear(); // Clear errors when loading new file
+        }
+        else
+        {
+            errors.push_back({"Failed to open file: " + filePath, -1, 0});
+        }
+    }
+    catch (const std::exception &e)
+    {
+        errors.push_back({"File Error: " + std::string(e.what()), -1, 0});
+    }
+}
+
+void CompilerGUI::openWorkspace()
+{
+    IGFD::FileDialogConfig config;
+    config.path = ".";
+    config.flags = ImGuiFileDialogFlags_Modal;
+    // No filter: the dialog picks a directory
+    ImGuiFileDialog::Instance()->OpenDialog("ChooseWorkspaceDlg", "Choose Workspace", nullptr, config);
+}
+
+// Keeps codeBuffer sized to the text ImGui is editing so the editor can grow
+// without a fixed upper bound and without copying the buffer every frame, and
+// records the caret so the highlighting overlay can draw it.
+int CompilerGUI::editorCallback(ImGuiInputTextCallbackData *data)
 {
-    cout << "\n\nTokens:\n";
-    for (auto &tk : tokens)
+    CompilerGUI *gui = static_cast<CompilerGUI *>(data->UserData);
+    if (data->EventFlag == ImGuiInputTextFlags_CallbackResize)
+    {
+        gui->codeBuffer.resize(data->BufTextLen);
+        data->Buf = gui->codeBuffer.data();
+    }
+    else if (data->EventFlag == ImGuiInputTextFlags_CallbackAlways)
     {
-        cout << "< ";
-        switch (tk.type)
+        if (gui->pendingCursor >= 0)
         {
-        case TokenType::FalseKeyword:
-            cout << "FalseKeyword";
-            break;
-        case TokenType::NoneKeyword:
-            cout << "NoneKeyword";
-            break;
-        case TokenType::TrueKeyword:
-            cout << "TrueKeyword";
-            break;
-        case TokenType::AndKeyword:
-            cout << "AndKeyword";
-            break;
-        case TokenType::AsKeyword:
-            cout << "AsKeyword";
-            break;
-        case TokenType::AssertKeyword:
-            cout << "AssertKeyword";
-            break;
-        case TokenType::AsyncKeyword:
-            cout << "AsyncKeyword";
-            break;
-        case TokenType::AwaitKeyword:
-            cout << "AwaitKeyword";
-            break;
-        case TokenType::BreakKeyword:
-            cout << "BreakKeyword";
-            break;
-        case TokenType::ClassKeyword:
-            cout << "ClassKeyword";
-            break;
-        case TokenType::ContinueKeyword:
-            cout << "ContinueKeyword";
-            break;
-        case TokenType::DefKeyword:
-            cout << "DefKeyword";
-            break;
-        case TokenType::DelKeyword:
-            cout << "DelKeyword";
-            break;
-        case TokenType::ElifKeyword:
-            cout << "ElifKeyword";
-            break;
-        case TokenType::ElseKeyword:
-            cout << "ElseKeyword";
-            break;
-        case TokenType::ExceptKeyword:
-            cout << "ExceptKeyword";
-            break;
-        case TokenType::FinallyKeyword:
-            cout << "FinallyKeyword";
-            break;
-        case TokenType::ForKeyword:
-            cout << "ForKeyword";
-            break;
-        case TokenType::FromKeyword:
-            cout << "FromKeyword";
-            break;
-        case TokenType::GlobalKeyword:
-            cout << "GlobalKeyword";
-            break;
-        case TokenType::IfKeyword:
-            cout << "IfKeyword";
-            break;
-        case TokenType::ImportKeyword:
-            cout << "ImportKeyword";
-            break;
-        case TokenType::InKeyword:
-            cout << "InKeyword";
-            break;
-        case TokenType::IsKeyword:
-            cout << "IsKeyword";
-            break;
-        case TokenType::LambdaKeyword:
-            cout << "LambdaKeyword";
-            break;
-        case TokenType::NonlocalKeyword:
-            cout << "NonlocalKeyword";
-            break;
-        case TokenType::NotKeyword:
-            cout << "NotKeyword";
-            break;
-        case TokenType::OrKeyword:
-            cout << "OrKeyword";
-            break;
-        case TokenType::PassKeyword:
-            cout << "PassKeyword";
-            break;
-        case TokenType::RaiseKeyword:
-            cout << "RaiseKeyword";
-            break;
-        case TokenType::ReturnKeyword:
-            cout << "ReturnKeyword";
-            break;
-        case TokenType::TryKeyword:
-            cout << "TryKeyword";
-            break;
-        case TokenType::WhileKeyword:
-            cout << "WhileKeyword";
-            break;
-        case TokenType::WithKeyword:
-            cout << "WithKeyword";
-            break;
-        case TokenType::YieldKeyword:
-            cout << "YieldKeyword";
-            break;
-        case TokenType::IDENTIFIER:
-            cout << "IDENTIFIER";
-            break;
-        case TokenType::NUMBER:
-            cout << "NUMBER";
-            break;
-        case TokenType::OPERATOR:
-            cout << "OPERATOR";
-            break;
-        case TokenType::LeftParenthesis:
-            cout << "LeftParenthesis";
-            break;
-        case TokenType::RightParenthesis:
-            cout << "RightParenthesis";
-            break;
-        case TokenType::LeftBracket:
-            cout << "LeftBracket";
-            break;
-        case TokenType::RightBracket:
-            cout << "RightBracket";
-            break;
-        case TokenType::LeftBrace:
-            cout << "LeftBrace";
-            break;
-        case TokenType::RightBrace:
-            cout << "RightBrace";
-            break;
-        case TokenType::Colon:
-            cout << "Colon";
-            break;
-        case TokenType::Comma:
-            cout << "Comma";
-            break;
-        case TokenType::Dot:
-            cout << "Dot";
-            break;
-        case TokenType::Semicolon:
-            cout << "Semicolon";
-            break;
-        case TokenType::STRING_LITERAL:
-            cout << "STRING_LITERAL";
-            break;
-        case TokenType::INDENT:
-            cout << "INDENT";
-            break;
-        case TokenType::DEDENT:
-            cout << "DEDENT";
-            break;
-        case TokenType::UNKNOWN:
-            cout << "UNKNOWN";
-            break;
+            data->CursorPos = std::min(gui->pendingCursor, data->BufTextLen);
+            data->SelectionStart = data->SelectionEnd = data->CursorPos;
+            gui->pendingCursor = -1;
         }
-        cout << ", ";
+        gui->editorCursor = data->CursorPos;
+    }
+    return 0;
+}
+
+// Editor colors, indexed by SyntaxHighlighter::Style
+static const ImU32 styleColors[] = {
+    IM_COL32(212, 212, 212, 255), // Default
+    IM_COL32(197, 134, 192, 255), // Keyword
+    IM_COL32(156, 220, 254, 255), // Identifier
+    IM_COL32(181, 206, 168, 255), // Number
+    IM_COL32(206, 145, 120, 255), // String
+    IM_COL32(212, 212, 212, 255), // Operator
+    IM_COL32(170, 170, 170, 255), // Punctuation
+    IM_COL32(106, 153, 85, 255),  // Comment
+    IM_COL32(244, 71, 71, 255),   // Error
+};
+static_assert(sizeof(styleColors) / sizeof(styleColors[0]) ==
+                  static_cast<size_t>(SyntaxHighlighter::Style::Count),
+              "styleColors must cover every highlight style");
+
+// Writes the token stream as text. Lines are assembled into one buffer and
+// written with a single call instead of flushing per token.
+static bool writeTokenDump(const std::string &path, const std::vector<Token> &tokens,
+                           const std::vector<int> &tokenEntries)
+{
+    TraceScope trace("writeTokenDump", path);
+    std::string out;
+    out.reserve(tokens.size() * 48);
+    for (size_t i = 0; i < tokens.size(); i++)
+    {
+        const Token &tk = tokens[i];
+        out += "< ";
+        out += tokenTypeName(tk.type);
+        out += ", ";
         if (tk.type == TokenType::IDENTIFIER)
         {
-            string key = tk.lexeme + "@" + tk.scope;
-            if (symbols.table.find(key) != symbols.table.end())
-            {
-                cout << "symbol table entry : " << symbols.table[key].entry;
-            }
+            if (tokenEntries[i] > 0)
+                out += "symbol table entry : " + std::to_string(tokenEntries[i]);
             else
-            {
-                cout << "symbol table entry: not found";
-            }
+                out += "symbol table entry: not found";
         }
         else
         {
-            cout << tk.lexeme;
+            out += tk.lexeme;
         }
-        cout << " > ";
-        cout << " | LINE NUMBER: " << tk.lineNumber << endl;
+        out += " >  | LINE NUMBER: ";
+        out += std::to_string(tk.lineNumber);
+        out += '\n';
     }
-    cout << endl;
+
+    std::ofstream file(path, std::ios::binary);
+    file.write(out.data(), static_cast<std::streamsize>(out.size()));
+    return static_cast<bool>(file);
 }
 
-void CompilerGUI::compile()
+// Runs on compileThread against an immutable snapshot, so the user can keep
+// editing while it works.
+CompilerGUI::CompileResult CompilerGUI::runCompile(const TextBuffer::Snapshot &snapshot)
 {
-    errors.clear(); // Clear previous errors
+    CompileResult result;
+    CompileMetrics &metrics = result.metrics;
+    const AllocationCounts allocationsBefore = threadAllocations();
+    AllocationCounts lexAllocations;
+    PhaseTimer timer;
     try
     {
-        // Use your existing compiler logic with error collection
-        SymbolTable symbols;
+        result.source = std::make_shared<SourceView>(snapshot);
+        const SourceView &source = *result.source;
+        metrics.sourceBytes = source.size();
+        metrics.loadMs = timer.lap();
+
+        // Use your existing compiler logic with error collection. The parser
+        // runs alongside the lexer, so parseMs is what it adds after lexing ends
+        // (and why this is not parseParallel(); see lexAndParse()).
+        result.strings = std::make_shared<StringPool>();
+        SymbolTable symbols(*result.strings);
         std::vector<Error> tokenErrors;
-        auto tokens = Lexer().tokenize(codeBuffer, tokenErrors);
+        double lexMs = 0;
+        auto tokens = lexAndParse(source, tokenErrors, symbols, &lexMs, &lexAllocations);
+        double pipelineMs = timer.lap();
+        metrics.lexMs = lexMs;
+        metrics.parseMs = std::max(pipelineMs - lexMs, 0.0);
+        metrics.tokens = tokens.size();
         // Add tokenization errors to main error list
-        errors.insert(errors.end(), tokenErrors.begin(), tokenErrors.end());
+        result.errors.insert(result.errors.end(), tokenErrors.begin(), tokenErrors.end());
 
-        // Only proceed if no tokenization errors
-        if (errors.empty())
+        // Symbols only count if tokenization succeeded
+        if (result.errors.empty())
         {
-            Parser(tokens, symbols).parse();
+            metrics.symbols = symbols.table.size();
 
-            // Format symbol table output
-            std::stringstream ss;
-            symbols.printSymbols(ss);
-            symbolTableOutput = ss.str();
+            result.symbols = symbols.records();
+            result.references = std::move(symbols.references);
+            result.parsed = true;
         }
-        printtokens(tokens, symbols);
+
+        // Each identifier's symbol entry, as the parser resolved it
+        result.tokenEntries.assign(tokens.size(), 0);
+        for (size_t i = 0; i < tokens.size(); i++)
+        {
+            if (tokens[i].type != TokenType::IDENTIFIER)
+                continue;
+            const CrossReferenceIndex::Reference *ref = result.references.at(tokens[i].offset);
+            result.tokenEntries[i] = ref && ref->offset == tokens[i].offset ? ref->symbol : -1;
+        }
+        result.tokens = std::move(tokens);
+        metrics.reportMs = timer.lap();
     }
     catch (const UnterminatedStringError &e)
     {
-        errors.push_back({"Unterminated string literal", e.line_number, e.index});
+        result.errors.push_back({"Unterminated string literal", e.line_number, e.index});
     }
     catch (const std::exception &e)
     {
-        errors.push_back({e.what(), -1, 0}); // Generic error
+        result.errors.push_back({e.what(), -1, 0}); // Generic error
+    }
+
+    metrics.errors = result.errors.size();
+    const AllocationCounts allocationsAfter = threadAllocations();
+    metrics.allocations.count = allocationsAfter.count - allocationsBefore.count + lexAllocations.count;
+    metrics.allocations.bytes = allocationsAfter.bytes - allocationsBefore.bytes + lexAllocations.bytes;
+    return result;
+}
+
+void CompilerGUI::compile()
+{
+    if (compileRunning)
+        return;
+
+    compileRunning = true;
+    sourceChangedSinceCompile = false;
+    compileThread = std::thread([this, snapshot = document.snapshot()]()
+                                {
+                                    setTraceThreadName("compile");
+                                    {
+                                        TraceScope trace("compile");
+                                        compileResult = runCompile(snapshot);
+                                    }
+                                    compileRunning = false;
+                                    glfwPostEmptyEvent(); // wake the render loop
+                                });
+}
+
+void CompilerGUI::collectCompileResult()
+{
+    if (compileRunning || !compileThread.joinable())
+        return;
+
+    compileThread.join();
+    errors = std::move(compileResult.errors);
+    tokens = std::move(compileResult.tokens);
+    tokenEntries = std::move(compileResult.tokenEntries);
+    tokenStrings = compileResult.strings;
+    metrics = compileResult.metrics;
+    hasMetrics = true;
+    symbolsMatchTokens = compileResult.parsed;
+    if (compileResult.parsed)
+    {
+        symbolRecords = std::move(compileResult.symbols);
+        symbolStrings = compileResult.strings;
+        symbolSource = compileResult.source;
+        references = std::move(compileResult.references);
+        symbolViewDirty = true;
+    }
+    else
+    {
+        // The old index would point into text that is no longer there
+        references.clear();
+    }
+    compileResult = CompileResult();
+}
+
+enum SymbolColumn
+{
+    SymbolColumn_Entry,
+    SymbolColumn_Name,
+    SymbolColumn_Scope,
+    SymbolColumn_Type,
+    SymbolColumn_Line,
+    SymbolColumn_Usage,
+    SymbolColumn_Value
+};
+
+void CompilerGUI::rebuildSymbolView()
+{
+    symbolView.clear();
+    const std::string filter = symbolFilter;
+    for (size_t i = 0; i < symbolRecords.size(); i++)
+    {
+        const auto &rec = symbolRecords[i];
+        if (filter.empty() ||
+            rec.name.find(filter) != std::string::npos ||
+            rec.info.scope.find(filter) != std::string::npos ||
+            rec.info.type.find(filter) != std::string::npos)
+        {
+            symbolView.push_back(static_cast<int>(i));
+        }
+    }
+
+    // Records arrive ordered by entry, so a stable sort keeps ties in entry order
+    const auto &recs = symbolRecords;
+    auto key = [&](int a, int b)
+    {
+        const auto &x = recs[a].info;
+        const auto &y = recs[b].info;
+        switch (symbolSortColumn)
+        {
+        case SymbolColumn_Name:
+            return recs[a].name < recs[b].name;
+        case SymbolColumn_Scope:
+            return x.scope < y.scope;
+        case SymbolColumn_Type:
+            return x.type < y.type;
+        case SymbolColumn_Line:
+            return x.firstAppearance < y.firstAppearance;
+        case SymbolColumn_Usage:
+            return x.usageCount < y.usageCount;
+        default:
+            return x.entry < y.entry;
+        }
+    };
+    if (symbolSortDescending)
+        std::stable_sort(symbolView.begin(), symbolView.end(), [&](int a, int b)
+                         { return key(b, a); });
+    else
+        std::stable_sort(symbolView.begin(), symbolView.end(), key);
+    symbolViewDirty = false;
+}
+
+void CompilerGUI::renderSymbolTable()
+{
+    ImGui::Text("Symbol Table:");
+    ImGui::SameLine();
+    ImGui::SetNextItemWidth(200);
+    if (ImGui::InputTextWithHint("##SymbolFilter", "Filter", symbolFilter, sizeof(symbolFilter)))
+        symbolViewDirty = true;
+    ImGui::SameLine();
+    ImGui::TextDisabled("%zu / %zu", symbolView.size(), symbolRecords.size());
+
+    const ImGuiTableFlags flags = ImGuiTableFlags_Sortable | ImGuiTableFlags_Resizable |
+                                  ImGuiTableFlags_RowBg | ImGuiTableFlags_Borders |
+                                  ImGuiTableFlags_ScrollY;
+    if (!ImGui::BeginTable("Symbols", 7, flags, ImVec2(0, 200)))
+        return;
+
+    ImGui::TableSetupScrollFreeze(0, 1);
+    ImGui::TableSetupColumn("Entry", ImGuiTableColumnFlags_DefaultSort | ImGuiTableColumnFlags_WidthFixed, 0, SymbolColumn_Entry);
+    ImGui::TableSetupColumn("Name", ImGuiTableColumnFlags_WidthStretch, 0, SymbolColumn_Name);
+    ImGui::TableSetupColumn("Scope", ImGuiTableColumnFlags_WidthStretch, 0, SymbolColumn_Scope);
+    ImGui::TableSetupColumn("Type", ImGuiTableColumnFlags_WidthFixed, 0, SymbolColumn_Type);
+    ImGui::TableSetupColumn("Line", ImGuiTableColumnFlags_WidthFixed, 0, SymbolColumn_Line);
+    ImGui::TableSetupColumn("Uses", ImGuiTableColumnFlags_WidthFixed, 0, SymbolColumn_Usage);
+    ImGui::TableSetupColumn("Value", ImGuiTableColumnFlags_WidthStretch | ImGuiTableColumnFlags_NoSort, 0, SymbolColumn_Value);
+    ImGui::TableHeadersRow();
+
+    if (ImGuiTableSortSpecs *specs = ImGui::TableGetSortSpecs())
+    {
+        if (specs->SpecsDirty && specs->SpecsCount > 0)
+        {
+            symbolSortColumn = static_cast<int>(specs->Specs[0].ColumnUserID);
+            symbolSortDescending = specs->Specs[0].SortDirection == ImGuiSortDirection_Descending;
+            symbolViewDirty = true;
+        }
+        specs->SpecsDirty = false;
+    }
+    if (symbolViewDirty)
+        rebuildSymbolView();
+
+    // Only rows inside the scroll window are laid out
+    ImGuiListClipper clipper;
+    clipper.Begin(static_cast<int>(symbolView.size()));
+    while (clipper.Step())
+    {
+        for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; row++)
+        {
+            const auto &rec = symbolRecords[symbolView[row]];
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::Text("%d", rec.info.entry);
+            ImGui::TableNextColumn();
+            ImGui::TextUnformatted(rec.name.c_str());
+            ImGui::TableNextColumn();
+            ImGui::TextUnformatted(rec.info.scope.c_str());
+            ImGui::TableNextColumn();
+            ImGui::TextUnformatted(rec.info.type.c_str());
+            ImGui::TableNextColumn();
+            ImGui::Text("%d", rec.info.firstAppearance);
+            ImGui::TableNextColumn();
+            ImGui::Text("%d", rec.info.usageCount);
+            ImGui::TableNextColumn();
+            // First line only; docstrings and big literals stay one row tall
+            const std::string value = spanText(*symbolSource, rec.info.value, 120);
+            ImGui::TextUnformatted(value.data(), value.data() + std::min(value.find('\n'), value.size()));
+        }
+    }
+    ImGui::EndTable();
+}
+
+void CompilerGUI::renderEditor()
+{
+    const ImGuiStyle &style = ImGui::GetStyle();
+    const float lineHeight = ImGui::GetTextLineHeight();
+    const float charWidth = ImGui::CalcTextSize(" ").x;
+    const size_t lineCount = highlighter.lineCount();
+
+    // The input widget is sized to the whole text so it never scrolls on its
+    // own; this child does the scrolling, which tells us the visible lines.
+    ImGui::BeginChild("##EditorScroll", ImVec2(-1, ImGui::GetContentRegionAvail().y * 0.4f), true,
+                      ImGuiWindowFlags_HorizontalScrollbar);
+    const ImVec2 avail = ImGui::GetContentRegionAvail();
+    const ImVec2 size(std::max(avail.x, (highlighter.longestLine(codeBuffer) + 2) * charWidth + style.FramePadding.x * 2),
+                      std::max(avail.y, (lineCount + 1) * lineHeight + style.FramePadding.y * 2));
+    const ImVec2 origin = ImGui::GetCursorScreenPos();
+    const ImVec2 textOrigin(origin.x + style.FramePadding.x, origin.y + style.FramePadding.y);
+    const float scrollX = ImGui::GetScrollX();
+    const float scrollY = ImGui::GetScrollY();
+    const float viewWidth = ImGui::GetWindowWidth();
+    const float viewHeight = ImGui::GetWindowHeight();
+
+    // Colored text goes underneath a transparent InputTextMultiline, which
+    // still handles all editing, selection and clipboard work.
+    ImDrawList *drawList = ImGui::GetWindowDrawList();
+    drawList->AddRectFilled(origin, ImVec2(origin.x + size.x, origin.y + size.y),
+                            ImGui::GetColorU32(ImGuiCol_FrameBg));
+    size_t firstLine = static_cast<size_t>(std::max(0.0f, scrollY - style.FramePadding.y) / lineHeight);
+    size_t lastLine = std::min(lineCount, firstLine + static_cast<size_t>(viewHeight / lineHeight) + 2);
+    for (size_t line = firstLine; line < lastLine; line++)
+    {
+        std::string_view text = highlighter.lineText(codeBuffer, line);
+        ImVec2 pos(textOrigin.x, textOrigin.y + line * lineHeight);
+        for (const auto &span : highlighter.spans(codeBuffer, line))
+        {
+            const char *begin = text.data() + span.start;
+            const char *end = begin + span.length;
+            drawList->AddText(pos, styleColors[static_cast<size_t>(span.style)], begin, end);
+            pos.x += ImGui::CalcTextSize(begin, end).x;
+        }
+    }
+
+    // The widget's own caret is drawn in the (transparent) text color
+    size_t caretLine = highlighter.lineOfOffset(static_cast<size_t>(editorCursor));
+    std::string_view caretText = highlighter.lineText(codeBuffer, caretLine);
+    size_t caretColumn = std::min(static_cast<size_t>(editorCursor) - highlighter.lineStart(caretLine), caretText.size());
+    float caretX = style.FramePadding.x + ImGui::CalcTextSize(caretText.data(), caretText.data() + caretColumn).x;
+    float caretY = style.FramePadding.y + caretLine * lineHeight;
+    if (editorActive && std::fmod(glfwGetTime(), 1.2) < 0.8)
+    {
+        drawList->AddRectFilled(ImVec2(origin.x + caretX, origin.y + caretY),
+                                ImVec2(origin.x + caretX + 1.0f, origin.y + caretY + lineHeight),
+                                styleColors[0]);
+    }
+
+    if (pendingCursor >= 0)
+        ImGui::SetKeyboardFocusHere(); // the callback applies the caret once active
+    ImGui::PushStyleColor(ImGuiCol_FrameBg, IM_COL32(0, 0, 0, 0));
+    ImGui::PushStyleColor(ImGuiCol_Text, IM_COL32(0, 0, 0, 0));
+    bool changed = ImGui::InputTextMultiline("##Code", codeBuffer.data(), codeBuffer.capacity() + 1, size,
+                                             ImGuiInputTextFlags_CallbackResize | ImGuiInputTextFlags_CallbackAlways,
+                                             editorCallback, this);
+    ImGui::PopStyleColor(2);
+    editorActive = ImGui::IsItemActive();
+
+    if (changed)
+    {
+        // Fold this frame's edit into the document as one replace and
+        // invalidate only the highlighted lines it touched
+        TextBuffer::Edit edit;
+        if (document.reconcile(codeBuffer, &edit))
+        {
+            highlighter.applyEdit(codeBuffer, edit.offset, edit.removed, edit.inserted);
+            sourceChangedSinceCompile = true;
+        }
+    }
+
+    // Follow the caret when it moves, but leave manual scrolling alone
+    if (editorActive && editorCursor != lastEditorCursor)
+    {
+        if (caretY < scrollY)
+            ImGui::SetScrollY(caretY);
+        else if (caretY + lineHeight * 2 > scrollY + viewHeight)
+            ImGui::SetScrollY(caretY + lineHeight * 2 - viewHeight);
+        if (caretX < scrollX)
+            ImGui::SetScrollX(caretX);
+        else if (caretX + charWidth * 4 > scrollX + viewWidth)
+            ImGui::SetScrollX(caretX + charWidth * 4 - viewWidth);
+        lastEditorCursor = editorCursor;
+    }
+    ImGui::EndChild();
+}
+
+void CompilerGUI::renderTokenPanel()
+{
+    if (!ImGui::CollapsingHeader("Tokens"))
+        return;
+
+    ImGui::TextDisabled("%zu tokens", tokens.size());
+    const ImGuiTableFlags flags = ImGuiTableFlags_Resizable | ImGuiTableFlags_RowBg |
+                                  ImGuiTableFlags_Borders | ImGuiTableFlags_ScrollY;
+    if (!ImGui::BeginTable("TokenStream", 4, flags, ImVec2(0, 200)))
+        return;
+
+    ImGui::TableSetupScrollFreeze(0, 1);
+    ImGui::TableSetupColumn("#", ImGuiTableColumnFlags_WidthFixed);
+    ImGui::TableSetupColumn("Type", ImGuiTableColumnFlags_WidthFixed);
+    ImGui::TableSetupColumn("Lexeme / Entry", ImGuiTableColumnFlags_WidthStretch);
+    ImGui::TableSetupColumn("Line", ImGuiTableColumnFlags_WidthFixed);
+    ImGui::TableHeadersRow();
+
+    // Only visible rows get formatted
+    ImGuiListClipper clipper;
+    clipper.Begin(static_cast<int>(tokens.size()));
+    while (clipper.Step())
+    {
+        for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; row++)
+        {
+            const Token &tk = tokens[row];
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::Text("%d", row);
+            ImGui::TableNextColumn();
+            ImGui::TextUnformatted(tokenTypeName(tk.type));
+            ImGui::TableNextColumn();
+            if (tk.type == TokenType::IDENTIFIER)
+            {
+                if (tokenEntries[row] > 0)
+                    ImGui::Text("%s  (entry %d)", tk.lexeme.c_str(), tokenEntries[row]);
+                else
+                    ImGui::Text("%s  (not found)", tk.lexeme.c_str());
+            }
+            else
+            {
+                size_t shown = std::min(tk.lexeme.view().find('\n'), std::min<size_t>(tk.lexeme.size(), 120));
+                ImGui::TextUnformatted(tk.lexeme.data(), tk.lexeme.data() + shown);
+            }
+            ImGui::TableNextColumn();
+            ImGui::Text("%d", tk.lineNumber);
+        }
+    }
+    ImGui::EndTable();
+}
+
+// References to the symbol under the caret, from the last compile
+void CompilerGUI::renderReferencePanel()
+{
+    if (!ImGui::CollapsingHeader("References"))
+        return;
+
+    if (sourceChangedSinceCompile)
+    {
+        ImGui::TextDisabled("The source changed since the last compile; compile to update");
+        return;
+    }
+    const CrossReferenceIndex::Reference *here = references.at(static_cast<size_t>(editorCursor));
+    if (!here)
+    {
+        ImGui::TextDisabled("Place the caret on an identifier");
+        return;
+    }
+
+    std::string_view name(codeBuffer.data() + here->offset, here->length);
+    const CrossReferenceIndex::Reference *first = references.begin(here->symbol);
+    const CrossReferenceIndex::Reference *last = references.end(here->symbol);
+    const CrossReferenceIndex::Reference *def = references.definition(here->symbol);
+    ImGui::Text("%.*s  (entry %d): %d references", static_cast<int>(name.size()), name.data(),
+                here->symbol, static_cast<int>(last - first));
+    ImGui::SameLine();
+    if (ImGui::Button("Go to definition"))
+        pendingCursor = static_cast<int>(def->offset);
+
+    static const char *const kindNames[] = {"use", "assign", "def"};
+    if (!ImGui::BeginChild("ReferenceList", ImVec2(0, 120), true))
+    {
+        ImGui::EndChild();
+        return;
+    }
+    ImGuiListClipper clipper;
+    clipper.Begin(static_cast<int>(last - first));
+    while (clipper.Step())
+    {
+        for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; row++)
+        {
+            const CrossReferenceIndex::Reference &ref = first[row];
+            std::string_view text = highlighter.lineText(codeBuffer, static_cast<size_t>(ref.line - 1));
+            size_t indent = std::min(text.find_first_not_of(" \t"), text.size());
+            text = text.substr(indent, 120);
+            char label[192];
+            snprintf(label, sizeof(label), "%5d  %-6s %.*s##ref%d", ref.line, kindNames[static_cast<int>(ref.kind)],
+                     static_cast<int>(text.size()), text.data(), row);
+            if (ImGui::Selectable(label, &ref == here))
+                pendingCursor = static_cast<int>(ref.offset);
+        }
+    }
+    ImGui::EndChild();
+}
+
+// Definitions of a name across the open workspace
+void CompilerGUI::renderWorkspacePanel()
+{
+    if (!ImGui::CollapsingHeader("Workspace"))
+        return;
+
+    if (!workspace.isOpen())
+    {
+        ImGui::TextDisabled("File > Open Workspace... indexes a directory of .py files");
+        return;
+    }
+    const WorkspaceIndex::Status status = workspace.status();
+    ImGui::Text("%s: %zu files, %zu definitions%s", workspace.root().c_str(), status.files,
+                status.definitions, status.scanning ? " (indexing...)" : "");
+    ImGui::SetNextItemWidth(240);
+    ImGui::InputTextWithHint("##WorkspaceQuery", "Find definition", workspaceQuery, sizeof(workspaceQuery));
+    if (workspaceShownQuery != workspaceQuery || workspaceShownGeneration != status.generation)
+    {
+        workspaceShownQuery = workspaceQuery;
+        workspaceShownGeneration = status.generation;
+        workspaceResults = workspace.find(workspaceShownQuery);
+    }
+
+    if (!ImGui::BeginChild("WorkspaceResults", ImVec2(0, 120), true))
+    {
+        ImGui::EndChild();
+        return;
+    }
+    const size_t rootLength = workspace.root().size() + 1; // paths shown relative to it
+    ImGuiListClipper clipper;
+    clipper.Begin(static_cast<int>(workspaceResults.size()));
+    while (clipper.Step())
+    {
+        for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; row++)
+        {
+            const WorkspaceIndex::Location &location = workspaceResults[row];
+            const char *path = location.path.c_str() + std::min(rootLength, location.path.size());
+            char label[384];
+            snprintf(label, sizeof(label), "%s:%d  %-10s %s##ws%d", path, location.line,
+                     location.type.c_str(), location.scope.c_str(), row);
+            if (ImGui::Selectable(label))
+            {
+                openFile(location.path);
+                pendingCursor = static_cast<int>(location.offset);
+            }
+        }
+    }
+    ImGui::EndChild();
+}
+
+// The buffer comes first, so its matches are usually the first to show
+void CompilerGUI::startSearch()
+{
+    std::vector<TextSearch::Source> sources;
+    sources.push_back({std::string(), std::make_shared<const std::string>(codeBuffer)});
+    if (searchWorkspace && workspace.isOpen())
+    {
+        for (std::string &path : workspace.paths())
+            sources.push_back({std::move(path), nullptr});
+    }
+    searchResults.clear();
+    search.start(std::move(sources), searchQuery, static_cast<TextSearch::TokenClass>(searchTokenClass));
+}
+
+void CompilerGUI::renderSearchPanel()
+{
+    if (!ImGui::CollapsingHeader("Search"))
+        return;
+
+    ImGui::SetNextItemWidth(240);
+    bool run = ImGui::InputTextWithHint("##SearchQuery", "Find text", searchQuery, sizeof(searchQuery),
+                                        ImGuiInputTextFlags_EnterReturnsTrue);
+    ImGui::SameLine();
+    ImGui::SetNextItemWidth(110);
+    static const char *const tokenClassNames[] = {"Anywhere", "Identifiers", "Strings"};
+    run |= ImGui::Combo("##SearchTokens", &searchTokenClass, tokenClassNames, 3);
+    ImGui::SameLine();
+    if (workspace.isOpen())
+    {
+        run |= ImGui::Checkbox("Workspace", &searchWorkspace);
+        ImGui::SameLine();
+    }
+    run |= ImGui::Button("Find");
+    if (run)
+        startSearch();
+
+    search.take(searchResults);
+    const TextSearch::Status status = search.status();
+    if (status.total > 0)
+    {
+        ImGui::Text("%zu matches in %zu of %zu sources%s%s", searchResults.size(), status.searched, status.total,
+                    status.truncated ? " (stopped at the limit)" : "", status.running ? " (searching...)" : "");
+    }
+
+    if (!ImGui::BeginChild("SearchResults", ImVec2(0, 120), true))
+    {
+        ImGui::EndChild();
+        return;
+    }
+    const size_t rootLength = workspace.isOpen() ? workspace.root().size() + 1 : 0;
+    ImGuiListClipper clipper;
+    clipper.Begin(static_cast<int>(searchResults.size()));
+    while (clipper.Step())
+    {
+        for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; row++)
+        {
+            const TextSearch::Match &match = searchResults[row];
+            const char *path = match.path.empty() ? "buffer" : match.path.c_str();
+            if (rootLength > 0 && match.path.size() > rootLength &&
+                match.path.compare(0, rootLength - 1, workspace.root()) == 0)
+                path += rootLength; // relative to the workspace
+            std::string_view text = match.context;
+            size_t indent = std::min(text.find_first_not_of(" \t"), text.size());
+            text = text.substr(indent, 120);
+            char label[384];
+            snprintf(label, sizeof(label), "%s:%d:%d  %.*s##find%d", path, match.line, match.column,
+                     static_cast<int>(text.size()), text.data(), row);
+            if (ImGui::Selectable(label))
+            {
+                if (!match.path.empty())
+                    openFile(match.path);
+                pendingCursor = static_cast<int>(match.offset);
+            }
+        }
+    }
+    ImGui::EndChild();
+}
+
+void CompilerGUI::renderPerformancePanel()
+{
+    if (!ImGui::CollapsingHeader("Performance"))
+        return;
+
+    if (!hasMetrics)
+    {
+        ImGui::TextDisabled("No compile yet");
+        return;
+    }
+
+    const ImGuiTableFlags flags = ImGuiTableFlags_RowBg | ImGuiTableFlags_Borders | ImGuiTableFlags_SizingFixedFit;
+    if (ImGui::BeginTable("PhaseTimes", 3, flags))
+    {
+        ImGui::TableSetupColumn("Phase");
+        ImGui::TableSetupColumn("ms");
+        ImGui::TableSetupColumn("Share", ImGuiTableColumnFlags_WidthStretch);
+        ImGui::TableHeadersRow();
+
+        const double total = metrics.totalMs();
+        const std::pair<const char *, double> phases[] = {
+            {"Load", metrics.loadMs},
+            {"Lex", metrics.lexMs},
+            {"Parse", metrics.parseMs},
+            {"Report", metrics.reportMs},
+        };
+        for (const auto &[name, ms] : phases)
+        {
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::TextUnformatted(name);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.3f", ms);
+            ImGui::TableNextColumn();
+            ImGui::ProgressBar(total > 0 ? static_cast<float>(ms / total) : 0.0f, ImVec2(-1, 0), "");
+        }
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+        ImGui::TextUnformatted("Total");
+        ImGui::TableNextColumn();
+        ImGui::Text("%.3f", total);
+        ImGui::EndTable();
+    }
+
+    ImGui::Text("%zu bytes, %zu tokens, %zu symbols, %zu errors",
+                metrics.sourceBytes, metrics.tokens, metrics.symbols, metrics.errors);
+    ImGui::Text("Allocations: %llu (%.2f MB)",
+                static_cast<unsigned long long>(metrics.allocations.count),
+                metrics.allocations.bytes / (1024.0 * 1024.0));
+
+    if (ImGui::Button("Export JSON..."))
+    {
+        IGFD::FileDialogConfig config;
+        config.path = ".";
+        config.flags = ImGuiFileDialogFlags_Modal | ImGuiFileDialogFlags_ConfirmOverwrite;
+        ImGuiFileDialog::Instance()->OpenDialog("ExportMetricsDlg", "Export Metrics", ".json", config);
     }
 }
 
 void CompilerGUI::render()
 {
+    // ImGui settles hover and focus changes over a couple of frames, so keep
+    // drawing briefly after each wake-up before blocking again.
+    const int settleFrames = 3;
+    const double idleTimeout = 1.0;
+    const double caretBlinkTimeout = 0.4;
+
     while (!glfwWindowShouldClose(window))
     {
-        glfwPollEvents();
+        if (framesToRender > 0 || compileRunning)
+        {
+            glfwPollEvents();
+            if (framesToRender > 0)
+                framesToRender--;
+        }
+        else
+        {
+            // Nothing is changing on screen: sleep until input, a posted
+            // compile-finished event, or the caret needs to blink.
+            glfwWaitEventsTimeout(ImGui::GetIO().WantTextInput ? caretBlinkTimeout : idleTimeout);
+            framesToRender = settleFrames;
+        }
+        collectCompileResult();
 
         // Start new ImGui frame
         ImGui_ImplOpenGL3_NewFrame();
@@ -303,28 +852,80 @@ void CompilerGUI::render()
 
         // Handle file dialog
         if (ImGuiFileDialog::Instance()->Display("ChooseFileDlg"))
+        {
+            if (ImGuiFileDialog::Instance()->IsOk())
+            {
+                openFile(ImGuiFileDialog::Instance()->GetFilePathName());
+            }
+            ImGuiFileDialog::Instance()->Close();
+        }
+        if (ImGuiFileDialog::Instance()->Display("ChooseWorkspaceDlg"))
+        {
+            if (ImGuiFileDialog::Instance()->IsOk())
+            {
+                std::string dir = ImGuiFileDialog::Instance()->GetCurrentPath();
+                if (!workspace.open(dir))
+                    errors.push_back({"Not a directory: " + dir, -1, 0});
+            }
+            ImGuiFileDialog::Instance()->Close();
+        }
+        if (ImGuiFileDialog::Instance()->Display("ExportTokensDlg"))
+        {
+            if (ImGuiFileDialog::Instance()->IsOk())
+            {
+                std::string filePath = ImGuiFileDialog::Instance()->GetFilePathName();
+                if (!writeTokenDump(filePath, tokens, tokenEntries))
+                {
+                    errors.push_back({"Failed to write file: " + filePath, -1, 0});
+                }
+            }
+            ImGuiFileDialog::Instance()->Close();
+        }
+        if (ImGuiFileDialog::Instance()->Display("ExportBinaryDlg"))
         {
             if (ImGuiFileDialog::Instance()->IsOk())
             {
                 std::string filePath = ImGuiFileDialog::Instance()->GetFilePathName();
                 try
                 {
-                    std::ifstream file(filePath);
-                    if (file)
-                    {
-                        codeBuffer.assign(
-                            (std::istreambuf_iterator<char>(file)),
-                            std::istreambuf_iterator<char>());
-                        errors.clear(); // Clear errors when loading new file
-                    }
-                    else
-                    {
-                        errors.push_back({"Failed to open file: " + filePath, -1, 0});
-                    }
+                    // After a failed compile the symbols on screen are an
+                    // older compile's, so only the tokens and errors go out
+                    const std::vector<SymbolTable::SymbolRecord> noSymbols;
+                    const bool withSymbols = symbolsMatchTokens && symbolSource;
+                    if (!saveBinaryOutput(filePath, tokens, withSymbols ? symbolRecords : noSymbols, errors,
+                                          withSymbols ? *symbolSource : SourceView(std::string())))
+                        errors.push_back({"Failed to write file: " + filePath, -1, 0});
                 }
                 catch (const std::exception &e)
                 {
-                    errors.push_back({"File Error: " + std::string(e.what()), -1, 0});
+                    errors.push_back({e.what(), -1, 0});
+                }
+            }
+            ImGuiFileDialog::Instance()->Close();
+        }
+        if (ImGuiFileDialog::Instance()->Display("ExportMetricsDlg"))
+        {
+            if (ImGuiFileDialog::Instance()->IsOk())
+            {
+                std::string filePath = ImGuiFileDialog::Instance()->GetFilePathName();
+                TraceScope trace("export metrics", filePath);
+                std::ofstream file(filePath, std::ios::binary);
+                file << metrics.toJson();
+                if (!file)
+                {
+                    errors.push_back({"Failed to write file: " + filePath, -1, 0});
+                }
+            }
+            ImGuiFileDialog::Instance()->Close();
+        }
+        if (ImGuiFileDialog::Instance()->Display("ExportTraceDlg"))
+        {
+            if (ImGuiFileDialog::Instance()->IsOk())
+            {
+                std::string filePath = ImGuiFileDialog::Instance()->GetFilePathName();
+                if (!writeTraceJson(filePath))
+                {
+                    errors.push_back({"Failed to write file: " + filePath, -1, 0});
                 }
             }
             ImGuiFileDialog::Instance()->Close();
@@ -341,34 +942,91 @@ void CompilerGUI::render()
                 {
                     if (ImGui::MenuItem("Open"))
                         loadFile();
+                    if (ImGui::MenuItem("Open Workspace..."))
+                        openWorkspace();
+                    if (ImGui::MenuItem("Export Tokens...", nullptr, false, !tokens.empty()))
+                    {
+                        IGFD::FileDialogConfig config;
+                        config.path = ".";
+                        config.flags = ImGuiFileDialogFlags_Modal | ImGuiFileDialogFlags_ConfirmOverwrite;
+                        ImGuiFileDialog::Instance()->OpenDialog("ExportTokensDlg", "Export Tokens", ".txt", config);
+                    }
+                    if (ImGui::MenuItem("Export Binary...", nullptr, false, !tokens.empty() || !errors.empty()))
+                    {
+                        IGFD::FileDialogConfig config;
+                        config.path = ".";
+                        config.flags = ImGuiFileDialogFlags_Modal | ImGuiFileDialogFlags_ConfirmOverwrite;
+                        ImGuiFileDialog::Instance()->OpenDialog("ExportBinaryDlg", "Export Binary", ".pycb", config);
+                    }
+                    ImGui::EndMenu();
+                }
+                if (ImGui::BeginMenu("Edit"))
+                {
+                    if (ImGui::MenuItem("Undo", nullptr, false, document.canUndo()) && document.undo())
+                    {
+                        codeBuffer = document.toString();
+                        highlighter.setText(codeBuffer);
+                        sourceChangedSinceCompile = true;
+                    }
+                    if (ImGui::MenuItem("Redo", nullptr, false, document.canRedo()) && document.redo())
+                    {
+                        codeBuffer = document.toString();
+                        highlighter.setText(codeBuffer);
+                        sourceChangedSinceCompile = true;
+                    }
+                    ImGui::EndMenu();
+                }
+                if (ImGui::BeginMenu("Trace"))
+                {
+                    if (ImGui::MenuItem("Record", nullptr, traceEnabled()))
+                        setTraceEnabled(!traceEnabled());
+                    // Buffers may only be reset while no other thread records
+                    if (ImGui::MenuItem("Clear", nullptr, false, !compileRunning))
+                        clearTrace();
+                    if (ImGui::MenuItem("Export..."))
+                    {
+                        IGFD::FileDialogConfig config;
+                        config.path = ".";
+                        config.flags = ImGuiFileDialogFlags_Modal | ImGuiFileDialogFlags_ConfirmOverwrite;
+                        ImGuiFileDialog::Instance()->OpenDialog("ExportTraceDlg", "Export Trace", ".json", config);
+                    }
                     ImGui::EndMenu();
                 }
                 ImGui::EndMenuBar();
             }
 
             // Code editor
-            static char buffer[4096] = {0};
-            strncpy(buffer, codeBuffer.c_str(), sizeof(buffer));
-            if (ImGui::InputTextMultiline("##Code", buffer, sizeof(buffer),
-                                          ImVec2(-1, ImGui::GetContentRegionAvail().y * 0.4)))
-            {
-                codeBuffer = buffer;
-            }
+            renderEditor();
 
             // Compile button
             if (ImGui::Button("Compile", ImVec2(120, 30)))
             {
                 compile();
             }
+            if (compileRunning)
+            {
+                ImGui::SameLine();
+                ImGui::Text("Compiling%.*s", static_cast<int>(glfwGetTime() * 3) % 4, "...");
+            }
 
             // Symbol table display
             ImGui::Separator();
-            ImGui::Text("Symbol Table:");
-            if (ImGui::BeginChild("Symbols", ImVec2(0, 200), true))
-            {
-                ImGui::TextUnformatted(symbolTableOutput.c_str());
-                ImGui::EndChild();
-            }
+            renderSymbolTable();
+
+            ImGui::Separator();
+            renderTokenPanel();
+
+            ImGui::Separator();
+            renderReferencePanel();
+
+            ImGui::Separator();
+            renderWorkspacePanel();
+
+            ImGui::Separator();
+            renderSearchPanel();
+
+            ImGui::Separator();
+            renderPerformancePanel();
 
             // Error display section
             ImGui::Separator();
@@ -1,7 +1,17 @@
 #pragma once
+#include <atomic>
+#include <memory>
 #include <string>
+#include <thread>
 #include <GLFW/glfw3.h> // Add GLFW header
 #include "main.h"
+#include "text_buffer.h"
+#include "highlighter.h"
+#include "metrics.h"
+#include "search.h"
+#include "workspace.h"
+
+struct ImGuiInputTextCallbackData;
 
 class CompilerGUI
 {
@@ -12,12 +22,87 @@ public:
     void render();
 
 private:
+    // Output of one background compile, handed to the GUI thread when done
+    struct CompileResult
+    {
+        bool parsed = false; // false keeps the previous symbol table on screen
+        std::shared_ptr<StringPool> strings;       // text of the tokens
+        std::shared_ptr<const SourceView> source; // what the symbol values point into
+        std::vector<SymbolTable::SymbolRecord> symbols;
+        std::vector<Token> tokens;
+        std::vector<int> tokenEntries; // symbol entry per IDENTIFIER, -1 if not found
+        std::vector<Error> errors;
+        CrossReferenceIndex references;
+        CompileMetrics metrics;
+    };
+
     void loadFile();
+    void openFile(const std::string &path);
+    void openWorkspace();
     void compile();
+    void renderEditor();
+    static int editorCallback(ImGuiInputTextCallbackData *data);
+    void collectCompileResult();
+    void renderSymbolTable();
+    void rebuildSymbolView();
+    void renderTokenPanel();
+    void renderPerformancePanel();
+    void renderReferencePanel();
+    void renderWorkspacePanel();
+    void renderSearchPanel();
+    void startSearch();
+    static CompileResult runCompile(const TextBuffer::Snapshot &snapshot);
 
     GLFWwindow *window;
-    std::string codeBuffer;
-    std::string symbolTableOutput;
+    TextBuffer document;    // source of truth: undo history and compile snapshots
+    std::string codeBuffer; // contiguous copy that the ImGui editor widget edits
+    SyntaxHighlighter highlighter;
+    int editorCursor = 0;      // byte offset of the caret, from the input callback
+    int lastEditorCursor = -1; // caret position the view last scrolled to
+    int pendingCursor = -1;    // caret position to apply on the next callback
+    bool editorActive = false;
+    bool sourceChangedSinceCompile = false; // token offsets no longer match codeBuffer
     std::string errorOutput;
     std::vector<Error> errors; // Add this line
+    std::vector<Token> tokens;
+    std::vector<int> tokenEntries;
+    // Each compile interns into a fresh pool, freed once neither the tokens
+    // nor the symbols on screen come from it
+    std::shared_ptr<StringPool> tokenStrings;
+    std::shared_ptr<StringPool> symbolStrings;
+    std::shared_ptr<const SourceView> symbolSource;
+    bool symbolsMatchTokens = false; // the last compile parsed, so both are its own
+    CrossReferenceIndex references;
+    CompileMetrics metrics; // from the last finished compile
+    bool hasMetrics = false;
+
+    // Symbol table view: records from the last compile plus the filtered,
+    // sorted row order, rebuilt only when the data, filter or sort changes
+    std::vector<SymbolTable::SymbolRecord> symbolRecords;
+    std::vector<int> symbolView;
+    bool symbolViewDirty = true;
+    char symbolFilter[128] = {0};
+    int symbolSortColumn = 0;
+    bool symbolSortDescending = false;
+
+    // Workspace mode: definitions across a directory, kept current in the
+    // background; the result list is refreshed when the query or index changes
+    WorkspaceIndex workspace;
+    char workspaceQuery[128] = {0};
+    std::string workspaceShownQuery;
+    uint64_t workspaceShownGeneration = 0;
+    std::vector<WorkspaceIndex::Location> workspaceResults;
+
+    // Text search over the buffer and, when one is open, the workspace;
+    // results are moved out of `search` every frame as they come in
+    TextSearch search;
+    char searchQuery[128] = {0};
+    int searchTokenClass = 0; // TextSearch::TokenClass
+    bool searchWorkspace = true;
+    std::vector<TextSearch::Match> searchResults;
+
+    std::thread compileThread;
+    std::atomic<bool> compileRunning{false};
+    CompileResult compileResult; // written by compileThread, read after join
+    int framesToRender = 0;      // frames left before the loop may block again
 };
\ No newline at end of file
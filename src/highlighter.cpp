@@ -0,0 +1,272 @@
+// highlighter.cpp
+#include "highlighter.h"
+#include <algorithm>
+
+namespace
+{
+SyntaxHighlighter::Style styleFor(TokenType type)
+{
+    using Style = SyntaxHighlighter::Style;
+    if (type <= TokenType::YieldKeyword)
+        return Style::Keyword;
+    switch (type)
+    {
+    case TokenType::IDENTIFIER:
+        return Style::Identifier;
+    case TokenType::NUMBER:
+        return Style::Number;
+    case TokenType::STRING_LITERAL:
+        return Style::String;
+    case TokenType::OPERATOR:
+        return Style::Operator;
+    case TokenType::COMMENT:
+        return Style::Comment;
+    case TokenType::UNKNOWN:
+        return Style::Error;
+    default:
+        return Style::Punctuation;
+    }
+}
+
+// Index just past the closing triple quote, or npos if the line doesn't close it
+size_t findTripleClose(std::string_view line, size_t from, char quote)
+{
+    for (size_t k = from; k < line.size(); k++)
+    {
+        if (line[k] == '\\')
+        {
+            k++;
+            continue;
+        }
+        if (k + 2 < line.size() && line[k] == quote && line[k + 1] == quote && line[k + 2] == quote)
+            return k + 3;
+    }
+    return std::string_view::npos;
+}
+
+bool isTripleQuote(std::string_view line, size_t pos)
+{
+    return pos + 2 < line.size() && (line[pos] == '"' || line[pos] == '\'') &&
+           line[pos + 1] == line[pos] && line[pos + 2] == line[pos];
+}
+}
+
+// ----------------------------------------------
+// Line index
+// ----------------------------------------------
+void SyntaxHighlighter::setText(std::string_view text)
+{
+    lineStarts.assign(1, 0);
+    for (size_t i = 0; i < text.size(); i++)
+    {
+        if (text[i] == '\n')
+            lineStarts.push_back(i + 1);
+    }
+    lines.assign(lineStarts.size(), Line());
+    statesValidUpTo = 0;
+    longestDirty = true;
+}
+
+void SyntaxHighlighter::applyEdit(std::string_view text, size_t offset, size_t removed, size_t inserted)
+{
+    size_t firstLine = lineOfOffset(offset);
+    // Length of the longest line the edit touches, before and after it
+    const size_t oldSize = text.size() + removed - inserted;
+    auto longestIn = [&](size_t first, size_t last, size_t size)
+    {
+        size_t width = 0;
+        for (size_t line = first; line <= last; line++)
+        {
+            size_t end = line + 1 < lineStarts.size() ? lineStarts[line + 1] - 1 : size;
+            width = std::max(width, end - std::min(lineStarts[line], end));
+        }
+        return width;
+    };
+
+    // Old line starts inside the replaced range disappear with it
+    auto removeBegin = lineStarts.begin() + firstLine + 1;
+    auto removeEnd = std::upper_bound(removeBegin, lineStarts.end(), offset + removed);
+    size_t removedLines = static_cast<size_t>(removeEnd - removeBegin);
+    const size_t widthBefore = longestDirty ? 0 : longestIn(firstLine, firstLine + removedLines, oldSize);
+    auto tail = lineStarts.erase(removeBegin, removeEnd);
+    for (auto it = tail; it != lineStarts.end(); ++it)
+        *it = *it + inserted - removed;
+
+    std::vector<size_t> newStarts;
+    for (size_t i = offset; i < offset + inserted; i++)
+    {
+        if (text[i] == '\n')
+            newStarts.push_back(i + 1);
+    }
+    lineStarts.insert(lineStarts.begin() + firstLine + 1, newStarts.begin(), newStarts.end());
+
+    lines.erase(lines.begin() + firstLine + 1, lines.begin() + firstLine + 1 + removedLines);
+    lines.insert(lines.begin() + firstLine + 1, newStarts.size(), Line());
+    lines[firstLine].dirty = true;
+
+    statesValidUpTo = std::min(statesValidUpTo, firstLine);
+    if (longestDirty)
+        return;
+    // Only a longest line that got shorter needs the whole rescan
+    const size_t widthAfter = longestIn(firstLine, firstLine + newStarts.size(), text.size());
+    if (widthBefore == longest && widthAfter < longest)
+        longestDirty = true;
+    else
+        longest = std::max(longest, widthAfter);
+}
+
+std::string_view SyntaxHighlighter::lineText(std::string_view text, size_t line) const
+{
+    if (line >= lineStarts.size())
+        return {};
+    size_t start = std::min(lineStarts[line], text.size());
+    size_t end = line + 1 < lineStarts.size() ? lineStarts[line + 1] - 1 : text.size();
+    return text.substr(start, std::max(start, end) - start);
+}
+
+size_t SyntaxHighlighter::lineOfOffset(size_t offset) const
+{
+    auto it = std::upper_bound(lineStarts.begin(), lineStarts.end(), offset);
+    return static_cast<size_t>(it - lineStarts.begin()) - 1;
+}
+
+size_t SyntaxHighlighter::longestLine(std::string_view text)
+{
+    if (longestDirty)
+    {
+        longest = 0;
+        for (size_t line = 0; line < lineStarts.size(); line++)
+            longest = std::max(longest, lineText(text, line).size());
+        longestDirty = false;
+    }
+    return longest;
+}
+
+// ----------------------------------------------
+// Lexing
+// ----------------------------------------------
+const std::vector<SyntaxHighlighter::Span> &SyntaxHighlighter::spans(std::string_view text, size_t line)
+{
+    for (size_t i = statesValidUpTo; i <= line; i++)
+    {
+        char entry = i == 0 ? 0 : lines[i - 1].exitState;
+        if (lines[i].dirty || lines[i].entryState != entry)
+            lexLine(text, i, entry);
+    }
+    statesValidUpTo = std::max(statesValidUpTo, line + 1);
+    return lines[line].spans;
+}
+
+void SyntaxHighlighter::lexLine(std::string_view text, size_t line, char entryState)
+{
+    Line &ln = lines[line];
+    ln.spans.clear();
+    ln.entryState = entryState;
+    ln.exitState = 0;
+    ln.dirty = false;
+
+    std::string_view body = lineText(text, line);
+    auto add = [&](size_t start, size_t length, Style style)
+    {
+        if (length > 0)
+            ln.spans.push_back({static_cast<uint32_t>(start), static_cast<uint32_t>(length), style});
+    };
+
+    // Finish a triple-quoted string carried in from the previous line
+    size_t base = 0;
+    if (entryState)
+    {
+        base = findTripleClose(body, 0, entryState);
+        if (base == std::string_view::npos)
+        {
+            add(0, body.size(), Style::String);
+            ln.exitState = entryState;
+            return;
+        }
+        add(0, base, Style::String);
+    }
+
+    std::string_view rest = body.substr(base);
+    std::string source(rest);
+    source += '\n'; // lets the Lexer see a trailing line continuation
+    std::vector<Error> errors;
+    std::vector<Token> tokens;
+    if (strings.bytes() > (size_t(1) << 20))
+        strings.clear(); // no token from an earlier line is still held
+    try
+    {
+        tokens = lexer.tokenize(source, errors);
+    }
+    catch (const std::exception &)
+    {
+        add(base, rest.size(), Style::Default);
+        return;
+    }
+
+    std::vector<Span> marks;
+    for (const Token &tk : tokens)
+    {
+        if (!tk.lexeme.empty() && tk.offset < rest.size())
+        {
+            size_t length = std::min(tk.lexeme.size(), rest.size() - tk.offset);
+            marks.push_back({static_cast<uint32_t>(tk.offset), static_cast<uint32_t>(length), styleFor(tk.type)});
+        }
+    }
+    for (const Error &e : errors)
+    {
+        size_t pos = e.position;
+        if (pos >= rest.size() || rest[pos] == ' ' || rest[pos] == '\t')
+            continue;
+        if (isTripleQuote(rest, pos))
+        {
+            // Opens a triple-quoted string that continues on the next line
+            marks.push_back({static_cast<uint32_t>(pos), static_cast<uint32_t>(rest.size() - pos), Style::String});
+            ln.exitState = rest[pos];
+        }
+        else if (rest[pos] == '"' || rest[pos] == '\'')
+        {
+            marks.push_back({static_cast<uint32_t>(pos), static_cast<uint32_t>(rest.size() - pos), Style::Error});
+        }
+        else
+        {
+            size_t end = pos + 1;
+            while (end < rest.size() && isalnum(static_cast<unsigned char>(rest[end])))
+                end++;
+            marks.push_back({static_cast<uint32_t>(pos), static_cast<uint32_t>(end - pos), Style::Error});
+        }
+    }
+    std::sort(marks.begin(), marks.end(),
+              [](const Span &a, const Span &b)
+              { return a.start < b.start; });
+
+    // Tile the line: gaps become Default, and the first '#' in a gap starts
+    // a comment that the Lexer skipped without emitting a token.
+    size_t pos = 0;
+    for (const Span &m : marks)
+    {
+        if (m.start < pos)
+            continue;
+        std::string_view gap = rest.substr(pos, m.start - pos);
+        size_t hash = gap.find('#');
+        if (hash != std::string_view::npos)
+        {
+            add(base + pos, hash, Style::Default);
+            add(base + pos + hash, rest.size() - pos - hash, Style::Comment);
+            return;
+        }
+        add(base + pos, gap.size(), Style::Default);
+        add(base + m.start, m.length, m.style);
+        pos = m.start + m.length;
+    }
+    std::string_view gap = rest.substr(pos);
+    size_t hash = gap.find('#');
+    if (hash != std::string_view::npos)
+    {
+        add(base + pos, hash, Style::Default);
+        add(base + pos + hash, gap.size() - hash, Style::Comment);
+    }
+    else
+    {
+        add(base + pos, gap.size(), Style::Default);
+    }
+}
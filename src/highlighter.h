@@ -0,0 +1,75 @@
+// highlighter.h
+#pragma once
+#include <cstdint>
+#include <string_view>
+#include <vector>
+#include "main.h"
+
+// ----------------------------------------------
+// SyntaxHighlighter: per-line color spans from the Lexer
+// ----------------------------------------------
+// Each line is run through the real Lexer on its own and the resulting token
+// types become color spans. The only state carried between lines is whether
+// a triple-quoted string is still open, so a line is re-lexed only when it
+// was edited or that incoming state changed. Lines are lexed lazily as they
+// are drawn, which keeps the cost proportional to what is on screen.
+class SyntaxHighlighter
+{
+public:
+    enum class Style : uint8_t
+    {
+        Default,
+        Keyword,
+        Identifier,
+        Number,
+        String,
+        Operator,
+        Punctuation,
+        Comment,
+        Error,
+        Count
+    };
+
+    struct Span
+    {
+        uint32_t start; // byte offset within the line
+        uint32_t length;
+        Style style;
+    };
+
+    // Rebuilds the line index for new text; every line becomes dirty.
+    void setText(std::string_view text);
+    // Tells the highlighter that `removed` bytes at `offset` were replaced by
+    // `inserted` bytes; `text` is the document after the edit.
+    void applyEdit(std::string_view text, size_t offset, size_t removed, size_t inserted);
+
+    size_t lineCount() const { return lineStarts.size(); }
+    size_t lineStart(size_t line) const { return lineStarts[line]; }
+    std::string_view lineText(std::string_view text, size_t line) const; // empty past the last line
+    size_t lineOfOffset(size_t offset) const;
+    size_t longestLine(std::string_view text); // in bytes
+
+    // Spans covering `line`, lexing it and any stale lines above it first.
+    const std::vector<Span> &spans(std::string_view text, size_t line);
+
+private:
+    struct Line
+    {
+        std::vector<Span> spans;
+        char entryState = 0; // open triple quote character, or 0
+        char exitState = 0;
+        bool dirty = true;
+    };
+
+    void lexLine(std::string_view text, size_t line, char entryState);
+
+    // Line tokens are dropped once they become spans, so the highlighter
+    // interns into a pool of its own and empties it now and then
+    StringPool strings;
+    Lexer lexer{strings};
+    std::vector<size_t> lineStarts{0};
+    std::vector<Line> lines{1};
+    size_t statesValidUpTo = 0; // lines before this have up-to-date spans
+    size_t longest = 0;
+    bool longestDirty = true;
+};
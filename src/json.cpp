@@ -0,0 +1,425 @@
+// json.cpp
+#include "json.h"
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+
+namespace
+{
+const Json nullJson;
+const std::string emptyString;
+
+void appendUtf8(std::string &out, uint32_t c)
+{
+    if (c < 0x80)
+    {
+        out += static_cast<char>(c);
+    }
+    else if (c < 0x800)
+    {
+        out += static_cast<char>(0xC0 | (c >> 6));
+        out += static_cast<char>(0x80 | (c & 0x3F));
+    }
+    else if (c < 0x10000)
+    {
+        out += static_cast<char>(0xE0 | (c >> 12));
+        out += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (c & 0x3F));
+    }
+    else
+    {
+        out += static_cast<char>(0xF0 | (c >> 18));
+        out += static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+        out += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (c & 0x3F));
+    }
+}
+} // namespace
+
+// ----------------------------------------------
+// JsonParser: recursive descent over the text
+// ----------------------------------------------
+class JsonParser
+{
+public:
+    explicit JsonParser(std::string_view text) : text(text) {}
+
+    Json document()
+    {
+        Json value = parseValue(0);
+        skipSpace();
+        if (pos != text.size())
+            fail("trailing characters");
+        return value;
+    }
+
+private:
+    static constexpr int maxDepth = 256;
+
+    std::string_view text;
+    size_t pos = 0;
+
+    [[noreturn]] void fail(const char *why) const
+    {
+        throw std::runtime_error("JSON: " + std::string(why) + " at byte " + std::to_string(pos));
+    }
+
+    void skipSpace()
+    {
+        while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\n' || text[pos] == '\r'))
+            pos++;
+    }
+
+    bool consume(std::string_view word)
+    {
+        if (text.compare(pos, word.size(), word) != 0)
+            return false;
+        pos += word.size();
+        return true;
+    }
+
+    Json parseValue(int depth)
+    {
+        if (depth > maxDepth)
+            fail("nesting too deep");
+        skipSpace();
+        if (pos >= text.size())
+            fail("unexpected end");
+        char c = text[pos];
+        if (c == '{')
+            return parseObject(depth);
+        if (c == '[')
+            return parseArray(depth);
+        if (c == '"')
+            return Json(parseString());
+        if (consume("true"))
+            return Json(true);
+        if (consume("false"))
+            return Json(false);
+        if (consume("null"))
+            return Json();
+        if (c == '-' || (c >= '0' && c <= '9'))
+            return parseNumber();
+        fail("unexpected character");
+    }
+
+    Json parseObject(int depth)
+    {
+        Json object = Json::object();
+        pos++; // '{'
+        skipSpace();
+        if (pos < text.size() && text[pos] == '}')
+        {
+            pos++;
+            return object;
+        }
+        for (;;)
+        {
+            skipSpace();
+            if (pos >= text.size() || text[pos] != '"')
+                fail("expected a member name");
+            std::string key = parseString();
+            skipSpace();
+            if (pos >= text.size() || text[pos] != ':')
+                fail("expected ':'");
+            pos++;
+            object.members.emplace_back(std::move(key), parseValue(depth + 1));
+            skipSpace();
+            if (pos < text.size() && text[pos] == ',')
+            {
+                pos++;
+                continue;
+            }
+            if (pos < text.size() && text[pos] == '}')
+            {
+                pos++;
+                return object;
+            }
+            fail("expected ',' or '}'");
+        }
+    }
+
+    Json parseArray(int depth)
+    {
+        Json array = Json::array();
+        pos++; // '['
+        skipSpace();
+        if (pos < text.size() && text[pos] == ']')
+        {
+            pos++;
+            return array;
+        }
+        for (;;)
+        {
+            array.elements.push_back(parseValue(depth + 1));
+            skipSpace();
+            if (pos < text.size() && text[pos] == ',')
+            {
+                pos++;
+                continue;
+            }
+            if (pos < text.size() && text[pos] == ']')
+            {
+                pos++;
+                return array;
+            }
+            fail("expected ',' or ']'");
+        }
+    }
+
+    uint32_t parseHex4()
+    {
+        if (pos + 4 > text.size())
+            fail("short \\u escape");
+        uint32_t v = 0;
+        for (int k = 0; k < 4; k++)
+        {
+            char h = text[pos++];
+            v <<= 4;
+            if (h >= '0' && h <= '9')
+                v |= static_cast<uint32_t>(h - '0');
+            else if (h >= 'a' && h <= 'f')
+                v |= static_cast<uint32_t>(h - 'a' + 10);
+            else if (h >= 'A' && h <= 'F')
+                v |= static_cast<uint32_t>(h - 'A' + 10);
+            else
+                fail("bad \\u escape");
+        }
+        return v;
+    }
+
+    std::string parseString()
+    {
+        std::string out;
+        pos++; // opening quote
+        for (;;)
+        {
+            // Copy the run up to the next quote or escape in one go
+            size_t run = pos;
+            while (run < text.size() && text[run] != '"' && text[run] != '\\')
+                run++;
+            out.append(text.substr(pos, run - pos));
+            pos = run;
+            if (pos >= text.size())
+                fail("unterminated string");
+            if (text[pos++] == '"')
+                return out;
+            if (pos >= text.size())
+                fail("unterminated string");
+            char e = text[pos++];
+            switch (e)
+            {
+            case '"':
+            case '\\':
+            case '/':
+                out += e;
+                break;
+            case 'b':
+                out += '\b';
+                break;
+            case 'f':
+                out += '\f';
+                break;
+            case 'n':
+                out += '\n';
+                break;
+            case 'r':
+                out += '\r';
+                break;
+            case 't':
+                out += '\t';
+                break;
+            case 'u':
+            {
+                uint32_t c = parseHex4();
+                if (c >= 0xD800 && c < 0xDC00 && text.compare(pos, 2, "\\u") == 0)
+                {
+                    size_t back = pos;
+                    pos += 2;
+                    uint32_t low = parseHex4();
+                    if (low >= 0xDC00 && low < 0xE000)
+                        c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+                    else
+                        pos = back; // a lone high surrogate, kept as is
+                }
+                appendUtf8(out, c);
+                break;
+            }
+            default:
+                fail("bad escape");
+            }
+        }
+    }
+
+    Json parseNumber()
+    {
+        size_t start = pos;
+        if (text[pos] == '-')
+            pos++;
+        while (pos < text.size() && ((text[pos] >= '0' && text[pos] <= '9') || text[pos] == '.' ||
+                                     text[pos] == 'e' || text[pos] == 'E' || text[pos] == '+' || text[pos] == '-'))
+            pos++;
+        std::string digits(text.substr(start, pos - start));
+        char *end = nullptr;
+        double v = std::strtod(digits.c_str(), &end);
+        if (end != digits.c_str() + digits.size())
+            fail("bad number");
+        return Json(v);
+    }
+};
+
+// ----------------------------------------------
+// Json
+// ----------------------------------------------
+Json Json::array()
+{
+    Json a;
+    a.kind = Type::Array;
+    return a;
+}
+
+Json Json::object()
+{
+    Json o;
+    o.kind = Type::Object;
+    return o;
+}
+
+const std::string &Json::asString() const
+{
+    return kind == Type::String ? text : emptyString;
+}
+
+const Json &Json::operator[](std::string_view key) const
+{
+    for (const auto &member : members)
+    {
+        if (member.first == key)
+            return member.second;
+    }
+    return nullJson;
+}
+
+bool Json::has(std::string_view key) const
+{
+    for (const auto &member : members)
+    {
+        if (member.first == key)
+            return true;
+    }
+    return false;
+}
+
+Json &Json::set(std::string key, Json member) &
+{
+    kind = Type::Object;
+    for (auto &existing : members)
+    {
+        if (existing.first == key)
+        {
+            existing.second = std::move(member);
+            return *this;
+        }
+    }
+    members.emplace_back(std::move(key), std::move(member));
+    return *this;
+}
+
+Json &Json::push(Json element) &
+{
+    kind = Type::Array;
+    elements.push_back(std::move(element));
+    return *this;
+}
+
+Json Json::parse(std::string_view text)
+{
+    return JsonParser(text).document();
+}
+
+std::string Json::dump() const
+{
+    std::string out;
+    dump(out);
+    return out;
+}
+
+void Json::dump(std::string &out) const
+{
+    switch (kind)
+    {
+    case Type::Null:
+        out += "null";
+        break;
+    case Type::Bool:
+        out += flag ? "true" : "false";
+        break;
+    case Type::Number:
+    {
+        char buf[32];
+        // Ids, lines and columns are integers; print them without a fraction
+        if (std::isfinite(value) && value == std::floor(value) && std::fabs(value) < 9e15)
+        {
+            out.append(buf, std::to_chars(buf, buf + sizeof(buf), static_cast<long long>(value)).ptr);
+            break;
+        }
+        if (std::isfinite(value))
+            snprintf(buf, sizeof(buf), "%.17g", value);
+        else
+            snprintf(buf, sizeof(buf), "null");
+        out += buf;
+        break;
+    }
+    case Type::String:
+        appendJsonString(out, text);
+        break;
+    case Type::Array:
+        out += '[';
+        for (size_t i = 0; i < elements.size(); i++)
+        {
+            if (i)
+                out += ',';
+            elements[i].dump(out);
+        }
+        out += ']';
+        break;
+    case Type::Object:
+        out += '{';
+        for (size_t i = 0; i < members.size(); i++)
+        {
+            if (i)
+                out += ',';
+            appendJsonString(out, members[i].first);
+            out += ':';
+            members[i].second.dump(out);
+        }
+        out += '}';
+        break;
+    }
+}
+
+void appendJsonString(std::string &out, std::string_view text)
+{
+    out += '"';
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+        {
+            out += '\\';
+            out += c;
+        }
+        else if (static_cast<unsigned char>(c) < 0x20)
+        {
+            char esc[8];
+            snprintf(esc, sizeof(esc), "\\u%04x", c);
+            out += esc;
+        }
+        else
+        {
+            out += c;
+        }
+    }
+    out += '"';
+}
@@ -0,0 +1,85 @@
+// json.h
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// ----------------------------------------------
+// Json: a parsed or hand-built JSON value
+// ----------------------------------------------
+// Enough JSON for the language server's messages: values are parsed into a
+// small tree and built back up the same way. Objects keep their members in
+// order in a vector, since messages have a handful of keys each and a
+// linear lookup beats hashing them. Reads never throw: a missing member or
+// a value of another type reads as null, 0, false or "".
+class Json
+{
+public:
+    enum class Type
+    {
+        Null,
+        Bool,
+        Number,
+        String,
+        Array,
+        Object,
+    };
+
+    Json() = default;
+    Json(std::nullptr_t) {}
+    Json(bool b) : kind(Type::Bool), flag(b) {}
+    Json(int n) : kind(Type::Number), value(n) {}
+    Json(unsigned n) : kind(Type::Number), value(n) {}
+    Json(int64_t n) : kind(Type::Number), value(static_cast<double>(n)) {}
+    Json(size_t n) : kind(Type::Number), value(static_cast<double>(n)) {}
+    Json(double n) : kind(Type::Number), value(n) {}
+    Json(const char *s) : kind(Type::String), text(s) {}
+    Json(std::string s) : kind(Type::String), text(std::move(s)) {}
+    Json(std::string_view s) : kind(Type::String), text(s) {}
+
+    static Json array();
+    static Json object();
+
+    Type type() const { return kind; }
+    bool isNull() const { return kind == Type::Null; }
+    bool isObject() const { return kind == Type::Object; }
+
+    bool asBool() const { return kind == Type::Bool && flag; }
+    double asNumber() const { return kind == Type::Number ? value : 0; }
+    int64_t asInt() const { return static_cast<int64_t>(asNumber()); }
+    const std::string &asString() const;
+
+    // Object member, or a null value
+    const Json &operator[](std::string_view key) const;
+    bool has(std::string_view key) const;
+    // Array elements; empty for anything else
+    const std::vector<Json> &items() const { return elements; }
+
+    // Builders: set() on an object (replacing a member of the same name),
+    // push() on an array. Both return *this for chaining; on a temporary,
+    // as an rvalue, so a nested chain moves into its parent, not copies.
+    Json &set(std::string key, Json member) &;
+    Json &&set(std::string key, Json member) && { return std::move(set(std::move(key), std::move(member))); }
+    Json &push(Json element) &;
+    Json &&push(Json element) && { return std::move(push(std::move(element))); }
+
+    // Throws std::runtime_error with the byte offset of the problem
+    static Json parse(std::string_view text);
+    std::string dump() const;
+    void dump(std::string &out) const;
+
+private:
+    Type kind = Type::Null;
+    bool flag = false;
+    double value = 0;
+    std::string text;
+    std::vector<Json> elements;
+    std::vector<std::pair<std::string, Json>> members;
+
+    friend class JsonParser;
+};
+
+// Appends `text` as a quoted JSON string
+void appendJsonString(std::string &out, std::string_view text);
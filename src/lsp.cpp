@@ -0,0 +1,511 @@
+// lsp.cpp
+#include "lsp.h"
+#include <algorithm>
+#include <cstdlib>
+#include <istream>
+#include <ostream>
+#include <thread>
+#include "trace.h"
+#include "unicode.h"
+
+namespace
+{
+// JSON-RPC error codes
+constexpr int parseError = -32700;
+constexpr int invalidRequest = -32600;
+constexpr int methodNotFound = -32601;
+constexpr int internalError = -32603;
+
+// LSP SymbolKind values
+constexpr int classKind = 5;
+constexpr int functionKind = 12;
+constexpr int variableKind = 13;
+
+size_t sequenceLength(unsigned char lead)
+{
+    return lead < 0xC0 ? 1 : lead < 0xE0 ? 2 : lead < 0xF0 ? 3 : 4;
+}
+
+// UTF-16 code units of UTF-8 `text`: a four-byte sequence is a surrogate pair
+size_t utf16Length(std::string_view text)
+{
+    size_t units = 0;
+    for (unsigned char c : text)
+    {
+        if ((c & 0xC0) != 0x80)
+            units += c >= 0xF0 ? 2 : 1;
+    }
+    return units;
+}
+
+// Byte offset of an LSP position in a line, clamped to the line's end
+size_t byteInLine(std::string_view line, int64_t character)
+{
+    size_t i = 0;
+    for (int64_t units = 0; i < line.size() && units < character;)
+    {
+        size_t length = sequenceLength(static_cast<unsigned char>(line[i]));
+        units += length == 4 ? 2 : 1;
+        i += length;
+    }
+    return std::min(i, line.size());
+}
+
+// Byte offset of an LSP position in the current text of a document
+size_t offsetAt(const TextBuffer::Snapshot &text, const Json &position)
+{
+    int64_t line = position["line"].asInt();
+    if (line < 0)
+        return 0;
+    if (static_cast<size_t>(line) >= text.lineCount())
+        return text.size();
+    size_t start = text.offsetOfLine(static_cast<size_t>(line));
+    size_t end = static_cast<size_t>(line) + 1 < text.lineCount() ? text.offsetOfLine(static_cast<size_t>(line) + 1) - 1
+                                                                   : text.size();
+    return start + byteInLine(text.substr(start, end - start), position["character"].asInt());
+}
+
+Json makeRange(int64_t startLine, size_t startCharacter, int64_t endLine, size_t endCharacter)
+{
+    return Json::object()
+        .set("start", Json::object().set("line", startLine).set("character", startCharacter))
+        .set("end", Json::object().set("line", endLine).set("character", endCharacter));
+}
+} // namespace
+
+LanguageServer::LanguageServer(std::istream &in, std::ostream &out)
+    : in(in), out(out), inbox(std::make_shared<Inbox>())
+{
+    // std::cin flushes std::cout before each read; from the reader thread
+    // that would race with the replies
+    in.tie(nullptr);
+}
+
+// ----------------------------------------------
+// Transport: Content-Length framed JSON-RPC
+// ----------------------------------------------
+void LanguageServer::readMessages(std::istream &in, std::shared_ptr<Inbox> inbox)
+{
+    setTraceThreadName("lsp reader");
+    std::string line;
+    for (;;)
+    {
+        size_t length = 0;
+        bool framed = false;
+        while (std::getline(in, line))
+        {
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+            if (line.empty())
+                break;
+            static const char header[] = "Content-Length:";
+            if (line.compare(0, sizeof(header) - 1, header) == 0)
+            {
+                length = std::strtoull(line.c_str() + sizeof(header) - 1, nullptr, 10);
+                framed = true;
+            }
+        }
+        if (!in)
+            break;
+        if (!framed)
+            continue; // a blank line between messages
+        std::string body(length, '\0');
+        in.read(&body[0], static_cast<std::streamsize>(length));
+        if (!in)
+            break;
+        std::lock_guard<std::mutex> hold(inbox->lock);
+        inbox->messages.push_back(std::move(body));
+        inbox->ready.notify_one();
+    }
+    std::lock_guard<std::mutex> hold(inbox->lock);
+    inbox->closed = true;
+    inbox->ready.notify_one();
+}
+
+bool LanguageServer::messageWaiting()
+{
+    std::lock_guard<std::mutex> hold(inbox->lock);
+    return !inbox->messages.empty();
+}
+
+int LanguageServer::run()
+{
+    std::thread(readMessages, std::ref(in), inbox).detach();
+    while (!exitRequested)
+    {
+        // Idle time goes to the diagnostics of documents edited since
+        if (!messageWaiting())
+            publishPending();
+
+        std::string body;
+        {
+            std::unique_lock<std::mutex> hold(inbox->lock);
+            inbox->ready.wait(hold, [&]
+                              { return !inbox->messages.empty() || inbox->closed; });
+            if (inbox->messages.empty())
+                break;
+            body = std::move(inbox->messages.front());
+            inbox->messages.pop_front();
+        }
+        handle(body);
+    }
+    return shutdownRequested && exitRequested ? 0 : 1;
+}
+
+void LanguageServer::send(const Json &message)
+{
+    std::string body = message.dump();
+    out << "Content-Length: " << body.size() << "\r\n\r\n"
+        << body;
+    out.flush();
+}
+
+void LanguageServer::reply(const Json &id, Json result)
+{
+    send(Json::object().set("jsonrpc", "2.0").set("id", id).set("result", std::move(result)));
+}
+
+void LanguageServer::replyError(const Json &id, int code, const std::string &message)
+{
+    send(Json::object()
+             .set("jsonrpc", "2.0")
+             .set("id", id)
+             .set("error", Json::object().set("code", code).set("message", message)));
+}
+
+void LanguageServer::notify(const char *method, Json params)
+{
+    send(Json::object().set("jsonrpc", "2.0").set("method", method).set("params", std::move(params)));
+}
+
+void LanguageServer::handle(const std::string &body)
+{
+    Json message;
+    try
+    {
+        message = Json::parse(body);
+    }
+    catch (const std::exception &e)
+    {
+        replyError(Json(), parseError, e.what());
+        return;
+    }
+    const std::string &method = message["method"].asString();
+    const Json *id = message.has("id") ? &message["id"] : nullptr;
+    if (method.empty())
+        return; // a response to nothing we asked
+    TraceScope trace("lsp message", method);
+    try
+    {
+        dispatch(method, message["params"], id);
+    }
+    catch (const std::exception &e)
+    {
+        if (id)
+            replyError(*id, internalError, e.what());
+    }
+}
+
+void LanguageServer::dispatch(const std::string &method, const Json &params, const Json *id)
+{
+    if (method == "exit")
+    {
+        exitRequested = true;
+        return;
+    }
+    if (shutdownRequested && id)
+    {
+        replyError(*id, invalidRequest, "Server is shutting down");
+        return;
+    }
+
+    if (method == "initialize" && id)
+    {
+        Json capabilities = Json::object()
+                                .set("textDocumentSync", Json::object()
+                                                             .set("openClose", true)
+                                                             .set("change", 2)) // incremental
+                                .set("documentSymbolProvider", true)
+                                .set("definitionProvider", true)
+                                .set("referencesProvider", true);
+        reply(*id, Json::object()
+                       .set("capabilities", std::move(capabilities))
+                       .set("serverInfo", Json::object().set("name", "compiler_lsp")));
+    }
+    else if (method == "shutdown" && id)
+    {
+        shutdownRequested = true;
+        reply(*id, Json());
+    }
+    else if (method == "textDocument/didOpen")
+        didOpen(params);
+    else if (method == "textDocument/didChange")
+        didChange(params);
+    else if (method == "textDocument/didClose")
+        didClose(params);
+    else if (method == "textDocument/documentSymbol" && id)
+        reply(*id, documentSymbol(params));
+    else if (method == "textDocument/definition" && id)
+        reply(*id, definition(params));
+    else if (method == "textDocument/references" && id)
+        reply(*id, references(params));
+    else if (id)
+        replyError(*id, methodNotFound, "Unsupported method: " + method);
+    // Other notifications (initialized, $/cancelRequest, ...) need nothing
+}
+
+// ----------------------------------------------
+// Document sync
+// ----------------------------------------------
+void LanguageServer::didOpen(const Json &params)
+{
+    const Json &item = params["textDocument"];
+    Document &document = documents[item["uri"].asString()];
+    document.text.assign(item["text"].asString());
+    document.version = item["version"].asInt();
+    document.stale = true;
+    document.publishedVersion = -1;
+}
+
+// Applies the changes in order, each against the text the previous one
+// left; a change without a range replaces the whole document
+void LanguageServer::didChange(const Json &params)
+{
+    Document *document = find(params);
+    if (!document)
+        return;
+    for (const Json &change : params["contentChanges"].items())
+    {
+        const std::string &text = change["text"].asString();
+        if (!change.has("range"))
+        {
+            document->text.assign(text);
+            continue;
+        }
+        TextBuffer::Snapshot current = document->text.snapshot();
+        size_t start = offsetAt(current, change["range"]["start"]);
+        size_t end = offsetAt(current, change["range"]["end"]);
+        if (end < start)
+            std::swap(start, end);
+        document->text.replace(start, end - start, text);
+    }
+    document->version = params["textDocument"]["version"].asInt();
+    document->stale = true;
+}
+
+void LanguageServer::didClose(const Json &params)
+{
+    const std::string &uri = params["textDocument"]["uri"].asString();
+    if (documents.erase(uri))
+        notify("textDocument/publishDiagnostics",
+               Json::object().set("uri", uri).set("diagnostics", Json::array()));
+}
+
+LanguageServer::Document *LanguageServer::find(const Json &params)
+{
+    auto it = documents.find(params["textDocument"]["uri"].asString());
+    return it == documents.end() ? nullptr : &it->second;
+}
+
+// ----------------------------------------------
+// Analysis, once per version
+// ----------------------------------------------
+const LanguageServer::Analysis &LanguageServer::analyse(Document &document)
+{
+    if (!document.stale)
+        return *document.analysis;
+
+    auto analysis = std::make_shared<Analysis>();
+    analysis->text = document.text.snapshot();
+    const std::string size = std::to_string(analysis->text.size()) + " bytes";
+    TraceScope trace("lsp analyse", size);
+    indexLines(*analysis);
+    try
+    {
+        // The table's names and scopes are copied out by records(), so the
+        // pool goes with this call
+        const SourceView source(analysis->text);
+        StringPool strings;
+        SymbolTable symbols(strings);
+        lexAndParse(source, analysis->errors, symbols);
+        if (analysis->errors.empty())
+        {
+            analysis->symbols = symbols.records();
+            analysis->references = std::move(symbols.references);
+        }
+    }
+    catch (const UnterminatedStringError &e)
+    {
+        analysis->errors.push_back({"Unterminated string literal", e.line_number, e.index});
+    }
+    catch (const std::exception &e)
+    {
+        analysis->errors.push_back({e.what(), -1, 0});
+    }
+    document.analysis = std::move(analysis);
+    document.stale = false;
+    return *document.analysis;
+}
+
+// One pass over the text for the line table. A line with no byte above
+// 0x7F, nearly all of them, has its columns counted without decoding.
+void LanguageServer::indexLines(Analysis &analysis)
+{
+    analysis.lineStarts.assign(1, 0);
+    analysis.asciiLines.assign(1, true);
+    size_t base = 0;
+    for (auto it = analysis.text.chunks(); !it.done(); ++it)
+    {
+        std::string_view chunk = *it;
+        for (size_t pos = 0; pos < chunk.size();)
+        {
+            size_t newline = std::min(chunk.find('\n', pos), chunk.size());
+            std::string_view part = chunk.substr(pos, newline - pos);
+            if (unicode::asciiPrefix(part) < part.size())
+                analysis.asciiLines.back() = false;
+            if (newline == chunk.size())
+                break;
+            analysis.lineStarts.push_back(base + newline + 1);
+            analysis.asciiLines.push_back(true);
+            pos = newline + 1;
+        }
+        base += chunk.size();
+    }
+}
+
+// The LSP range of `length` bytes at `offset`, all on one line
+Json LanguageServer::range(const Analysis &analysis, size_t offset, size_t length)
+{
+    size_t line = static_cast<size_t>(std::upper_bound(analysis.lineStarts.begin(), analysis.lineStarts.end(), offset) -
+                                      analysis.lineStarts.begin()) -
+                  1;
+    size_t start = analysis.lineStarts[line];
+    size_t character = offset - start;
+    size_t width = length;
+    if (!analysis.asciiLines[line])
+    {
+        character = utf16Length(analysis.text.substr(start, offset - start));
+        width = utf16Length(analysis.text.substr(offset, length));
+    }
+    return makeRange(static_cast<int64_t>(line), character, static_cast<int64_t>(line), character + width);
+}
+
+void LanguageServer::publishDiagnostics(const std::string &uri, Document &document)
+{
+    const Analysis &analysis = analyse(document);
+    Json diagnostics = Json::array();
+    for (const Error &error : analysis.errors)
+    {
+        // Positions are byte offsets; errors without one go on the first line
+        size_t offset = error.line < 0 ? 0 : std::min(error.position, analysis.text.size());
+        std::string at = analysis.text.substr(offset, 4); // the character it points at
+        size_t length = at.empty() || at[0] == '\n' ? 0 : std::min(sequenceLength(static_cast<unsigned char>(at[0])), at.size());
+        diagnostics.push(Json::object()
+                             .set("range", range(analysis, offset, length))
+                             .set("severity", 1) // error
+                             .set("source", "compiler")
+                             .set("message", error.message));
+    }
+    notify("textDocument/publishDiagnostics", Json::object()
+                                                  .set("uri", uri)
+                                                  .set("version", document.version)
+                                                  .set("diagnostics", std::move(diagnostics)));
+    document.publishedVersion = document.version;
+}
+
+// Stops early when a message comes in; the rest wait for the next pause
+void LanguageServer::publishPending()
+{
+    for (auto &[uri, document] : documents)
+    {
+        if (document.publishedVersion == document.version && !document.stale)
+            continue;
+        if (messageWaiting())
+            return;
+        publishDiagnostics(uri, document);
+    }
+}
+
+// ----------------------------------------------
+// Requests, answered from the analysis
+// ----------------------------------------------
+Json LanguageServer::documentSymbol(const Json &params)
+{
+    Document *document = find(params);
+    if (!document)
+        return Json();
+    analyse(*document);
+    Analysis &analysis = *document->analysis;
+    if (analysis.documentSymbolsBuilt)
+        return analysis.documentSymbols;
+
+    // Every name something binds: def and class names, assignments and
+    // parameters, each at its definition, in source order
+    std::vector<std::pair<const CrossReferenceIndex::Reference *, const SymbolTable::SymbolRecord *>> defined;
+    for (const SymbolTable::SymbolRecord &rec : analysis.symbols)
+    {
+        const CrossReferenceIndex::Reference *def = analysis.references.definition(rec.info.entry);
+        if (def && def->kind != CrossReferenceIndex::Kind::Use)
+            defined.emplace_back(def, &rec);
+    }
+    std::sort(defined.begin(), defined.end(), [](const auto &a, const auto &b)
+              { return a.first->offset < b.first->offset; });
+
+    const std::string &uri = params["textDocument"]["uri"].asString();
+    Json result = Json::array();
+    for (const auto &[def, rec] : defined)
+    {
+        int kind = rec->info.type == "function" ? functionKind : rec->info.type == "class" ? classKind
+                                                                                            : variableKind;
+        Json location = Json::object()
+                            .set("uri", uri)
+                            .set("range", range(analysis, def->offset, def->length));
+        Json info = Json::object().set("name", rec->name).set("kind", kind).set("location", std::move(location));
+        if (rec->info.scope != "global")
+            info.set("containerName", rec->info.scope);
+        result.push(std::move(info));
+    }
+    analysis.documentSymbols = std::move(result);
+    analysis.documentSymbolsBuilt = true;
+    return analysis.documentSymbols;
+}
+
+Json LanguageServer::definition(const Json &params)
+{
+    Document *document = find(params);
+    if (!document)
+        return Json();
+    const Analysis &analysis = analyse(*document);
+    const CrossReferenceIndex::Reference *here = analysis.references.at(offsetAt(analysis.text, params["position"]));
+    if (!here)
+        return Json();
+    const CrossReferenceIndex::Reference *def = analysis.references.definition(here->symbol);
+    return Json::object()
+        .set("uri", params["textDocument"]["uri"])
+        .set("range", range(analysis, def->offset, def->length));
+}
+
+Json LanguageServer::references(const Json &params)
+{
+    Document *document = find(params);
+    if (!document)
+        return Json();
+    const Analysis &analysis = analyse(*document);
+    const CrossReferenceIndex::Reference *here = analysis.references.at(offsetAt(analysis.text, params["position"]));
+    Json result = Json::array();
+    if (!here)
+        return result;
+    const CrossReferenceIndex::Reference *def = analysis.references.definition(here->symbol);
+    const bool includeDeclaration = params["context"]["includeDeclaration"].asBool();
+    const Json &uri = params["textDocument"]["uri"];
+    for (const CrossReferenceIndex::Reference *ref = analysis.references.begin(here->symbol);
+         ref != analysis.references.end(here->symbol); ref++)
+    {
+        if (ref == def && !includeDeclaration)
+            continue;
+        result.push(Json::object()
+                        .set("uri", uri)
+                        .set("range", range(analysis, ref->offset, ref->length)));
+    }
+    return result;
+}
@@ -0,0 +1,103 @@
+// lsp.h
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "json.h"
+#include "main.h"
+#include "text_buffer.h"
+
+// ----------------------------------------------
+// LanguageServer: the compiler's analysis over LSP
+// ----------------------------------------------
+// Speaks the Language Server Protocol over a pair of streams (stdin and
+// stdout in compiler_lsp): documents are kept as TextBuffers and edited in
+// place by incremental didChange events. A document is analysed at most once
+// per version, when a request needs it or when no message is waiting, and
+// the result is kept: definition and references are then lookups in its
+// CrossReferenceIndex and documentSymbol returns a response built once.
+// Diagnostics for each version are published as soon as the input goes
+// quiet, so a burst of keystrokes costs one analysis, not one per edit.
+//
+// Positions are LSP's: 0-based lines and UTF-16 code units within the line.
+class LanguageServer
+{
+public:
+    // `in` is read on a thread that is left behind if the client sends exit
+    // without closing it, so it must live as long as the process (std::cin)
+    // or end on its own (a string stream)
+    LanguageServer(std::istream &in, std::ostream &out);
+
+    // Serves until the client sends exit or closes the input. Returns the
+    // process exit code: 0 if shutdown came first, as the protocol asks.
+    int run();
+
+private:
+    struct Analysis
+    {
+        TextBuffer::Snapshot text;      // what was analysed
+        std::vector<size_t> lineStarts; // byte offset of each line in `text`
+        std::vector<bool> asciiLines;   // lines whose columns are byte counts
+        std::vector<SymbolTable::SymbolRecord> symbols;
+        CrossReferenceIndex references;
+        std::vector<Error> errors;
+        Json documentSymbols; // the response, built by the first request
+        bool documentSymbolsBuilt = false;
+    };
+
+    struct Document
+    {
+        TextBuffer text;
+        int64_t version = 0;
+        std::shared_ptr<Analysis> analysis; // of an earlier version while stale
+        bool stale = true;
+        int64_t publishedVersion = -1; // diagnostics last sent for
+    };
+
+    // Message bodies read ahead on a thread of their own, so the main loop
+    // can tell when the client has gone quiet. Shared with that thread,
+    // which may outlive the server.
+    struct Inbox
+    {
+        std::mutex lock;
+        std::condition_variable ready;
+        std::deque<std::string> messages;
+        bool closed = false; // end of input
+    };
+
+    std::istream &in;
+    std::ostream &out;
+    std::shared_ptr<Inbox> inbox;
+    std::unordered_map<std::string, Document> documents; // by URI
+    bool shutdownRequested = false;
+    bool exitRequested = false;
+
+    static void readMessages(std::istream &in, std::shared_ptr<Inbox> inbox);
+    bool messageWaiting();
+    void handle(const std::string &body);
+    void dispatch(const std::string &method, const Json &params, const Json *id);
+    void send(const Json &message);
+    void reply(const Json &id, Json result);
+    void replyError(const Json &id, int code, const std::string &message);
+    void notify(const char *method, Json params);
+
+    void didOpen(const Json &params);
+    void didChange(const Json &params);
+    void didClose(const Json &params);
+    Json documentSymbol(const Json &params);
+    Json definition(const Json &params);
+    Json references(const Json &params);
+
+    Document *find(const Json &params);
+    const Analysis &analyse(Document &document);
+    void publishDiagnostics(const std::string &uri, Document &document);
+    void publishPending();
+    static void indexLines(Analysis &analysis);
+    static Json range(const Analysis &analysis, size_t offset, size_t length);
+};
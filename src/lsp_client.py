@@ -0,0 +1,148 @@
+# lsp_client.py
+# Scripted stdio client for compiler_lsp: drives one session through the
+# protocol and checks each answer against what the server should say.
+#
+#   python3 src/lsp_client.py path/to/compiler_lsp
+#
+# Covers initialize, didOpen, publishDiagnostics, incremental didChange,
+# documentSymbol, definition, references, and shutdown/exit. Prints each
+# step and exits 1 at the first answer that is wrong.
+import json
+import subprocess
+import sys
+
+URI = "file:///session.py"
+TEXT = (
+    "x = 1\n"
+    "def f(a):\n"
+    "    y = x + a\n"
+    "    return y\n"
+    "z = f(x)\n"
+    "näme = 'é'\n"
+    "q = näme\n"
+)
+
+
+class Session:
+    def __init__(self, server):
+        self.proc = subprocess.Popen([server], stdin=subprocess.PIPE, stdout=subprocess.PIPE)
+        self.next_id = 0
+        self.notifications = []
+
+    def send(self, message):
+        body = json.dumps(dict(message, jsonrpc="2.0")).encode()
+        self.proc.stdin.write(b"Content-Length: %d\r\n\r\n" % len(body) + body)
+        self.proc.stdin.flush()
+
+    def receive(self):
+        length = None
+        while True:
+            line = self.proc.stdout.readline()
+            if not line:
+                raise EOFError("server closed its output")
+            if line == b"\r\n":
+                break
+            if line.lower().startswith(b"content-length:"):
+                length = int(line.split(b":")[1])
+        return json.loads(self.proc.stdout.read(length))
+
+    def request(self, method, params):
+        self.next_id += 1
+        self.send({"id": self.next_id, "method": method, "params": params})
+        while True:
+            message = self.receive()
+            if message.get("id") == self.next_id:
+                return message
+            self.notifications.append(message)
+
+    def notify(self, method, params):
+        self.send({"method": method, "params": params})
+
+    # The diagnostics published for `version`, skipping older ones
+    def diagnostics(self, version):
+        while True:
+            pending = [m for m in self.notifications if m.get("method") == "textDocument/publishDiagnostics"]
+            for message in pending:
+                self.notifications.remove(message)
+                if message["params"]["version"] == version:
+                    return message["params"]["diagnostics"]
+            self.notifications.append(self.receive())
+
+
+def position(line, character):
+    return {"line": line, "character": character}
+
+
+def span(line, start, end):
+    return {"start": position(line, start), "end": position(line, end)}
+
+
+def check(step, got, expected):
+    if got != expected:
+        print("FAIL %s\n  got      %s\n  expected %s" % (step, json.dumps(got), json.dumps(expected)))
+        sys.exit(1)
+    print("ok   %s" % step)
+
+
+def main():
+    if len(sys.argv) != 2:
+        print("usage: python3 lsp_client.py path/to/compiler_lsp")
+        return 2
+    s = Session(sys.argv[1])
+    document = {"uri": URI}
+
+    capabilities = s.request("initialize", {"capabilities": {}})["result"]["capabilities"]
+    check("initialize", capabilities["textDocumentSync"], {"openClose": True, "change": 2})
+    s.notify("initialized", {})
+
+    s.notify("textDocument/didOpen",
+             {"textDocument": {"uri": URI, "languageId": "python", "version": 1, "text": TEXT}})
+    check("diagnostics after didOpen", s.diagnostics(1), [])
+
+    symbols = s.request("textDocument/documentSymbol", {"textDocument": document})["result"]
+    check("documentSymbol names", [(sym["name"], sym.get("containerName")) for sym in symbols],
+          [("x", None), ("f", None), ("a", "f"), ("y", "f"), ("z", None), ("näme", None), ("q", None)])
+    check("documentSymbol function kind", symbols[1]["kind"], 12)
+
+    # x read inside f, and a non-ASCII name (characters are UTF-16 units)
+    definition = s.request("textDocument/definition",
+                           {"textDocument": document, "position": position(2, 8)})["result"]
+    check("definition of x", definition, {"uri": URI, "range": span(0, 0, 1)})
+    definition = s.request("textDocument/definition",
+                           {"textDocument": document, "position": position(6, 5)})["result"]
+    check("definition of näme", definition["range"], span(5, 0, 4))
+
+    references = s.request("textDocument/references",
+                           {"textDocument": document, "position": position(0, 0),
+                            "context": {"includeDeclaration": True}})["result"]
+    check("references to x", [r["range"] for r in references], [span(0, 0, 1), span(2, 8, 9), span(4, 6, 7)])
+
+    # Incremental edit: rename x to xx on line 0 and at its use in f
+    s.notify("textDocument/didChange",
+             {"textDocument": {"uri": URI, "version": 2},
+              "contentChanges": [{"range": span(2, 8, 9), "text": "xx"},
+                                 {"range": span(0, 0, 1), "text": "xx"}]})
+    check("diagnostics after didChange", s.diagnostics(2), [])
+    references = s.request("textDocument/references",
+                           {"textDocument": document, "position": position(0, 1),
+                            "context": {"includeDeclaration": True}})["result"]
+    check("references to xx", [r["range"] for r in references], [span(0, 0, 2), span(2, 8, 10)])
+
+    # An unterminated string is reported where it starts
+    s.notify("textDocument/didChange",
+             {"textDocument": {"uri": URI, "version": 3},
+              "contentChanges": [{"range": span(6, 4, 4), "text": "\"unterminated"}]})
+    diagnostics = s.diagnostics(3)
+    check("diagnostics for an unterminated string",
+          [(d["range"]["start"], d["message"]) for d in diagnostics],
+          [(position(6, 4), "Unterminated string literal")])
+
+    check("shutdown", s.request("shutdown", None).get("result", "missing"), None)
+    s.notify("exit", None)
+    s.proc.stdin.close()
+    check("exit status", s.proc.wait(timeout=10), 0)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,51 @@
+// lsp_main.cpp
+// Language server for editors: the compiler's diagnostics, document
+// symbols, definitions and references over LSP on stdin/stdout.
+//
+//   compiler_lsp [--stdio] [--trace FILE]
+//
+// --stdio is accepted for clients that pass it; stdio is the only transport.
+// --trace FILE records every message and analysis as Chrome trace_event
+// JSON, written when the server exits. lsp_client.py beside this file runs
+// a scripted session against the server and checks its answers.
+#include "lsp.h"
+#include "trace.h"
+#include <cstring>
+#include <iostream>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+int main(int argc, char **argv)
+{
+    string trace;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+            trace = argv[++i];
+        else if (strcmp(argv[i], "--stdio") != 0)
+        {
+            cerr << "usage: compiler_lsp [--stdio] [--trace FILE]" << endl;
+            return 2;
+        }
+    }
+    if (!trace.empty())
+    {
+        setTraceEnabled(true);
+        setTraceThreadName("lsp main");
+    }
+
+    // Content-Length counts bytes, so no newline translation on either side
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    ios::sync_with_stdio(false);
+    LanguageServer server(cin, cout);
+    int status = server.run();
+    if (!trace.empty() && !writeTraceJson(trace))
+        cerr << "Could not write trace: " << trace << endl;
+    return status;
+}
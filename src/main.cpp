@@ -1,50 +1,288 @@
 #include "main.h"
+#include "concurrent_symbols.h"
+#include "metrics.h"
+#include "spill.h"
+#include "token_store.h"
+#include "trace.h"
+#include "unicode.h"
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <exception>
+#include <thread>
+#ifndef COMPILER_HEADLESS
 #include "gui.h"
+#endif
 
 using namespace std;
 
 // ----------------------------------------------
 // Token Implementation
 // ----------------------------------------------
-Token::Token(TokenType t, const string &l, int line, const string &s)
-    : type(t), lexeme(l), lineNumber(line), scope(s) {}
+Token::Token(TokenType t, InternedString l, int line, size_t off, InternedString s)
+    : type(t), lexeme(l), lineNumber(line), offset(off), scope(s) {}
+
+string spanText(const SourceView &source, SourceSpan span, size_t limit)
+{
+    return source.substr(span.offset, min<size_t>(span.length, limit));
+}
 
 // ----------------------------------------------
 // SymbolTable Implementation
 // ----------------------------------------------
-void SymbolTable::addSymbol(const string &name, const string &type,
-                            int lineNumber, const string &scope,
-                            const string &val)
+// Names Python resolves in the builtins module when nothing shadows them
+static const unordered_set<string_view> builtinNames = {
+    "abs", "all", "any", "ascii", "bin", "bool", "breakpoint", "bytearray",
+    "bytes", "callable", "chr", "classmethod", "compile", "complex", "delattr",
+    "dict", "dir", "divmod", "enumerate", "eval", "exec", "filter", "float",
+    "format", "frozenset", "getattr", "globals", "hasattr", "hash", "help",
+    "hex", "id", "input", "int", "isinstance", "issubclass", "iter", "len",
+    "list", "locals", "map", "max", "memoryview", "min", "next", "object",
+    "oct", "open", "ord", "pow", "print", "property", "range", "repr",
+    "reversed", "round", "set", "setattr", "slice", "sorted", "staticmethod",
+    "str", "sum", "super", "tuple", "type", "vars", "zip", "__import__",
+    "__name__", "__file__", "__doc__", "NotImplemented", "Ellipsis",
+    "BaseException", "Exception", "ArithmeticError", "AssertionError",
+    "AttributeError", "EOFError", "ImportError", "IndexError", "KeyError",
+    "KeyboardInterrupt", "LookupError", "MemoryError", "NameError",
+    "NotImplementedError", "OSError", "OverflowError", "RecursionError",
+    "RuntimeError", "StopIteration", "SyntaxError", "SystemExit", "TypeError",
+    "ValueError", "ZeroDivisionError"};
+
+SymbolTable::SymbolTable(StringPool &strings)
+    : pool(&strings)
+{
+    lastScopePath = pool->intern("global").id();
+    scopeIds.emplace(lastScopePath, addScope("global", -1));
+    addScope("builtins", -1); // not in scopeIds: no lexer scope reaches it by name
+}
+
+int SymbolTable::addScope(const string &path, int parent)
+{
+    Scope scope;
+    scope.path = path;
+    scope.parent = parent;
+    scopes.push_back(move(scope));
+    return static_cast<int>(scopes.size()) - 1;
+}
+
+string SymbolTable::enclosingScope(string_view scope)
 {
-    string uniqueKey = name + "@" + scope;
+    size_t at = scope.find('@');
+    return at == string::npos ? "global" : string(scope.substr(at + 1));
+}
 
-    auto it = table.find(uniqueKey);
-    if (it == table.end())
+int SymbolTable::scopeId(InternedString path)
+{
+    if (path.id() == lastScopePath)
+        return lastScopeId;
+    int id;
+    auto it = scopeIds.find(path.id());
+    if (it != scopeIds.end())
     {
-        SymbolInfo info;
-        info.entry = nextEntry++;
-        info.type = type;
-        info.scope = scope;
-        info.firstAppearance = lineNumber;
-        info.usageCount = 1;
-        info.value = val;
-        table[uniqueKey] = info;
+        id = it->second;
     }
     else
     {
-        it->second.usageCount++;
-        if (it->second.type == "unknown" && type != "unknown")
+        id = addScope(path.str(), scopeId(pool->intern(enclosingScope(path))));
+        scopeIds.emplace(path.id(), id);
+    }
+    if (spill)
+    {
+        // The scope and those enclosing it are in use: back in memory, and
+        // in the list the next spill looks through
+        for (int s = id; s > builtinScope; s = scopes[s].parent)
+        {
+            if (scopes[s].spilled)
+                pageIn(s);
+            if (!scopes[s].listed)
+            {
+                scopes[s].listed = true;
+                residentScopes.push_back(s);
+            }
+        }
+    }
+    lastScopePath = path.id();
+    lastScopeId = id;
+    return id;
+}
+
+// The symbol `name` bound in `scope`, created on first sight
+SymbolTable::SymbolInfo &SymbolTable::bindIn(int scope, InternedString name, int lineNumber)
+{
+    auto it = scopes[scope].names.find(name.id());
+    if (it != scopes[scope].names.end())
+        return it->second->second;
+
+    string key;
+    key.reserve(name.size() + 1 + scopes[scope].path.size());
+    key.append(name.view()).append("@").append(scopes[scope].path);
+    Entry &entry = *table.try_emplace(move(key)).first;
+    SymbolInfo &info = entry.second;
+    info.entry = nextEntry++;
+    info.scope = scopes[scope].path;
+    info.firstAppearance = lineNumber;
+    if (scope == builtinScope)
+        info.type = "builtin";
+    scopes[scope].names.emplace(name.id(), &entry);
+    return info;
+}
+
+SymbolTable::SymbolInfo &SymbolTable::bind(InternedString name, InternedString scope, int lineNumber)
+{
+    int from = scopeId(scope);
+    auto redirect = scopes[from].redirects.find(name.id());
+    int target = redirect != scopes[from].redirects.end() ? redirect->second : from;
+
+    size_t before = scopes[target].names.size();
+    SymbolInfo &info = bindIn(target, name, lineNumber);
+    if (moduleWrites && target == moduleScope)
+        moduleWrites->emplace_back(name, &info);
+    if (scopes[target].names.size() != before)
+    {
+        // A new binding shadows whatever reads between here and there resolved to.
+        // Scopes already closed never read again: the parser runs in source order.
+        for (int s = from;; s = scopes[s].parent)
+        {
+            scopes[s].resolved.erase(name.id());
+            if (s == target || scopes[s].parent < 0)
+                break;
+        }
+    }
+    info.usageCount++;
+    return info;
+}
+
+SymbolTable::SymbolInfo &SymbolTable::lookup(int scope, InternedString name, int lineNumber)
+{
+    auto redirect = scopes[scope].redirects.find(name.id());
+    if (redirect != scopes[scope].redirects.end())
+        return bindIn(redirect->second, name, lineNumber);
+
+    for (int s = scope; s >= 0; s = scopes[s].parent)
+    {
+        // Class bodies are not enclosing scopes for the functions inside them
+        if (s != scope && scopes[s].isClass)
+            continue;
+        auto it = scopes[s].names.find(name.id());
+        if (it != scopes[s].names.end())
+            return it->second->second;
+    }
+    if (moduleHistory)
+    {
+        if (const ModuleHistory::Version *version = moduleHistory->before(name.id(), historySegment))
         {
-            it->second.type = type;
+            SymbolInfo &info = bindIn(moduleScope, name, lineNumber);
+            info.type = version->type;
+            info.value = version->value;
+            return info;
         }
-        if (!val.empty())
+    }
+    if (builtinNames.count(name.view()))
+        return bindIn(builtinScope, name, lineNumber);
+    return bindIn(moduleScope, name, lineNumber);
+}
+
+void SymbolTable::setModuleSnapshot(const ModuleHistory *history, uint32_t segment)
+{
+    moduleHistory = history;
+    historySegment = segment;
+    // Earlier reads may resolve differently against another snapshot
+    for (Scope &scope : scopes)
+        scope.resolved.clear();
+    for (auto &[name, entry] : scopes[moduleScope].names)
+    {
+        const ModuleHistory::Version *version = history ? history->before(name, segment) : nullptr;
+        entry->second.type = version ? version->type : "unknown";
+        entry->second.value = version ? version->value : SourceSpan();
+    }
+}
+
+const ModuleHistory::Version *ModuleHistory::before(uint32_t name, uint32_t segment) const
+{
+    auto it = versions.find(name);
+    if (it == versions.end())
+        return nullptr;
+    const vector<Version> &list = it->second;
+    auto next = lower_bound(list.begin(), list.end(), segment,
+                            [](const Version &v, uint32_t value)
+                            { return v.segment < value; });
+    return next == list.begin() ? nullptr : &*(next - 1);
+}
+
+SymbolTable::SymbolInfo &SymbolTable::resolve(InternedString name, InternedString scope, int lineNumber)
+{
+    int from = scopeId(scope);
+    auto cached = scopes[from].resolved.find(name.id());
+    SymbolInfo *info;
+    if (cached != scopes[from].resolved.end())
+    {
+        info = cached->second;
+    }
+    else
+    {
+        info = &lookup(from, name, lineNumber);
+        scopes[from].resolved.emplace(name.id(), info);
+    }
+    info->usageCount++;
+    return *info;
+}
+
+void SymbolTable::declareClass(InternedString scope)
+{
+    scopes[scopeId(scope)].isClass = true;
+}
+
+void SymbolTable::declareGlobal(InternedString name, InternedString scope)
+{
+    int from = scopeId(scope);
+    if (from == moduleScope)
+        return;
+    scopes[from].redirects[name.id()] = moduleScope;
+    scopes[from].resolved.erase(name.id());
+}
+
+void SymbolTable::declareNonlocal(InternedString name, InternedString scope)
+{
+    int from = scopeId(scope);
+    // The nearest enclosing function that binds the name, else the nearest one
+    int target = -1;
+    for (int s = scopes[from].parent; s > moduleScope; s = scopes[s].parent)
+    {
+        if (scopes[s].isClass)
+            continue;
+        if (target < 0)
+            target = s;
+        if (scopes[s].names.count(name.id()))
         {
-            it->second.value = val;
+            target = s;
+            break;
         }
     }
+    if (target < 0)
+        return; // not inside a nested function: a SyntaxError in Python
+    scopes[from].redirects[name.id()] = target;
+    scopes[from].resolved.erase(name.id());
+}
+
+int SymbolTable::addSymbol(string_view name, const string &type,
+                           int lineNumber, string_view scope,
+                           SourceSpan val)
+{
+    SymbolInfo &info = bindIn(scopeId(pool->intern(scope)), pool->intern(name), lineNumber);
+    info.usageCount++;
+    if (info.type == "unknown" && type != "unknown")
+    {
+        info.type = type;
+    }
+    if (!val.empty())
+    {
+        info.value = val;
+    }
+    return info.entry;
 }
 
-// ... (Other SymbolTable methods from your code)
 void SymbolTable::updateType(const string &name, const string &scope, const string &newType)
 {
     string key = name + "@" + scope;
@@ -53,7 +291,7 @@ void SymbolTable::updateType(const string &name, const string &scope, const stri
         table[key].type = newType;
     }
 }
-void SymbolTable::updateValue(const string &name, const string &scope, const string &newValue)
+void SymbolTable::updateValue(const string &name, const string &scope, SourceSpan newValue)
 {
     string key = name + "@" + scope;
     if (table.find(key) != table.end())
@@ -70,54 +308,366 @@ string SymbolTable::getType(const string &name, const string &scope)
     auto it = table.find(name + "@" + scope);
     return it != table.end() ? it->second.type : "unknown";
 }
-string SymbolTable::getValue(const string &name, const string &scope)
+SourceSpan SymbolTable::getValue(const string &name, const string &scope)
 {
     auto it = table.find(name + "@" + scope);
-    return it != table.end() ? it->second.value : "";
+    return it != table.end() ? it->second.value : SourceSpan();
+}
+
+vector<SymbolTable::SymbolRecord> SymbolTable::records() const
+{
+    vector<SymbolRecord> rows;
+    rows.reserve(symbolCount());
+    forEachRecord([&](const string &name, const SymbolInfo &info)
+                  { rows.push_back({name, info}); });
+    return rows;
 }
 
-void SymbolTable::printSymbols(ostream &out)
+void SymbolTable::load(vector<SymbolRecord> rows)
 {
-    // Create a vector of pairs to sort by entry
-    vector<pair<string, SymbolInfo>> sortedSymbols(table.begin(), table.end());
-    sort(sortedSymbols.begin(), sortedSymbols.end(),
-         [](const pair<string, SymbolInfo> &a, const pair<string, SymbolInfo> &b)
-         {
-             return a.second.entry < b.second.entry;
-         });
+    CrossReferenceIndex kept = move(references);
+    uint32_t keptFile = file;
+    *this = SymbolTable(*pool);
+    references = move(kept);
+    file = keptFile;
+    table.reserve(rows.size());
+    for (SymbolRecord &row : rows)
+    {
+        int scope = row.info.scope == scopes[builtinScope].path ? builtinScope : scopeId(pool->intern(row.info.scope));
+        Entry &entry = *table.try_emplace(row.name + "@" + row.info.scope).first;
+        entry.second = move(row.info);
+        nextEntry = max(nextEntry, entry.second.entry + 1);
+        scopes[scope].names.emplace(pool->intern(row.name).id(), &entry);
+    }
+}
 
+void SymbolTable::printSymbols(ostream &out, const SourceView &source)
+{
     out << "Symbol Table:\n";
-    for (auto &[key, info] : sortedSymbols)
+    forEachRecord([&](const string &name, const SymbolInfo &info)
+                  {
+                      out << "Entry: " << info.entry
+                          << ", Name: " << name
+                          << ", Scope: " << info.scope
+                          << ", Type: " << info.type
+                          << ", First Appearance: Line " << info.firstAppearance
+                          << ", Usage Count: " << info.usageCount;
+                      if (!info.value.empty())
+                          out << ", Value: " << spanText(source, info.value);
+                      out << "\n";
+                  });
+}
+
+// ----------------------------------------------
+// Spilling cold scopes
+// ----------------------------------------------
+// A scope the parser has left is cold: apart from a later def of the same
+// name, which pages it back in, nothing reads its symbols again until the
+// table is reported. Its records go to the spill file in one chunk:
+//   i32 entry, first appearance, usage count; u32 value file, offset,
+//   length; u32 type length, key length; type and key bytes
+namespace
+{
+constexpr uint32_t spillCheckInterval = 4096; // statements between residency checks
+constexpr size_t spilledRecordHeader = 8 * sizeof(uint32_t);
+
+void putSpilled(string &out, uint32_t v)
+{
+    out.append(reinterpret_cast<const char *>(&v), sizeof(v));
+}
+
+uint32_t getSpilled(const char *&p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    p += sizeof(v);
+    return v;
+}
+
+// One record at p; advances past it
+void readSpilled(const char *&p, string &key, SymbolTable::SymbolInfo &info)
+{
+    info.entry = static_cast<int>(getSpilled(p));
+    info.firstAppearance = static_cast<int>(getSpilled(p));
+    info.usageCount = static_cast<int>(getSpilled(p));
+    info.value.file = getSpilled(p);
+    info.value.offset = getSpilled(p);
+    info.value.length = getSpilled(p);
+    uint32_t typeLength = getSpilled(p);
+    uint32_t keyLength = getSpilled(p);
+    info.type.assign(p, typeLength);
+    p += typeLength;
+    key.assign(p, keyLength);
+    p += keyLength;
+}
+} // namespace
+
+void SymbolTable::spillTo(SpillFile &file, size_t limit)
+{
+    spill = &file;
+    spillAt = limit;
+    untilSpillCheck = spillCheckInterval;
+}
+
+void SymbolTable::spillCold()
+{
+    untilSpillCheck = spillCheckInterval;
+    if (residentBytes() < spillAt)
+        return;
+
+    // The scope in use and those enclosing it stay
+    vector<int> inUse;
+    for (int s = lastScopeId; s > builtinScope; s = scopes[s].parent)
+        inUse.push_back(s);
+
+    string chunk;
+    const uint64_t base = spill->size();
+    uint64_t symbols = 0;
+    size_t kept = 0;
+    for (int id : residentScopes)
+    {
+        if (find(inUse.begin(), inUse.end(), id) != inUse.end())
+        {
+            residentScopes[kept++] = id;
+            continue;
+        }
+        Scope &scope = scopes[id];
+        scope.listed = false;
+        scope.resolved = {}; // may point into scopes spilled alongside
+        if (scope.names.empty())
+            continue;
+        scope.spilled = true;
+        scope.spillStart = base + chunk.size();
+        for (auto &[name, entry] : scope.names)
+        {
+            const SymbolInfo &info = entry->second;
+            spilledRecords.push_back({info.entry, id, base + chunk.size()});
+            putSpilled(chunk, static_cast<uint32_t>(info.entry));
+            putSpilled(chunk, static_cast<uint32_t>(info.firstAppearance));
+            putSpilled(chunk, static_cast<uint32_t>(info.usageCount));
+            putSpilled(chunk, info.value.file);
+            putSpilled(chunk, info.value.offset);
+            putSpilled(chunk, info.value.length);
+            putSpilled(chunk, static_cast<uint32_t>(info.type.size()));
+            putSpilled(chunk, static_cast<uint32_t>(entry->first.size()));
+            chunk += info.type;
+            chunk += entry->first;
+            table.erase(table.find(entry->first));
+        }
+        symbols += scope.names.size();
+        spilledSymbols += scope.names.size();
+        scope.spillEnd = base + chunk.size();
+        scope.names = {};
+    }
+    residentScopes.resize(kept);
+    if (!chunk.empty())
+    {
+        spill->append(chunk.data(), chunk.size());
+        spill->countSpilled(0, symbols);
+    }
+}
+
+void SymbolTable::pageIn(int id)
+{
+    Scope &scope = scopes[id];
+    string chunk(static_cast<size_t>(scope.spillEnd - scope.spillStart), '\0');
+    spill->read(scope.spillStart, chunk.size(), &chunk[0]);
+    string key;
+    SymbolInfo info;
+    for (const char *p = chunk.data(); p < chunk.data() + chunk.size();)
+    {
+        readSpilled(p, key, info);
+        info.scope = scope.path;
+        string name = key.substr(0, key.size() - scope.path.size() - 1);
+        Entry &entry = *table.try_emplace(move(key)).first;
+        entry.second = move(info);
+        scope.names.emplace(pool->intern(name).id(), &entry);
+        spilledSymbols--;
+    }
+    scope.spilled = false;
+}
+
+void SymbolTable::forEachRecord(const function<void(const string &name, const SymbolInfo &info)> &visit) const
+{
+    // In entry order, as records() has it; spilled rows carry their offset
+    struct Row
     {
-        auto at = key.find('@');
-        string name = key.substr(0, at);
-        string scope = key.substr(at + 1);
-        out << "Entry: " << info.entry
-            << ", Name: " << name
-            << ", Scope: " << scope
-            << ", Type: " << info.type
-            << ", First Appearance: Line " << info.firstAppearance
-            << ", Usage Count: " << info.usageCount;
-        if (!info.value.empty())
-            out << ", Value: " << info.value;
-        out << "\n";
+        int entry;
+        const Entry *resident;
+        uint64_t offset;
+    };
+    vector<Row> rows;
+    rows.reserve(symbolCount());
+    for (const Entry &entry : table)
+        rows.push_back({entry.second.entry, &entry, 0});
+    for (const SpilledRecord &record : spilledRecords)
+    {
+        const Scope &scope = scopes[record.scope];
+        if (scope.spilled && record.offset >= scope.spillStart && record.offset < scope.spillEnd)
+            rows.push_back({record.entry, nullptr, record.offset});
+    }
+    sort(rows.begin(), rows.end(), [](const Row &a, const Row &b)
+         { return a.entry < b.entry; });
+
+    string name;
+    string key;
+    SymbolInfo info;
+    string buffer;
+    for (const Row &row : rows)
+    {
+        if (row.resident)
+        {
+            const string &residentKey = row.resident->first;
+            name.assign(residentKey, 0, residentKey.find('@'));
+            visit(name, row.resident->second);
+            continue;
+        }
+        char header[spilledRecordHeader];
+        spill->read(row.offset, sizeof(header), header);
+        uint32_t lengths[2];
+        memcpy(lengths, header + 6 * sizeof(uint32_t), sizeof(lengths));
+        buffer.resize(sizeof(header) + lengths[0] + lengths[1]);
+        memcpy(&buffer[0], header, sizeof(header));
+        spill->read(row.offset + sizeof(header), lengths[0] + lengths[1], &buffer[sizeof(header)]);
+        const char *p = buffer.data();
+        readSpilled(p, key, info);
+        size_t at = key.find('@');
+        name.assign(key, 0, at);
+        info.scope = key.substr(at + 1);
+        visit(name, info);
     }
 }
 
 // ----------------------------------------------
 // Lexer Implementation
 // ----------------------------------------------
-vector<Token> Lexer::tokenize(const string &source, vector<Error> &errors)
+Lexer::Lexer(StringPool &strings)
+    : strings(&strings) {}
+
+vector<Token> Lexer::tokenize(const SourceView &source, vector<Error> &errors)
+{
+    return run(source, errors, nullptr);
+}
+
+void Lexer::tokenize(const SourceView &source, vector<Error> &errors, TokenQueue &queue)
+{
+    vector<Token> rest = run(source, errors, &queue);
+    if (!rest.empty())
+        queue.push(move(rest));
+    queue.close();
+}
+
+void Lexer::tokenize(const SourceView &source, vector<Error> &errors, CompressedTokens &store)
+{
+    store.append(run(source, errors, nullptr, &store));
+    store.finish();
+}
+
+// The code point of the UTF-8 sequence at `i`, which may span chunks
+static char32_t decodeAt(const SourceView &source, size_t i, size_t &length)
+{
+    unsigned char bytes[4];
+    size_t available = min<size_t>(4, source.size() - i);
+    for (size_t k = 0; k < available; k++)
+        bytes[k] = static_cast<unsigned char>(source[i + k]);
+    return unicode::decodeUtf8(bytes, available, length);
+}
+
+static bool startsIdentifier(const SourceView &source, size_t i)
+{
+    unsigned char c = static_cast<unsigned char>(source[i]);
+    if (c < 0x80)
+        return unicode::isAsciiIdentifierStart(c);
+    size_t length;
+    return unicode::isXidStart(decodeAt(source, i, length));
+}
+
+// End of the identifier characters from `i` on
+static size_t identifierEnd(const SourceView &source, size_t i)
+{
+    while (i < source.size())
+    {
+        unsigned char c = static_cast<unsigned char>(source[i]);
+        if (unicode::isAsciiIdentifierContinue(c))
+        {
+            i++;
+            continue;
+        }
+        if (c < 0x80)
+            break;
+        size_t length;
+        char32_t point = decodeAt(source, i, length);
+        if (point == unicode::invalid || !unicode::isXidContinue(point))
+            break;
+        i += length;
+    }
+    return i;
+}
+
+// Reports the first malformed UTF-8 sequence, as Python refuses a file
+// that is not UTF-8. Pure ASCII runs are skipped a block at a time.
+static void checkUtf8(const SourceView &source, vector<Error> &errors)
+{
+    size_t i = 0;
+    while (i < source.size())
+    {
+        string_view run = source.contiguous(i);
+        size_t ascii = unicode::asciiPrefix(run);
+        i += ascii;
+        if (ascii == run.size())
+            continue;
+        size_t length;
+        if (decodeAt(source, i, length) == unicode::invalid)
+        {
+            int line = 1;
+            for (size_t k = 0; k < i; k++)
+                line += source[k] == '\n';
+            char message[64];
+            snprintf(message, sizeof(message), "Invalid UTF-8 byte 0x%02X",
+                     static_cast<unsigned char>(source[i]));
+            errors.push_back({message, line, i});
+            return;
+        }
+        i += length;
+    }
+}
+
+// With a queue, full blocks go out as the loop fills them and the partial
+// last block is returned
+vector<Token> Lexer::run(const SourceView &source, vector<Error> &errors, TokenQueue *queue,
+                         CompressedTokens *store)
 {
+    TraceScope trace("Lexer::tokenize");
     vector<Token> tokens;
     int lineNumber = 1;
     size_t i = 0;
     indentStack = {0}; // Reset state
+    scopeStack.clear();
+    scope = strings->intern(getScope(scopeStack));
     atLineStart = true;
     lineContinuation = false;
+    checkUtf8(source, errors);
 
     while (i < source.size())
     {
+        if (queue && tokens.size() >= TokenQueue::blockSize)
+        {
+            // Blocks are exactly blockSize long, so the reader can index them
+            vector<Token> next;
+            next.reserve(TokenQueue::blockSize);
+            move(tokens.begin() + TokenQueue::blockSize, tokens.end(), back_inserter(next));
+            tokens.erase(tokens.begin() + TokenQueue::blockSize, tokens.end());
+            if (!queue->push(move(tokens)))
+                return {}; // the parser gave up
+            tokens = move(next);
+        }
+        if (store && tokens.size() >= TokenQueue::blockSize)
+        {
+            // Tokens already made are final; keep the vector's capacity
+            store->append(tokens);
+            tokens.clear();
+        }
+
         // Handle indentation at the start of a line (if not a continuation)
         if (atLineStart && !lineContinuation)
         {
@@ -162,6 +712,7 @@ vector<Token> Lexer::tokenize(const string &source, vector<Error> &errors)
             continue;
         }
 
+        size_t tokenStart = i;
         int startlineNumber = lineNumber;
         try
         {
@@ -171,8 +722,9 @@ vector<Token> Lexer::tokenize(const string &source, vector<Error> &errors)
             {
                 tokens.push_back(Token(
                     TokenType::STRING_LITERAL,
-                    triplestring,
-                    startlineNumber));
+                    strings->intern(triplestring),
+                    startlineNumber,
+                    tokenStart));
                 continue;
             }
         }
@@ -183,43 +735,37 @@ vector<Token> Lexer::tokenize(const string &source, vector<Error> &errors)
         }
 
         // Identify keywords and identifiers
-        if (isalpha(static_cast<unsigned char>(c)) || c == '_')
+        if (startsIdentifier(source, i))
         {
             size_t start = i;
-            while (i < source.size() &&
-                   (isalnum(static_cast<unsigned char>(source[i])) || source[i] == '_'))
-            {
-                i++;
-            }
+            i = identifierEnd(source, i);
             string word = source.substr(start, i - start);
             if (pythonKeywords.find(word) != pythonKeywords.end())
             {
                 // change the scope if it is a function or class
                 if (word == "def" || word == "class")
                 {
-                    tokens.push_back(Token(pythonKeywords[word], word, lineNumber));
+                    tokens.push_back(Token(pythonKeywords[word], strings->intern(word), lineNumber, tokenStart));
                     skipNonLeadingWhitespace(source, i);
                     size_t identifierStart = i;
-                    while (i < source.size() && (isalnum(static_cast<unsigned char>(source[i])) || source[i] == '_'))
-                    {
-                        i++;
-                    }
+                    i = identifierEnd(source, i);
                     if (identifierStart < i)
                     {
                         string identifier = source.substr(identifierStart, i - identifierStart);
                         scopeStack.push_back({identifier, indentStack.back()});
+                        scope = strings->intern(getScope(scopeStack));
                         // cout<<"Current scope: " << scopeStack << endl;
-                        tokens.push_back(Token(TokenType::IDENTIFIER, identifier, lineNumber, getScope(scopeStack)));
+                        tokens.push_back(Token(TokenType::IDENTIFIER, strings->intern(identifier), lineNumber, identifierStart, scope));
                     }
                 }
                 else
                 {
-                    tokens.push_back(Token(pythonKeywords[word], word, lineNumber));
+                    tokens.push_back(Token(pythonKeywords[word], strings->intern(word), lineNumber, tokenStart));
                 }
             }
             else
             {
-                tokens.push_back(Token(TokenType::IDENTIFIER, word, lineNumber, getScope(scopeStack)));
+                tokens.push_back(Token(TokenType::IDENTIFIER, strings->intern(word), lineNumber, tokenStart, scope));
                 // cout<< "scope of " << word << " is " << scopeStack << endl;
             }
             continue;
@@ -232,7 +778,7 @@ vector<Token> Lexer::tokenize(const string &source, vector<Error> &errors)
                 string threeChars = source.substr(i, 3);
                 if (operators.find(threeChars) != operators.end())
                 {
-                    tokens.push_back(Token(TokenType::OPERATOR, threeChars, lineNumber));
+                    tokens.push_back(Token(TokenType::OPERATOR, strings->intern(threeChars), lineNumber, tokenStart));
                     i += 3;
                     continue;
                 }
@@ -242,7 +788,7 @@ vector<Token> Lexer::tokenize(const string &source, vector<Error> &errors)
                 string twoChars = source.substr(i, 2);
                 if (operators.find(twoChars) != operators.end())
                 {
-                    tokens.push_back(Token(TokenType::OPERATOR, twoChars, lineNumber));
+                    tokens.push_back(Token(TokenType::OPERATOR, strings->intern(twoChars), lineNumber, tokenStart));
                     i += 2;
                     continue;
                 }
@@ -250,7 +796,7 @@ vector<Token> Lexer::tokenize(const string &source, vector<Error> &errors)
             string oneChar(1, c);
             if (operators.find(oneChar) != operators.end())
             {
-                tokens.push_back(Token(TokenType::OPERATOR, oneChar, lineNumber));
+                tokens.push_back(Token(TokenType::OPERATOR, strings->intern(oneChar), lineNumber, tokenStart));
                 i++;
                 continue;
             }
@@ -264,8 +810,9 @@ vector<Token> Lexer::tokenize(const string &source, vector<Error> &errors)
                 string str = handleDoubleQuotedString(source, i, lineNumber);
                 tokens.push_back(Token(
                     TokenType::STRING_LITERAL,
-                    str,
-                    lineNumber));
+                    strings->intern(str),
+                    lineNumber,
+                    tokenStart));
             }
             catch (const UnterminatedStringError &e)
             {
@@ -274,38 +821,39 @@ vector<Token> Lexer::tokenize(const string &source, vector<Error> &errors)
             continue;
         }
 
-        // Handle numeric literals
-        if (isdigit(static_cast<unsigned char>(c)))
+        // Handle numeric literals; ".5" is one too
+        if (isdigit(static_cast<unsigned char>(c)) ||
+            (c == '.' && i + 1 < source.size() && isdigit(static_cast<unsigned char>(source[i + 1]))))
         {
-            size_t start = i;
-            bool hasDot = false;
-            while (i < source.size() && (isdigit(source[i]) || source[i] == '.'))
-            {
-                if (source[i] == '.' && hasDot)
-                    break;
-                else if (source[i] == '.')
-                    hasDot = true;
-                i++;
-            }
-            string num = source.substr(start, i - start);
-            if (num[0] == '0' && std::stoi(num) != 0 && !hasDot)
-            {
-                errors.push_back({"leading zeros in decimal integer literals are not permitted", lineNumber, start});
-                continue;
-            }
-            tokens.push_back(Token(TokenType::NUMBER, num, lineNumber));
+            lexNumber(source, i, lineNumber, tokens, errors);
             continue;
         }
 
         // Handle punctuation symbols
         if (punctuationSymbols.find(c) != punctuationSymbols.end())
         {
-            tokens.push_back(Token(punctuationSymbols[c], string(1, c), lineNumber));
+            tokens.push_back(Token(punctuationSymbols[c], strings->intern(string_view(&c, 1)), lineNumber, tokenStart));
             i++;
             continue;
         }
 
         // Unknown character - add error but keep going
+        if (static_cast<unsigned char>(c) >= 0x80)
+        {
+            // A whole character, named as Python does; malformed bytes
+            // were reported by checkUtf8
+            size_t length;
+            char32_t point = decodeAt(source, i, length);
+            if (point != unicode::invalid)
+            {
+                char code[16];
+                snprintf(code, sizeof(code), "U+%04X", static_cast<unsigned>(point));
+                errors.push_back({"Invalid character '" + source.substr(i, length) + "' (" + code + ")", lineNumber, i});
+            }
+            i += length;
+            atLineStart = false;
+            continue;
+        }
         errors.push_back({"Invalid character '" + string(1, c) + "'", lineNumber, i});
         i++;
         atLineStart = false;
@@ -315,28 +863,24 @@ vector<Token> Lexer::tokenize(const string &source, vector<Error> &errors)
     while (indentStack.size() > 1)
     {
         indentStack.pop_back();
-        tokens.push_back(Token(TokenType::DEDENT, "", lineNumber));
+        tokens.push_back(Token(TokenType::DEDENT, InternedString(), lineNumber, source.size()));
     }
 
     return tokens;
 }
 
-void Lexer::skipNonLeadingWhitespace(const string &source, size_t &idx)
+void Lexer::skipNonLeadingWhitespace(const SourceView &source, size_t &idx)
 {
-    static const regex ws_regex(R"(^[ \t\r]+)");
-    smatch match;
-
-    if (idx >= source.size())
-        return;
-
-    string remaining = source.substr(idx);
-    if (regex_search(remaining, match, ws_regex, regex_constants::match_continuous))
+    // Plain scan instead of a regex: a regex needs contiguous text and would
+    // copy the rest of the source on every call.
+    while (idx < source.size() &&
+           (source[idx] == ' ' || source[idx] == '\t' || source[idx] == '\r'))
     {
-        idx += match.length(); // Advance past matched whitespace
+        idx++;
     }
 }
 
-string Lexer::handleTripleQuotedString(const string &source, size_t &idx, int &lineNumber)
+string Lexer::handleTripleQuotedString(const SourceView &source, size_t &idx, int &lineNumber)
 {
     int start_line = lineNumber;
     if (idx + 2 < source.size())
@@ -382,12 +926,141 @@ string Lexer::handleTripleQuotedString(const string &source, size_t &idx, int &l
     return "";
 }
 
+// Scans a literal in Python's number syntax: 0x/0o/0b integers, decimals
+// with a fraction or exponent, a j suffix, and single '_' between digits.
+// The value is converted once here, with from_chars on the digits stripped
+// of '_'. A malformed literal is skipped with an error instead of a token.
+void Lexer::lexNumber(const SourceView &source, size_t &i, int lineNumber,
+                      vector<Token> &tokens, vector<Error> &errors)
+{
+    const size_t start = i;
+    const size_t n = source.size();
+    string digits;
+    auto isDecimal = [](char c)
+    { return c >= '0' && c <= '9'; };
+    auto isIdentifierChar = [&](size_t at)
+    {
+        unsigned char c = static_cast<unsigned char>(source[at]);
+        return unicode::isAsciiIdentifierContinue(c) || c >= 0x80;
+    };
+    auto fail = [&](const string &message)
+    {
+        while (i < n && isIdentifierChar(i))
+            i++;
+        errors.push_back({message, lineNumber, start});
+    };
+    // Digits with at most one '_' between neighbours; false on a stray '_'
+    auto digitRun = [&](auto isDigit)
+    {
+        while (true)
+        {
+            while (i < n && isDigit(source[i]))
+                digits += source[i++];
+            if (i + 1 < n && source[i] == '_' && isDigit(source[i + 1]))
+                i++;
+            else
+                return !(i < n && source[i] == '_');
+        }
+    };
+    // Python lets a few keywords follow a number directly, as in `1if x else 2`
+    auto gluedToName = [&]
+    {
+        if (i >= n || !isIdentifierChar(i))
+            return false;
+        size_t end = i;
+        while (end < n && isIdentifierChar(end))
+            end++;
+        static const unordered_set<string> allowed = {"and", "else", "for", "if", "in", "is", "not", "or"};
+        return allowed.count(source.substr(i, end - i)) == 0;
+    };
+
+    Token token(TokenType::NUMBER, InternedString(), lineNumber, start);
+    char prefix = i + 1 < n && source[i] == '0' ? static_cast<char>(tolower(static_cast<unsigned char>(source[i + 1]))) : 0;
+    if (prefix == 'x' || prefix == 'o' || prefix == 'b')
+    {
+        int base = prefix == 'x' ? 16 : prefix == 'o' ? 8 : 2;
+        const char *name = base == 16 ? "hexadecimal" : base == 8 ? "octal" : "binary";
+        auto isDigit = [base](char c)
+        {
+            if (base == 16)
+                return isxdigit(static_cast<unsigned char>(c)) != 0;
+            return c >= '0' && c < '0' + base;
+        };
+        i += 2;
+        if (i < n && source[i] == '_')
+            i++;
+        if (i < n && !isDigit(source[i]) && isDecimal(source[i]))
+            return fail(string("invalid digit '") + source[i] + "' in " + name + " literal");
+        if (i >= n || !isDigit(source[i]) || !digitRun(isDigit))
+            return fail(string("invalid ") + name + " literal");
+        if (i < n && isDecimal(source[i]))
+            return fail(string("invalid digit '") + source[i] + "' in " + name + " literal");
+        if (gluedToName())
+            return fail(string("invalid ") + name + " literal");
+        auto [end, ec] = from_chars(digits.data(), digits.data() + digits.size(), token.intValue, base);
+        token.numberKind = ec == errc() ? NumberKind::Integer : NumberKind::BigInteger;
+    }
+    else
+    {
+        bool isFloat = false;
+        if (isDecimal(source[i]) && !digitRun(isDecimal))
+            return fail("invalid decimal literal");
+        if (i < n && source[i] == '.')
+        {
+            digits += source[i++];
+            isFloat = true;
+            if (i < n && isDecimal(source[i]) && !digitRun(isDecimal))
+                return fail("invalid decimal literal");
+        }
+        if (i < n && (source[i] == 'e' || source[i] == 'E'))
+        {
+            size_t at = i + 1;
+            if (at < n && (source[at] == '+' || source[at] == '-'))
+                at++;
+            // Otherwise the e starts a name, as in `1else`
+            if (at < n && isDecimal(source[at]))
+            {
+                digits += 'e';
+                if (at > i + 1)
+                    digits += source[i + 1];
+                i = at;
+                if (!digitRun(isDecimal))
+                    return fail("invalid decimal literal");
+                isFloat = true;
+            }
+        }
+        bool imaginary = i < n && (source[i] == 'j' || source[i] == 'J');
+        if (imaginary)
+            i++;
+        if (gluedToName())
+            return fail("invalid decimal literal");
+        if (!isFloat && !imaginary && digits.size() > 1 && digits[0] == '0' &&
+            digits.find_first_not_of('0') != string::npos)
+            return fail("leading zeros in decimal integer literals are not permitted");
+
+        if (isFloat || imaginary)
+        {
+            token.numberKind = imaginary ? NumberKind::Imaginary : NumberKind::Float;
+            auto [end, ec] = from_chars(digits.data(), digits.data() + digits.size(), token.floatValue);
+            if (ec == errc::result_out_of_range)
+                token.floatValue = strtod(digits.c_str(), nullptr); // inf, or 0 on underflow, as Python has it
+        }
+        else
+        {
+            auto [end, ec] = from_chars(digits.data(), digits.data() + digits.size(), token.intValue);
+            token.numberKind = ec == errc() ? NumberKind::Integer : NumberKind::BigInteger;
+        }
+    }
+    token.lexeme = strings->intern(source.substr(start, i - start));
+    tokens.push_back(move(token));
+}
+
 bool Lexer::isOperatorStart(char c)
 {
-    regex operatorRegex("[~+\\-*/%=!<>&|^]");
-    return regex_match(string(1, c), operatorRegex);
+    // Called once per character, so no regex here
+    return c != '\0' && strchr("~+-*/%=!<>&|^", c) != nullptr;
 }
-string Lexer::handleDoubleQuotedString(const string &source, size_t &idx, int &lineNumber)
+string Lexer::handleDoubleQuotedString(const SourceView &source, size_t &idx, int &lineNumber)
 {
     int start_line = lineNumber;
     if (idx < source.size())
@@ -419,7 +1092,7 @@ string Lexer::handleDoubleQuotedString(const string &source, size_t &idx, int &l
     throw UnterminatedStringError(start_line, idx);
 }
 
-void Lexer::processIndentation(const string &source, size_t &i, int lineNumber,
+void Lexer::processIndentation(const SourceView &source, size_t &i, int lineNumber,
                                vector<Token> &tokens, vector<Error> &errors)
 {
     size_t start = i;
@@ -448,7 +1121,7 @@ void Lexer::processIndentation(const string &source, size_t &i, int lineNumber,
     if (newIndent > indentStack.back())
     {
         indentStack.push_back(newIndent);
-        tokens.push_back(Token(TokenType::INDENT, "", lineNumber));
+        tokens.push_back(Token(TokenType::INDENT, InternedString(), lineNumber, start));
     }
     else if (newIndent < indentStack.back())
     {
@@ -456,11 +1129,12 @@ void Lexer::processIndentation(const string &source, size_t &i, int lineNumber,
         while (indentStack.back() > newIndent)
         {
             indentStack.pop_back();
-            tokens.push_back(Token(TokenType::DEDENT, "", lineNumber));
+            tokens.push_back(Token(TokenType::DEDENT, InternedString(), lineNumber, start));
             // Pop scope ONLY if dedenting past its original indentation level
             while (!scopeStack.empty() && indentStack.back() <= scopeStack.back().indentLevel)
             {
                 scopeStack.pop_back();
+                scope = strings->intern(getScope(scopeStack));
             }
             if (indentStack.empty())
             {
@@ -499,50 +1173,335 @@ string Lexer::getScope(const vector<ScopeInfo> &scopeStack)
 }
 
 // ----------------------------------------------
-// Parser Implementation
+// Token streaming Implementation
 // ----------------------------------------------
-Parser::Parser(const vector<Token> &tokens, SymbolTable &symTable)
-    : tokens(tokens), symbolTable(symTable) {}
+TokenQueue::TokenQueue(size_t capacity)
+    : slots(new vector<Token>[max<size_t>(capacity, 1)]), capacity(max<size_t>(capacity, 1))
+{
+}
 
-void Parser::parse()
+// A sleeper registers, then checks `ready`, all under the lock; a waker
+// publishes its index, then checks for sleepers. Both sides use seq_cst, so
+// either the sleeper sees the new index or the waker sees the sleeper, and
+// since the sleeper holds the lock until it waits, the notify can't slip in
+// between its check and its wait.
+template <typename Ready>
+void TokenQueue::waitUntil(Ready ready)
 {
-    size_t i = 0;
-    while (i < tokens.size())
+    unique_lock<mutex> hold(lock);
+    sleepers.fetch_add(1);
+    wake.wait(hold, ready);
+    sleepers.fetch_sub(1);
+}
+
+void TokenQueue::notify()
+{
+    if (sleepers.load() != 0)
     {
-        const Token &tk = tokens[i];
+        lock_guard<mutex> hold(lock);
+        wake.notify_all();
+    }
+}
 
-        if (tk.type == TokenType::DefKeyword || tk.type == TokenType::ClassKeyword)
-        {
-            lastKeyword = tk.lexeme;
-            i++;
-        }
-        else if (tk.type == TokenType::IDENTIFIER)
-        {
-            // If last keyword was 'def' or 'class', then this is a new function/class name
-            if (lastKeyword == "def")
-            {
-                symbolTable.addSymbol(tk.lexeme, "function", tk.lineNumber, tk.scope);
-                lastKeyword.clear();
-                i++;
+bool TokenQueue::push(vector<Token> &&block)
+{
+    size_t t = tail.load(memory_order_relaxed);
+    auto ready = [&]
+    { return t - head.load() < capacity || closed.load(); };
+    if (!ready())
+        waitUntil(ready);
+    if (closed.load())
+        return false;
+    slots[t % capacity] = move(block);
+    tail.store(t + 1);
+    notify();
+    return true;
+}
+
+bool TokenQueue::pop(vector<Token> &block)
+{
+    size_t h = head.load(memory_order_relaxed);
+    auto ready = [&]
+    { return tail.load() != h || closed.load(); };
+    if (!ready())
+        waitUntil(ready);
+    if (tail.load() == h)
+        return false; // closed and drained
+    block = move(slots[h % capacity]);
+    head.store(h + 1);
+    notify();
+    return true;
+}
+
+void TokenQueue::close()
+{
+    closed.store(true);
+    lock_guard<mutex> hold(lock);
+    wake.notify_all();
+}
+
+TokenStream::TokenStream(const vector<Token> &tokens)
+    : whole(&tokens), available(tokens.size())
+{
+}
+
+TokenStream::TokenStream(TokenQueue &queue)
+    : queue(&queue)
+{
+}
+
+TokenStream::TokenStream(const CompressedTokens &store)
+    : available(store.size()), store(&store), decoded(cachedBlocks)
+{
+}
+
+bool TokenStream::receive(size_t i)
+{
+    while (queue && i >= available)
+    {
+        blocks.emplace_back();
+        if (!queue->pop(blocks.back()))
+        {
+            blocks.pop_back();
+            queue = nullptr;
+            break;
+        }
+        available += blocks.back().size();
+    }
+    return i < available;
+}
+
+// Compressed mode, token i outside the block read last: reuse its block
+// if it is cached, else decode it over the least recently used one
+const Token &TokenStream::decode(size_t i) const
+{
+    size_t block = i / CompressedTokens::blockSize;
+    DecodedBlock *slot = &decoded[0];
+    for (DecodedBlock &candidate : decoded)
+    {
+        if (candidate.block == block)
+        {
+            slot = &candidate;
+            break;
+        }
+        if (candidate.used < slot->used)
+            slot = &candidate;
+    }
+    if (slot->block != block)
+    {
+        store->decodeBlock(block, slot->tokens);
+        slot->block = block;
+    }
+    slot->used = ++clock;
+    hot = slot->tokens.data();
+    hotFirst = block * CompressedTokens::blockSize;
+    hotCount = slot->tokens.size();
+    return hot[i - hotFirst];
+}
+
+size_t TokenStream::size()
+{
+    receive(SIZE_MAX);
+    return available;
+}
+
+vector<Token> TokenStream::take()
+{
+    receive(SIZE_MAX);
+    if (whole)
+        return *whole;
+    if (store)
+        return store->decodeAll();
+    vector<Token> out;
+    out.reserve(available);
+    for (vector<Token> &block : blocks)
+        move(block.begin(), block.end(), back_inserter(out));
+    blocks.clear();
+    available = 0;
+    return out;
+}
+
+// ----------------------------------------------
+// Parser Implementation
+// ----------------------------------------------
+Parser::Parser(const vector<Token> &tokens, SymbolTable &symTable)
+    : wholeFile(tokens), tokens(wholeFile), symbolTable(symTable) {}
+
+Parser::Parser(TokenStream &tokens, SymbolTable &symTable)
+    : tokens(tokens), symbolTable(symTable) {}
+
+static bool isAugmentedAssignment(string_view op)
+{
+    static const unordered_set<string_view> ops = {"+=", "-=", "*=", "/=", "//=", "%=", "**=",
+                                                   "&=", "|=", "^=", ">>=", "<<=", "@="};
+    return ops.count(op) != 0;
+}
+
+// `from` also appears mid-statement in `yield from` and `raise ... from`
+static bool startsStatement(const TokenStream &tokens, size_t i)
+{
+    if (i == 0)
+        return true;
+    const Token &prev = tokens[i - 1];
+    return prev.lineNumber < tokens[i].lineNumber || prev.type == TokenType::INDENT ||
+           prev.type == TokenType::DEDENT || prev.type == TokenType::Semicolon;
+}
+
+// For tracing: the token index just past the body of each def/class
+// keyword (npos elsewhere). A body ends at the DEDENT that closes its
+// INDENT, or for a one-line body at the first token on a later line.
+static vector<size_t> definitionBodyEnds(TokenStream &tokens)
+{
+    struct Pending
+    {
+        size_t keyword;
+        int bodyDepth; // indentation depth inside the body, 0 until its INDENT
+    };
+    vector<size_t> ends(tokens.size(), string::npos);
+    vector<Pending> open;
+    int depth = 0;
+    for (size_t i = 0; tokens.has(i); i++)
+    {
+        const Token &tk = tokens[i];
+        if (tk.type == TokenType::INDENT)
+        {
+            depth++;
+            if (!open.empty() && open.back().bodyDepth == 0)
+                open.back().bodyDepth = depth;
+        }
+        else if (tk.type == TokenType::DEDENT)
+        {
+            depth--;
+            while (!open.empty() && open.back().bodyDepth > depth)
+            {
+                ends[open.back().keyword] = i + 1;
+                open.pop_back();
             }
-            else if (lastKeyword == "class")
+        }
+        else if (!open.empty() && open.back().bodyDepth == 0 &&
+                 tk.lineNumber > tokens[open.back().keyword].lineNumber)
+        {
+            ends[open.back().keyword] = i;
+            open.pop_back();
+        }
+
+        if (tk.type == TokenType::DefKeyword || tk.type == TokenType::ClassKeyword)
+            open.push_back({i, 0});
+    }
+    for (const Pending &p : open)
+        ends[p.keyword] = tokens.size();
+    return ends;
+}
+
+void Parser::parse()
+{
+    TraceScope trace("Parser::parse");
+    // Finding the body ends takes the whole file, which a stream still
+    // arriving doesn't have; its def/class bodies go untraced
+    vector<size_t> ends = traceEnabled() && tokens.complete() ? definitionBodyEnds(tokens) : vector<size_t>();
+    bodyEnds = ends.empty() ? nullptr : &ends;
+    lastKeyword.clear();
+    parenDepth = 0;
+    lambdas.clear();
+    parseRange(0, SIZE_MAX);
+    bodyEnds = nullptr;
+    symbolTable.references.finalize();
+}
+
+// The statement loop over tokens [begin, end), or to the last token for an
+// `end` of SIZE_MAX. Lookahead inside a statement may read past `end`, as it
+// would in a run over the whole file.
+void Parser::parseRange(size_t begin, size_t end)
+{
+    // Open def/class body spans, innermost last
+    struct BodySpan
+    {
+        size_t end;
+        uint64_t start;
+        const char *kind;
+        string name;
+    };
+    const bool tracing = bodyEnds && traceEnabled();
+    vector<BodySpan> bodies;
+
+    rangeEnd = end;
+    size_t i = begin;
+    while (i < end && tokens.has(i))
+    {
+        symbolTable.spillColdScopes();
+        const Token &tk = tokens[i];
+
+        if (tracing)
+        {
+            while (!bodies.empty() && bodies.back().end <= i)
+            {
+                traceRecord(bodies.back().kind, bodies.back().name, bodies.back().start, traceNow());
+                bodies.pop_back();
+            }
+            // Bodies that continue past `end` are some other range's to trace
+            if ((*bodyEnds)[i] != string::npos && (*bodyEnds)[i] <= end)
             {
-                symbolTable.addSymbol(tk.lexeme, "class", tk.lineNumber, tk.scope);
+                const char *kind = tk.type == TokenType::DefKeyword ? "def" : "class";
+                string name = tokens.has(i + 1) ? tokens[i + 1].lexeme.str() : string();
+                bodies.push_back({(*bodyEnds)[i], traceNow(), kind, name});
+            }
+        }
+
+        if (tk.type == TokenType::DefKeyword || tk.type == TokenType::ClassKeyword)
+        {
+            lastKeyword = tk.lexeme;
+            parenDepth = 0;
+            i++;
+        }
+        else if (tk.type == TokenType::IDENTIFIER)
+        {
+            // If last keyword was 'def' or 'class', then this is a new function/class name.
+            // The lexer already tags the name with the scope it opens; the name
+            // itself is bound in the enclosing one.
+            if (lastKeyword == "def" || lastKeyword == "class")
+            {
+                bool isClass = lastKeyword == "class";
+                if (isClass)
+                    symbolTable.declareClass(tk.scope);
+                InternedString outer = symbolTable.strings().intern(SymbolTable::enclosingScope(tk.scope));
+                auto &info = symbolTable.bind(tk.lexeme, outer, tk.lineNumber);
+                info.type = isClass ? "class" : "function";
+                noteReference(tk, info.entry, CrossReferenceIndex::Kind::Definition);
                 lastKeyword.clear();
                 i++;
+                // A range may stop right after the name and leave the body to parseUnit()
+                if (!isClass && i < rangeEnd)
+                    parseParameters(i);
+            }
+            else if (isAttributeName(i) || isStringPrefix(i))
+            {
+                // obj.name is not a variable, and the f in f"..." is part of the literal
+                i++;
+            }
+            else if (parenDepth > 0)
+            {
+                // Inside a call: name=... is a keyword argument, anything else a read
+                if (tokens.has(i + 1) && tokens[i + 1].type == TokenType::OPERATOR &&
+                    tokens[i + 1].lexeme == "=")
+                    i += 2;
+                else
+                {
+                    resolveName(tk);
+                    i++;
+                }
             }
             else
             {
                 // handle multiple assignment like x,y = 2,3 -> assigns x = 2 and y = 3
                 size_t temp = i;
                 vector<Token> lhsIdentifiers;
-                while (temp < tokens.size())
+                while (tokens.has(temp))
                 {
                     if (tokens[temp].type == TokenType::IDENTIFIER)
                     {
                         lhsIdentifiers.push_back(tokens[temp]);
                         temp++;
-                        if (temp < tokens.size() && tokens[temp].type == TokenType::Comma)
+                        if (tokens.has(temp) && tokens[temp].type == TokenType::Comma)
                         {
                             temp++;
                         }
@@ -557,15 +1516,15 @@ void Parser::parse()
                     }
                 }
 
-                if (temp < tokens.size() && tokens[temp].type == TokenType::OPERATOR && tokens[temp].lexeme == "=")
+                if (tokens.has(temp) && tokens[temp].type == TokenType::OPERATOR && tokens[temp].lexeme == "=")
                 {
                     temp++;
-                    vector<pair<string, string>> rhsValues;
-                    while (temp < tokens.size())
+                    vector<pair<string, SourceSpan>> rhsValues;
+                    while (tokens.has(temp))
                     {
                         auto [type, value] = parseExpression(temp);
                         rhsValues.push_back({type, value});
-                        if (temp < tokens.size() && tokens[temp].type == TokenType::Comma)
+                        if (tokens.has(temp) && tokens[temp].type == TokenType::Comma)
                         {
                             temp++;
                         }
@@ -577,25 +1536,16 @@ void Parser::parse()
 
                     for (size_t j = 0; j < lhsIdentifiers.size(); ++j)
                     {
-                        const Token &var = lhsIdentifiers[j];
-                        string key = var.lexeme + "@" + var.scope;
-                        if (!symbolTable.exist(var.lexeme, var.scope))
-                        {
-                            symbolTable.addSymbol(var.lexeme, "unknown", var.lineNumber, var.scope);
-                        }
-                        else
-                        {
-                            symbolTable.table[key].usageCount++;
-                        }
+                        auto &info = bindName(lhsIdentifiers[j], CrossReferenceIndex::Kind::Assignment);
                         if (j < rhsValues.size())
                         {
                             if (rhsValues[j].first != "unknown")
                             {
-                                symbolTable.updateType(var.lexeme, var.scope, rhsValues[j].first);
+                                info.type = rhsValues[j].first;
                             }
                             if (!rhsValues[j].second.empty())
                             {
-                                symbolTable.updateValue(var.lexeme, var.scope, rhsValues[j].second);
+                                info.value = rhsValues[j].second;
                             }
                         }
                     }
@@ -603,73 +1553,565 @@ void Parser::parse()
                     continue;
                 }
                 // Check if next token is '=' (assignment)
-                if ((i + 1) < tokens.size() &&
+                if (tokens.has(i + 1) &&
                     tokens[i + 1].type == TokenType::OPERATOR &&
                     tokens[i + 1].lexeme == "=")
                 {
                     // We have "identifier = ..."
-                    const string &lhsName = tk.lexeme;
-                    int lineNumber = tk.lineNumber;
-                    // Add symbol if not exist
-                    string fullName = lhsName + "@" + tk.scope;
-                    if (!symbolTable.exist(fullName, tk.scope))
-                    {
-                        symbolTable.addSymbol(lhsName, "unknown", lineNumber, tk.scope);
-                    }
-                    else
-                    {
-                        // If it exists, usage count will increment
-                        symbolTable.table[lhsName + "@" + tk.scope].usageCount++;
-                    }
+                    auto &info = bindName(tk, CrossReferenceIndex::Kind::Assignment);
                     i += 2; // skip past "identifier" and "="
                     auto [rhsType, rhsValue] = parseExpression(i);
 
                     // Update the LHS symbol with the inferred type/value
                     if (rhsType != "unknown")
                     {
-                        symbolTable.updateType(lhsName, tk.scope, rhsType);
+                        info.type = rhsType;
                     }
                     if (!rhsValue.empty())
                     {
-                        symbolTable.updateValue(lhsName, tk.scope, rhsValue);
+                        info.value = rhsValue;
                     }
                 }
+                else if (tokens.has(i + 1) &&
+                         tokens[i + 1].type == TokenType::OPERATOR &&
+                         isAugmentedAssignment(tokens[i + 1].lexeme))
+                {
+                    // x += 1 binds x in this scope just like x = ...
+                    bindName(tk, CrossReferenceIndex::Kind::Assignment);
+                    i++;
+                }
                 else
                 {
-
-                    if (symbolTable.exist(tk.lexeme, tk.scope))
-                    {
-                        symbolTable.table[tk.lexeme + "@" + tk.scope].usageCount++;
-                    }
-
-                    else
-                    {
-                        symbolTable.addSymbol(tk.lexeme, "unknown", tk.lineNumber, tk.scope);
-                    }
+                    resolveName(tk);
                     i++;
                 }
             }
         }
+        else if (tk.type == TokenType::ImportKeyword ||
+                 (tk.type == TokenType::FromKeyword && startsStatement(tokens, i)))
+        {
+            parseImport(i);
+        }
+        else if (tk.type == TokenType::GlobalKeyword || tk.type == TokenType::NonlocalKeyword)
+        {
+            // A long list may scroll tk out of a compressed stream's cache
+            const bool global = tk.type == TokenType::GlobalKeyword;
+            const int line = tk.lineNumber;
+            for (i++; tokens.has(i) && tokens[i].lineNumber == line; i++)
+            {
+                const Token &name = tokens[i];
+                if (name.type == TokenType::Comma)
+                    continue;
+                if (name.type != TokenType::IDENTIFIER)
+                    break;
+                if (global)
+                    symbolTable.declareGlobal(name.lexeme, name.scope);
+                else
+                    symbolTable.declareNonlocal(name.lexeme, name.scope);
+                resolveName(name);
+            }
+        }
+        else if (tk.type == TokenType::ForKeyword)
+        {
+            // Loop targets up to `in`. Comprehensions get no scope of their
+            // own from the lexer, so their targets bind in the enclosing one.
+            const int line = tk.lineNumber;
+            for (i++; tokens.has(i) && tokens[i].type != TokenType::InKeyword && tokens[i].lineNumber == line; i++)
+            {
+                if (tokens[i].type == TokenType::IDENTIFIER && !isAttributeName(i))
+                    bindName(tokens[i], CrossReferenceIndex::Kind::Assignment);
+            }
+        }
+        else if (tk.type == TokenType::LambdaKeyword)
+        {
+            parseLambdaParameters(i);
+        }
+        else if (tk.type == TokenType::AsKeyword)
+        {
+            // with ... as name, except ... as name
+            i++;
+            if (tokens.has(i) && tokens[i].type == TokenType::IDENTIFIER)
+            {
+                bindName(tokens[i], CrossReferenceIndex::Kind::Assignment);
+                i++;
+            }
+        }
         else
         {
-            // We ignore other tokens (operators, delimiters, etc.) for now
+            // We ignore other tokens (operators, delimiters, etc.) for now,
+            // apart from tracking parentheses to spot keyword arguments
+            if (tk.type == TokenType::LeftParenthesis)
+                parenDepth++;
+            else if (tk.type == TokenType::RightParenthesis && parenDepth > 0)
+                parenDepth--;
+            else if (tk.type == TokenType::INDENT || tk.type == TokenType::DEDENT)
+                parenDepth = 0;
             i++;
         }
     }
+    for (; !bodies.empty(); bodies.pop_back())
+        traceRecord(bodies.back().kind, bodies.back().name, bodies.back().start, traceNow());
+}
+
+// ----------------------------------------------
+// Parallel analysis
+// ----------------------------------------------
+// The file is cut into segments: each top-level def/class body is a unit,
+// and the module-level code before, between and after the units (def/class
+// lines up to the name included) forms the segments in between. The
+// module-level segments run first, in order, on this thread and against
+// symbolTable, logging each module-scope binding into a ModuleHistory. The
+// units then run on workers with private tables that read the module as it
+// stood when they began. Units with the same name share scopes in a serial
+// run, so they go to one worker in order; a unit that declares `global`
+// changes module state others read, so it runs with the module level. Last,
+// every table's symbols meet in a ConcurrentSymbolTable tagged with
+// (segment, creation order), whose merge numbers them as a serial run does.
+void Parser::parseUnit(const Unit &unit)
+{
+    TraceScope trace(unit.isClass ? "class" : "def", tokens[unit.name].lexeme);
+    lastKeyword.clear();
+    parenDepth = 0;
+    lambdas.clear();
+    rangeEnd = unit.end;
+    size_t i = unit.begin;
+    if (unit.isClass)
+        symbolTable.declareClass(tokens[unit.name].scope);
+    else
+        parseParameters(i);
+    parseRange(i, unit.end);
 }
 
-pair<string, string> Parser::parseExpression(size_t &i)
+void Parser::parseParallel(unsigned threadCount)
+{
+    if (threadCount == 0)
+        threadCount = max(1u, thread::hardware_concurrency());
+    TraceScope trace("Parser::parseParallel");
+
+    // Find the units and group them by name
+    vector<size_t> ends = definitionBodyEnds(tokens);
+    vector<Unit> units;
+    vector<vector<size_t>> groups; // unit indices in source order
+    vector<bool> groupSerial;
+    vector<size_t> groupOfUnit;
+    unordered_map<uint32_t, size_t> groupByName; // by name id
+    int depth = 0;
+    for (size_t i = 0; tokens.has(i); i++)
+    {
+        const Token &tk = tokens[i];
+        if (tk.type == TokenType::INDENT)
+            depth++;
+        else if (tk.type == TokenType::DEDENT)
+            depth--;
+        else if (depth == 0 && (tk.type == TokenType::DefKeyword || tk.type == TokenType::ClassKeyword) &&
+                 tokens.has(i + 1) && tokens[i + 1].type == TokenType::IDENTIFIER && ends[i] > i + 2)
+        {
+            Unit unit{i + 1, i + 2, ends[i], static_cast<uint32_t>(2 * units.size() + 1),
+                      tk.type == TokenType::ClassKeyword};
+            auto [it, added] = groupByName.try_emplace(tokens[unit.name].lexeme.id(), groups.size());
+            if (added)
+            {
+                groups.emplace_back();
+                groupSerial.push_back(false);
+            }
+            groups[it->second].push_back(units.size());
+            groupOfUnit.push_back(it->second);
+            for (size_t j = unit.begin; j < unit.end; j++)
+            {
+                if (tokens[j].type == TokenType::GlobalKeyword)
+                    groupSerial[it->second] = true;
+            }
+            units.push_back(unit);
+            i = unit.end - 1; // the body's INDENT/DEDENT balance out
+        }
+    }
+    size_t parallelGroups = count(groupSerial.begin(), groupSerial.end(), false);
+    if (threadCount < 2 || parallelGroups < 2)
+    {
+        parse();
+        return;
+    }
+
+    // Module level, with the serial units inline
+    ModuleHistory history;
+    vector<pair<InternedString, SymbolTable::SymbolInfo *>> writes;
+    auto recordWrites = [&](uint32_t segment)
+    {
+        for (auto &[name, info] : writes)
+        {
+            vector<ModuleHistory::Version> &list = history.versions[name.id()];
+            if (list.empty() || list.back().segment != segment)
+                list.push_back({segment, info->type, info->value});
+            else
+                list.back() = {segment, info->type, info->value};
+        }
+        writes.clear();
+    };
+    vector<pair<int, uint32_t>> segmentStarts; // first entry symbolTable created in each segment
+    TraceScope moduleTrace("module level");
+    bodyEnds = traceEnabled() ? &ends : nullptr;
+    lastKeyword.clear();
+    parenDepth = 0;
+    lambdas.clear();
+    symbolTable.moduleWrites = &writes;
+    size_t position = 0;
+    for (size_t u = 0; u < units.size(); u++)
+    {
+        const Unit &unit = units[u];
+        segmentStarts.push_back({symbolTable.nextEntry, unit.segment - 1});
+        parseRange(position, unit.begin);
+        recordWrites(unit.segment - 1);
+        if (groupSerial[groupOfUnit[u]])
+        {
+            segmentStarts.push_back({symbolTable.nextEntry, unit.segment});
+            parseUnit(unit);
+            recordWrites(unit.segment);
+        }
+        position = unit.end;
+    }
+    segmentStarts.push_back({symbolTable.nextEntry, units.back().segment + 1});
+    parseRange(position, tokens.size());
+    symbolTable.moduleWrites = nullptr;
+    moduleTrace.end();
+
+    // Units on workers; this thread publishes the module level meanwhile
+    struct GroupResult
+    {
+        SymbolTable table;
+        vector<pair<int, uint32_t>> segmentStarts;
+        vector<int> ids;
+        exception_ptr error;
+    };
+    // Private tables intern into the shared pool so ids stay comparable
+    vector<GroupResult> results;
+    results.reserve(groups.size());
+    for (size_t g = 0; g < groups.size(); g++)
+    {
+        results.push_back({SymbolTable(symbolTable.strings()), {}, {}, nullptr});
+        results.back().table.file = symbolTable.file;
+    }
+    ConcurrentSymbolTable shared;
+    atomic<size_t> nextGroup{0};
+    auto work = [&]
+    {
+        setTraceThreadName("parse worker");
+        for (size_t g; (g = nextGroup.fetch_add(1)) < groups.size();)
+        {
+            if (groupSerial[g])
+                continue;
+            GroupResult &result = results[g];
+            try
+            {
+                // A compressed stream's cache is not shared between threads
+                TokenStream own;
+                if (tokens.compressed())
+                    own = TokenStream(*tokens.compressed());
+                Parser parser(tokens.compressed() ? own : tokens, result.table);
+                parser.bodyEnds = bodyEnds;
+                for (size_t u : groups[g])
+                {
+                    result.table.setModuleSnapshot(&history, units[u].segment);
+                    result.segmentStarts.push_back({result.table.nextEntry, units[u].segment});
+                    parser.parseUnit(units[u]);
+                }
+                // What the module holds is the module level's to report
+                result.table.setModuleSnapshot(nullptr, 0);
+                TraceScope publishTrace("publish");
+                result.ids = shared.publish(result.table, result.segmentStarts);
+            }
+            catch (...)
+            {
+                result.error = current_exception();
+            }
+        }
+    };
+    vector<thread> workers;
+    for (size_t t = 0; t < min<size_t>(threadCount, parallelGroups); t++)
+        workers.emplace_back(work);
+    vector<int> moduleIds;
+    exception_ptr error;
+    try
+    {
+        TraceScope publishTrace("publish");
+        moduleIds = shared.publish(symbolTable, segmentStarts);
+    }
+    catch (...)
+    {
+        error = current_exception();
+    }
+    for (thread &worker : workers)
+        worker.join();
+    bodyEnds = nullptr;
+    for (GroupResult &result : results)
+    {
+        if (!error)
+            error = result.error;
+    }
+    if (error)
+        rethrow_exception(error);
+
+    // Renumber everything in serial order
+    TraceScope mergeTrace("merge");
+    vector<SymbolTable::SymbolRecord> rows;
+    vector<int> entryOf = shared.merge(rows);
+    auto renumber = [&](const vector<int> &ids)
+    {
+        vector<int> entries(ids.size(), 0);
+        for (size_t e = 1; e < ids.size(); e++)
+            entries[e] = entryOf[ids[e]];
+        return entries;
+    };
+    CrossReferenceIndex references;
+    references.append(symbolTable.references, renumber(moduleIds));
+    for (size_t g = 0; g < groups.size(); g++)
+    {
+        if (!groupSerial[g])
+            references.append(results[g].table.references, renumber(results[g].ids));
+    }
+    symbolTable.load(move(rows));
+    symbolTable.references = move(references);
+    symbolTable.references.finalize();
+}
+
+// Records the identifier at `tk` against the symbol entry it resolved to
+void Parser::noteReference(const Token &tk, int entry, CrossReferenceIndex::Kind kind)
+{
+    if (symbolTable.recordReferences)
+        symbolTable.references.add(entry, tk.lineNumber, tk.offset, tk.lexeme.size(), kind);
+}
+
+SymbolTable::SymbolInfo &Parser::bindName(const Token &tk, CrossReferenceIndex::Kind kind)
+{
+    auto &info = symbolTable.bind(tk.lexeme, tk.scope, tk.lineNumber);
+    noteReference(tk, info.entry, kind);
+    return info;
+}
+
+SymbolTable::SymbolInfo &Parser::resolveName(const Token &tk)
+{
+    leaveLambdas(tk.offset);
+    for (const Lambda &lambda : lambdas)
+    {
+        if (find(lambda.parameters.begin(), lambda.parameters.end(), tk.lexeme.id()) != lambda.parameters.end())
+        {
+            lambdaParameter = SymbolTable::SymbolInfo();
+            return lambdaParameter;
+        }
+    }
+    auto &info = symbolTable.resolve(tk.lexeme, tk.scope, tk.lineNumber);
+    noteReference(tk, info.entry, CrossReferenceIndex::Kind::Use);
+    return info;
+}
+
+bool Parser::isAttributeName(size_t i) const
+{
+    return i > 0 && tokens[i - 1].type == TokenType::Dot;
+}
+
+SourceSpan Parser::span(size_t first, size_t end)
+{
+    const Token &last = tokens[end - 1];
+    size_t stop = last.offset + last.lexeme.size();
+    return {symbolTable.file, static_cast<uint32_t>(tokens[first].offset),
+            static_cast<uint32_t>(stop - tokens[first].offset)};
+}
+
+// f"...", rb'...' and friends: a short run of prefix letters glued to a string
+bool Parser::isStringPrefix(size_t i)
+{
+    const Token &tk = tokens[i];
+    if (!tokens.has(i + 1) || tokens[i + 1].type != TokenType::STRING_LITERAL ||
+        tokens[i + 1].offset != tk.offset + tk.lexeme.size() || tk.lexeme.size() > 2)
+        return false;
+    return tk.lexeme.view().find_first_not_of("rRbBfFuU") == string::npos;
+}
+
+// After a def name: binds the parameters in the function's scope. Default
+// values and annotations are reads.
+void Parser::parseParameters(size_t &i)
+{
+    if (!tokens.has(i) || tokens[i].type != TokenType::LeftParenthesis)
+        return;
+    i++;
+    int depth = 1;
+    bool atParameter = true;
+    while (tokens.has(i) && depth > 0)
+    {
+        const Token &tk = tokens[i];
+        if (tk.type == TokenType::LeftParenthesis || tk.type == TokenType::LeftBracket ||
+            tk.type == TokenType::LeftBrace)
+        {
+            depth++;
+        }
+        else if (tk.type == TokenType::RightParenthesis || tk.type == TokenType::RightBracket ||
+                 tk.type == TokenType::RightBrace)
+        {
+            depth--;
+        }
+        else if (depth == 1 && tk.type == TokenType::Comma)
+        {
+            atParameter = true;
+            i++;
+            continue;
+        }
+        else if (tk.type == TokenType::IDENTIFIER)
+        {
+            if (depth == 1 && atParameter)
+                bindName(tk, CrossReferenceIndex::Kind::Assignment);
+            else if (!isAttributeName(i))
+                resolveName(tk);
+        }
+        else if (tk.type == TokenType::OPERATOR && (tk.lexeme == "*" || tk.lexeme == "**"))
+        {
+            i++;
+            continue; // *args, **kwargs
+        }
+        atParameter = false;
+        i++;
+    }
+}
+
+// After `lambda`: its parameters up to the `:` are local to the lambda's
+// body, which runs to the comma, closing bracket or line end that ends the
+// expression. The lexer gives a lambda no scope of its own, so rather than
+// bind them anywhere, reads of them in the body are left unresolved.
+// Default values are reads.
+void Parser::parseLambdaParameters(size_t &i)
+{
+    leaveLambdas(tokens[i].offset);
+    Lambda lambda;
+    i++;
+    int depth = 0;
+    bool atParameter = true;
+    for (; tokens.has(i) && i < rangeEnd; i++)
+    {
+        const Token &tk = tokens[i];
+        if (depth == 0 && tk.type == TokenType::Colon)
+            break;
+        if (tk.type == TokenType::LeftParenthesis || tk.type == TokenType::LeftBracket ||
+            tk.type == TokenType::LeftBrace)
+            depth++;
+        else if (tk.type == TokenType::RightParenthesis || tk.type == TokenType::RightBracket ||
+                 tk.type == TokenType::RightBrace)
+            depth--;
+        else if (depth == 0 && tk.type == TokenType::Comma)
+        {
+            atParameter = true;
+            continue;
+        }
+        else if (tk.type == TokenType::OPERATOR && (tk.lexeme == "*" || tk.lexeme == "**"))
+            continue;
+        else if (tk.type == TokenType::IDENTIFIER && !isAttributeName(i))
+        {
+            if (depth == 0 && atParameter)
+                lambda.parameters.push_back(tk.lexeme.id());
+            else
+                resolveName(tk);
+        }
+        atParameter = false;
+    }
+    if (!tokens.has(i) || i >= rangeEnd || lambda.parameters.empty())
+        return;
+
+    // Find where the body ends; the statement loop reads it as usual
+    const int line = tokens[i].lineNumber;
+    depth = 0;
+    size_t end = i + 1;
+    for (; tokens.has(end) && end < rangeEnd; end++)
+    {
+        const Token &tk = tokens[end];
+        if (tk.type == TokenType::LeftParenthesis || tk.type == TokenType::LeftBracket ||
+            tk.type == TokenType::LeftBrace)
+            depth++;
+        else if (tk.type == TokenType::RightParenthesis || tk.type == TokenType::RightBracket ||
+                 tk.type == TokenType::RightBrace)
+        {
+            if (--depth < 0)
+                break;
+        }
+        else if (depth == 0 && (tk.type == TokenType::Comma || tk.type == TokenType::Semicolon))
+            break;
+        else if (parenDepth == 0 && (tk.type == TokenType::INDENT || tk.type == TokenType::DEDENT ||
+                                     tk.lineNumber != line))
+            break; // inside a call the body may go on to the next line
+    }
+    lambda.end = tokens.has(end) && end < rangeEnd ? tokens[end].offset : SIZE_MAX;
+    lambdas.push_back(move(lambda));
+}
+
+// Drops the lambdas whose bodies end at or before `offset`
+void Parser::leaveLambdas(size_t offset)
+{
+    while (!lambdas.empty() && offset >= lambdas.back().end)
+        lambdas.pop_back();
+}
+
+// import a.b as c, d / from m import x as y, z: binds c, d (the first
+// component of a dotted name), y and z in the current scope
+void Parser::parseImport(size_t &i)
+{
+    // Copied out: the statement may outrun a compressed stream's cache
+    const bool from = tokens[i].type == TokenType::FromKeyword;
+    const int line = tokens[i].lineNumber;
+    i++;
+    if (from)
+    {
+        while (tokens.has(i) && tokens[i].lineNumber == line &&
+               tokens[i].type != TokenType::ImportKeyword)
+            i++;
+        if (!tokens.has(i) || tokens[i].type != TokenType::ImportKeyword)
+            return;
+        i++;
+    }
+
+    int depth = 0; // a parenthesised name list may span lines
+    while (tokens.has(i) && (depth > 0 || tokens[i].lineNumber == line))
+    {
+        const Token &tk = tokens[i];
+        if (tk.type == TokenType::LeftParenthesis)
+            depth++;
+        else if (tk.type == TokenType::RightParenthesis)
+            depth--;
+        else if (depth > 0 && (tk.type == TokenType::INDENT || tk.type == TokenType::DEDENT))
+            ; // the lexer's view of a continuation line's indentation
+        else if (tk.type == TokenType::IDENTIFIER)
+        {
+            size_t name = i++;
+            while (tokens.has(i + 1) && tokens[i].type == TokenType::Dot &&
+                   tokens[i + 1].type == TokenType::IDENTIFIER)
+                i += 2;
+            if (tokens.has(i + 1) && tokens[i].type == TokenType::AsKeyword &&
+                tokens[i + 1].type == TokenType::IDENTIFIER)
+            {
+                bindName(tokens[i + 1], CrossReferenceIndex::Kind::Assignment);
+                i += 2;
+            }
+            else
+            {
+                bindName(tokens[name], CrossReferenceIndex::Kind::Assignment);
+            }
+            continue;
+        }
+        else if (tk.type != TokenType::Comma && !(tk.type == TokenType::OPERATOR && tk.lexeme == "*"))
+        {
+            break;
+        }
+        i++;
+    }
+}
+
+pair<string, SourceSpan> Parser::parseExpression(size_t &i)
 {
     // Parse the first operand
     auto [accumType, accumValue] = parseOperand(i);
 
     // If we have multiple operators, unify the type.
-    while (i < tokens.size())
+    while (tokens.has(i))
     {
         // Check if next token is +, -, *, /
         if (tokens[i].type == TokenType::OPERATOR)
         {
-            string op = tokens[i].lexeme;
+            InternedString op = tokens[i].lexeme;
             if (op == "+" || op == "-" || op == "*" || op == "/")
             {
                 // consume the operator
@@ -680,7 +2122,7 @@ pair<string, string> Parser::parseExpression(size_t &i)
                 accumType = unifyTypes(accumType, nextType);
                 // If we do actual arithmetic, we'd combine accumValue & nextValue,
                 // but for a multi-operand expression, let's just drop the literal:
-                accumValue = "";
+                accumValue = SourceSpan();
             }
             else
             {
@@ -697,11 +2139,11 @@ pair<string, string> Parser::parseExpression(size_t &i)
     return {accumType, accumValue};
 }
 
-pair<string, string> Parser::parseOperand(size_t &i)
+pair<string, SourceSpan> Parser::parseOperand(size_t &i)
 {
-    if (i >= tokens.size())
+    if (!tokens.has(i))
     {
-        return {"unknown", ""};
+        return {"unknown", SourceSpan()};
     }
 
     const Token &tk = tokens[i];
@@ -709,24 +2151,20 @@ pair<string, string> Parser::parseOperand(size_t &i)
     // If it's a numeric literal
     if (tk.type == TokenType::NUMBER)
     {
-        // check if there's a '.' => float
-        if (tk.lexeme.find('.') != string::npos)
-        {
-            i++;
-            return {"float", tk.lexeme};
-        }
-        else
-        {
-            i++;
-            return {"int", tk.lexeme};
-        }
+        // The lexer already classified it
+        i++;
+        if (tk.numberKind == NumberKind::Float)
+            return {"float", span(i - 1, i)};
+        if (tk.numberKind == NumberKind::Imaginary)
+            return {"complex", span(i - 1, i)};
+        return {"int", span(i - 1, i)};
     }
 
     // If it's a string literal
     if (tk.type == TokenType::STRING_LITERAL)
     {
         i++;
-        return {"string", tk.lexeme};
+        return {"string", span(i - 1, i)};
     }
 
     // If it's a keyword => might be True/False
@@ -735,123 +2173,121 @@ pair<string, string> Parser::parseOperand(size_t &i)
         if (tk.lexeme == "True" || tk.lexeme == "False")
         {
             i++;
-            return {"bool", tk.lexeme};
+            return {"bool", span(i - 1, i)};
         }
         i++;
-        return {"unknown", ""};
+        return {"unknown", SourceSpan()};
+    }
+
+    // f"..." and friends are string literals
+    if (tk.type == TokenType::IDENTIFIER && isStringPrefix(i))
+    {
+        i += 2;
+        return {"string", span(i - 2, i)};
     }
 
     // If it's an identifier
     if (tk.type == TokenType::IDENTIFIER)
     {
-        string name = tk.lexeme;
-        string knownType = symbolTable.getType(name, tk.scope);
-        string knownValue = symbolTable.getValue(name, tk.scope);
-        string fullName = name + "@" + tk.scope;
-        if (!symbolTable.exist(fullName, tk.scope))
-        {
-            symbolTable.addSymbol(name, "unknown", tk.lineNumber, tk.scope);
-        }
-        else
-        {
-            symbolTable.table[fullName].usageCount++;
-        }
+        auto &info = resolveName(tk);
         i++;
-        return {knownType, knownType == "unknown" ? "" : knownValue};
+        // What a call returns is not known
+        if (tokens.has(i) && tokens[i].type == TokenType::LeftParenthesis)
+            return {"unknown", SourceSpan()};
+        return {info.type, info.type == "unknown" ? SourceSpan() : info.value};
     }
 
     // if it's a tuple
     if (tk.lexeme == "(")
     {
-        string value = "(";
+        size_t start = i;
         i++;
         vector<string> elementTypes;
-        vector<string> elementValues;
+        vector<SourceSpan> elementValues;
 
-        while (i < tokens.size() && tokens[i].lexeme != ")")
+        while (tokens.has(i) && tokens[i].lexeme != ")")
         {
             auto [innerType, innerValue] = parseExpression(i);
             elementTypes.push_back(innerType);
             elementValues.push_back(innerValue);
 
-            if (i < tokens.size() && tokens[i].lexeme == ",")
+            if (tokens.has(i) && tokens[i].lexeme == ",")
             {
-                value += innerValue + ",";
                 i++; // Skip the comma
             }
             else
             {
-                value += innerValue;
                 break;
             }
         }
 
-        if (i < tokens.size() && tokens[i].lexeme == ")")
+        if (tokens.has(i) && tokens[i].lexeme == ")")
         {
             i++;
-            value += ")";
             if (elementTypes.size() == 1)
             {
                 // Single element in parentheses, treat as the element itself
-                return {elementTypes[0], value};
+                return {elementTypes[0], span(start, i)};
             }
             else
             {
                 // Multiple elements, treat as a tuple
-                return {"tuple", value};
+                return {"tuple", span(start, i)};
             }
         }
         else
         {
             // If no closing parenthesis, return unknown
-            return {"unknown", value};
+            return {"unknown", span(start, i)};
         }
     }
 
     // if it's a list
     if (tk.lexeme == "[")
     {
-        string value = "[";
+        size_t start = i;
         i++;
-        while (i < tokens.size() && tokens[i].lexeme != "]")
+        while (tokens.has(i) && tokens[i].lexeme != "]")
         {
-            value = value + tokens[i].lexeme;
             i++;
         }
-        if (i < tokens.size() && tokens[i].lexeme == "]")
+        if (tokens.has(i) && tokens[i].lexeme == "]")
         {
             i++;
         }
-        value = value + "]";
-        return {"list", value};
+        return {"list", span(start, i)};
     }
 
     // if it's a dictionary or set
     if (tk.lexeme == "{")
     {
-        string value = "{";
+        size_t start = i;
         i++;
         bool isSet = true;
-        while (i < tokens.size() && tokens[i].lexeme != "}")
+        while (tokens.has(i) && tokens[i].lexeme != "}")
         {
             if (tokens[i].lexeme == ":")
             {
                 isSet = false;
             }
-            value = value + tokens[i].lexeme;
             i++;
         }
-        if (i < tokens.size() && tokens[i].lexeme == "}")
+        if (tokens.has(i) && tokens[i].lexeme == "}")
         {
             i++;
         }
-        value = value + "}";
-        return {isSet ? "set" : "dictionary", value};
+        return {isSet ? "set" : "dictionary", span(start, i)};
+    }
+
+    // A lambda's parameters are its own; leave them to the statement loop
+    if (tk.type == TokenType::LambdaKeyword)
+    {
+        return {"unknown", SourceSpan()};
     }
 
     // Otherwise unknown
     i++;
-    return {"unknown", ""};
+    return {"unknown", SourceSpan()};
 }
 
 string Parser::unifyTypes(const string &t1, const string &t2)
@@ -863,6 +2299,17 @@ string Parser::unifyTypes(const string &t1, const string &t2)
     if (t2 == "unknown")
         return t1;
 
+    // If either is complex => complex
+    if (t1 == "complex" || t2 == "complex")
+    {
+        if (t1 == "string" || t2 == "string" ||
+            t1 == "bool" || t2 == "bool")
+        {
+            return "unknown";
+        }
+        return "complex";
+    }
+
     // If either is float => float
     if (t1 == "float" || t2 == "float")
     {
@@ -908,12 +2355,74 @@ string Parser::unifyTypes(const string &t1, const string &t2)
     return "unknown";
 }
 
+// ----------------------------------------------
+// Pipelined lexing and parsing
+// ----------------------------------------------
+vector<Token> lexAndParse(const SourceView &source, vector<Error> &errors,
+                          SymbolTable &symbols, double *lexMs, AllocationCounts *lexAllocations)
+{
+    TokenQueue queue;
+    vector<Error> lexErrors;
+    exception_ptr lexError;
+    thread lexer([&]
+                 {
+                     setTraceThreadName("lexer");
+                     const AllocationCounts allocationsBefore = threadAllocations();
+                     auto start = chrono::steady_clock::now();
+                     try
+                     {
+                         Lexer(symbols.strings()).tokenize(source, lexErrors, queue);
+                     }
+                     catch (...)
+                     {
+                         lexError = current_exception();
+                         queue.close();
+                     }
+                     if (lexMs)
+                         *lexMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+                     if (lexAllocations)
+                     {
+                         const AllocationCounts allocationsAfter = threadAllocations();
+                         lexAllocations->count = allocationsAfter.count - allocationsBefore.count;
+                         lexAllocations->bytes = allocationsAfter.bytes - allocationsBefore.bytes;
+                     }
+                 });
+
+    TokenStream stream(queue);
+    try
+    {
+        Parser(stream, symbols).parse();
+    }
+    catch (...)
+    {
+        queue.close(); // unblocks the lexer if the ring is full
+        lexer.join();
+        throw;
+    }
+    lexer.join();
+    if (lexError)
+        rethrow_exception(lexError);
+
+    if (!lexErrors.empty())
+    {
+        uint32_t file = symbols.file;
+        symbols = SymbolTable(symbols.strings());
+        symbols.file = file;
+    }
+    errors.insert(errors.end(), lexErrors.begin(), lexErrors.end());
+    return stream.take();
+}
+
 // ----------------------------------------------
 // Main Function
 // ----------------------------------------------
+// Headless builds (benchmarks, tools) link the compiler core without the GUI
+// and bring their own main().
+#ifndef COMPILER_HEADLESS
 int main()
 {
     CompilerGUI gui;
     gui.render();
     return 0;
-}
\ No newline at end of file
+}
+#endif
\ No newline at end of file
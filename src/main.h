@@ -8,7 +8,17 @@
 #include <unordered_set>
 #include <fstream>
 #include <cctype>
+#include <cstring>
 #include <regex>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include "metrics.h"
+#include "string_pool.h"
+#include "text_buffer.h"
+#include "xref.h"
 using namespace std;
 
 // ----------------------------------------------
@@ -97,18 +107,73 @@ enum class TokenType
     DEDENT
 };
 
+// Printable names, indexed by TokenType
+constexpr const char *tokenTypeNames[] = {
+    "FalseKeyword", "NoneKeyword", "TrueKeyword", "AndKeyword", "AsKeyword",
+    "AssertKeyword", "AsyncKeyword", "AwaitKeyword", "BreakKeyword",
+    "ClassKeyword", "ContinueKeyword", "DefKeyword", "DelKeyword", "ElifKeyword",
+    "ElseKeyword", "ExceptKeyword", "FinallyKeyword", "ForKeyword", "FromKeyword",
+    "GlobalKeyword", "IfKeyword", "ImportKeyword", "InKeyword", "IsKeyword",
+    "LambdaKeyword", "NonlocalKeyword", "NotKeyword", "OrKeyword", "PassKeyword",
+    "RaiseKeyword", "ReturnKeyword", "TryKeyword", "WhileKeyword", "WithKeyword",
+    "YieldKeyword", "IDENTIFIER", "NUMBER", "OPERATOR", "STRING_LITERAL",
+    "COMMENT", "UNKNOWN", "LeftParenthesis", "RightParenthesis", "LeftBracket",
+    "RightBracket", "LeftBrace", "RightBrace", "Colon", "Comma", "Dot",
+    "Semicolon", "INDENT", "DEDENT"};
+static_assert(sizeof(tokenTypeNames) / sizeof(tokenTypeNames[0]) ==
+                  static_cast<size_t>(TokenType::DEDENT) + 1,
+              "tokenTypeNames must list every TokenType");
+
+inline const char *tokenTypeName(TokenType type)
+{
+    return tokenTypeNames[static_cast<size_t>(type)];
+}
+
 // ----------------------------------------------
 // 2. Token Structure
 // ----------------------------------------------
+// What a NUMBER token's value holds
+enum class NumberKind : uint8_t
+{
+    None,       // not a number
+    Integer,    // intValue
+    BigInteger, // past int64_t; only the lexeme has it
+    Float,      // floatValue
+    Imaginary   // floatValue is the imaginary part, as in 2.5j
+};
+
 struct Token
 {
     TokenType type;
-    string lexeme;
+    InternedString lexeme; // text, scope: in the Lexer's StringPool
     int lineNumber;
-    string scope;
+    NumberKind numberKind = NumberKind::None;
+    size_t offset; // byte offset of the first character in the source
+    InternedString scope;
+    // NUMBER tokens: the value, converted once by the lexer
+    union
+    {
+        int64_t intValue = 0;
+        double floatValue;
+    };
+
+    Token(TokenType t, InternedString l, int line, size_t off, InternedString s = InternedString());
+};
 
-    Token(TokenType t, const string &l, int line, const string &s = "");
+// Where a value is written in the source. Symbols keep this rather than a
+// copy of the literal, so a large table or docstring costs no more than an
+// int; the text is cut out only to display or export it.
+struct SourceSpan
+{
+    uint32_t file = 0; // SymbolTable::file of the table that recorded it
+    uint32_t offset = 0;
+    uint32_t length = 0;
+
+    bool empty() const { return length == 0; }
 };
+
+// The first `limit` bytes of `span` in `source`
+string spanText(const SourceView &source, SourceSpan span, size_t limit = SIZE_MAX);
 // 3. Scope Info Structure
 // ----------------------------------------------
 struct ScopeInfo
@@ -117,9 +182,36 @@ struct ScopeInfo
     int indentLevel; // Indentation level when the scope started
 };
 
+// Module-level type and value of each name after each part of a file that
+// bound it, recorded so that parts analysed in parallel see the module as a
+// serial run would have at that point (see Parser::parseParallel)
+struct ModuleHistory
+{
+    struct Version
+    {
+        uint32_t segment;
+        string type;
+        SourceSpan value;
+    };
+    unordered_map<uint32_t, vector<Version>> versions; // by name id; by segment, ascending
+
+    // The latest version set before `segment`, or nullptr if none was
+    const Version *before(uint32_t name, uint32_t segment) const;
+};
+
+class SpillFile;
+
 // ----------------------------------------------
 // 4. SymbolTable
 // ----------------------------------------------
+// Symbols live in a tree of scopes that mirrors the lexer's scope strings
+// ("global", "f", "g@f", ...). A binding (assignment, def/class name,
+// parameter, import, loop target) lands in its own scope unless a
+// global/nonlocal declaration redirects it; a read resolves the way Python
+// does: local, enclosing functions (class bodies are skipped), global,
+// builtins. A read of a name bound nowhere yet is taken as a global that is
+// defined later in the file. Each scope caches the reads it has resolved,
+// so a hot name costs one lookup instead of one per level of nesting.
 class SymbolTable
 {
 public:
@@ -131,30 +223,147 @@ public:
         int firstAppearance = -1; // line of first appearance
         int usageCount = 0;       // how many times it is referenced
 
-        // A new field to store a literal value if we know it (optional).
-        string value;
+        // Where the literal value is written, if we know it (optional).
+        SourceSpan value;
     };
 
-    unordered_map<string, SymbolInfo> table;
+    // One row of the table with the name split back out of its "name@scope" key
+    struct SymbolRecord
+    {
+        string name;
+        SymbolInfo info;
+    };
+
+    unordered_map<string, SymbolInfo> table; // keyed "name@scope"
     int nextEntry = 1;
+    CrossReferenceIndex references; // filled by Parser::parse
+    bool recordReferences = true;   // off for a compile that never reads them
+    uint32_t file = 0;              // tags the value spans; callers pick the ids
+
+    // Names and scopes come in as InternedStrings from the tokens, so the
+    // table must share their pool
+    explicit SymbolTable(StringPool &strings = StringPool::global());
+    SymbolTable(SymbolTable &&) = default;
+    SymbolTable &operator=(SymbolTable &&) = default;
+    SymbolTable(const SymbolTable &) = delete; // scopes point into table
+    SymbolTable &operator=(const SymbolTable &) = delete;
+
+    // Binding and read occurrences; both count as a use of the symbol
+    SymbolInfo &bind(InternedString name, InternedString scope, int lineNumber);
+    SymbolInfo &resolve(InternedString name, InternedString scope, int lineNumber);
+    void declareClass(InternedString scope);
+    void declareGlobal(InternedString name, InternedString scope);
+    void declareNonlocal(InternedString name, InternedString scope);
+    // "g@f" -> "f", "f" -> "global"
+    static string enclosingScope(string_view scope);
+    StringPool &strings() const { return *pool; }
 
-    void addSymbol(const string &name, const string &type,
-                   int lineNumber, const string &scope,
-                   const string &val = "");
+    // Parallel analysis. When set, every binding in the module scope is
+    // logged here (name, symbol), possibly more than once.
+    vector<pair<InternedString, SymbolInfo *>> *moduleWrites = nullptr;
+    // Analyse a part of the file against the module scope as `history`
+    // had it before `segment`; nullptr goes back to the table's own module
+    // scope, whose symbols then carry no type or value of their own.
+    void setModuleSnapshot(const ModuleHistory *history, uint32_t segment);
+
+    // Text-keyed access, interning through strings(). Returns the symbol's
+    // entry number, new or existing
+    int addSymbol(string_view name, const string &type,
+                  int lineNumber, string_view scope,
+                  SourceSpan val = {});
     void updateType(const string &name, const string &scope, const string &newType);
-    void updateValue(const string &name, const string &scope, const string &newValue);
+    void updateValue(const string &name, const string &scope, SourceSpan newValue);
     bool exist(const string &name, const string &scope);
     string getType(const string &name, const string &scope);
-    string getValue(const string &name, const string &scope);
-    void printSymbols(ostream &out);
+    SourceSpan getValue(const string &name, const string &scope);
+    vector<SymbolRecord> records() const; // sorted by entry
+    // Replaces the symbols with `rows` (as records() returns them), e.g. the
+    // merged result of a parallel analysis; references are kept
+    void load(vector<SymbolRecord> rows);
+    // Values are read from `source`, the text the table was built from
+    void printSymbols(ostream &out, const SourceView &source);
+
+    // Memory-budgeted analysis. Once the process's resident set passes
+    // `spillAt` bytes, the symbols of scopes the parser has left move to
+    // `file`, which must outlive the table, and are read back if their
+    // scope comes round again (a second def of the same name). Spilled
+    // symbols are missing from `table` and the text-keyed lookups;
+    // records(), printSymbols() and symbolCount() include them.
+    void spillTo(SpillFile &file, size_t spillAt);
+    // For the parser, between statements: no SymbolInfo reference is held
+    void spillColdScopes()
+    {
+        if (spill && --untilSpillCheck == 0)
+            spillCold();
+    }
+    size_t symbolCount() const { return table.size() + spilledSymbols; }
+
+private:
+    using Entry = unordered_map<string, SymbolInfo>::value_type; // key and symbol, so a spill has both
+
+    struct Scope
+    {
+        string path;
+        int parent = -1; // -1 for the module and builtins scopes
+        bool isClass = false;
+        // Keyed by name id
+        unordered_map<uint32_t, Entry *> names;         // bound here
+        unordered_map<uint32_t, SymbolInfo *> resolved; // reads resolved from here
+        unordered_map<uint32_t, int> redirects;         // global/nonlocal: scope that binds the name
+        // Spilling
+        bool listed = false;  // in residentScopes
+        bool spilled = false; // names are in the spill file, at [spillStart, spillEnd)
+        uint64_t spillStart = 0;
+        uint64_t spillEnd = 0;
+    };
+
+    // A symbol in the spill file; stale once its scope is read back in
+    struct SpilledRecord
+    {
+        int entry;
+        int scope;
+        uint64_t offset;
+    };
+    static constexpr int moduleScope = 0;
+    static constexpr int builtinScope = 1;
+
+    StringPool *pool;
+    vector<Scope> scopes;
+    unordered_map<uint32_t, int> scopeIds; // by path id
+    uint32_t lastScopePath = 0;            // tokens arrive in runs of one scope
+    int lastScopeId = moduleScope;
+    const ModuleHistory *moduleHistory = nullptr;
+    uint32_t historySegment = 0;
+
+    SpillFile *spill = nullptr;
+    size_t spillAt = 0;
+    uint32_t untilSpillCheck = 0;
+    vector<int> residentScopes; // used since the last spill; a spill may move these out
+    vector<SpilledRecord> spilledRecords;
+    size_t spilledSymbols = 0; // not read back in
+
+    int addScope(const string &path, int parent);
+    int scopeId(InternedString path);
+    SymbolInfo &bindIn(int scope, InternedString name, int lineNumber);
+    SymbolInfo &lookup(int scope, InternedString name, int lineNumber);
+    void spillCold();
+    void pageIn(int scope);
+    // Every symbol with its name, spilled ones read back one at a time, in entry order
+    void forEachRecord(const function<void(const string &name, const SymbolInfo &info)> &visit) const;
 };
 
 // ----------------------------------------------
 // 5. Lexer
 // ----------------------------------------------
+class TokenQueue;
+class CompressedTokens;
+
 class Lexer
 {
 public:
+    // Token text is interned into `strings`, which must outlive the tokens
+    explicit Lexer(StringPool &strings = StringPool::global());
+
     unordered_map<string, TokenType> pythonKeywords = {
         {"False", TokenType::FalseKeyword},
         {"None", TokenType::NoneKeyword},
@@ -210,36 +419,210 @@ public:
 
     vector<ScopeInfo> scopeStack;
 
-    vector<Token> tokenize(const string &source, vector<Error> &errors);
+    vector<Token> tokenize(const SourceView &source, vector<Error> &errors);
+    // Same tokens, pushed into `queue` in blocks as they are made; closes
+    // the queue at the end, or stops early if the reader closed it
+    void tokenize(const SourceView &source, vector<Error> &errors, TokenQueue &queue);
+    // Same tokens, appended to `store` as they are made, so the whole
+    // vector never exists at once
+    void tokenize(const SourceView &source, vector<Error> &errors, CompressedTokens &store);
 
 private:
+    StringPool *strings;
+    InternedString scope;          // getScope(scopeStack), kept current as the stack changes
     vector<int> indentStack = {0}; // Track indentation levels (e.g., [0, 4, 8])
     bool atLineStart = true;       // Flag for newline handling
     bool lineContinuation = false; // Track line continuation via '\'
-    void skipNonLeadingWhitespace(const string &source, size_t &idx);
-    string handleTripleQuotedString(const string &source, size_t &idx, int &lineNumber);
+    vector<Token> run(const SourceView &source, vector<Error> &errors, TokenQueue *queue,
+                      CompressedTokens *store = nullptr);
+    void skipNonLeadingWhitespace(const SourceView &source, size_t &idx);
+    string handleTripleQuotedString(const SourceView &source, size_t &idx, int &lineNumber);
     bool isOperatorStart(char c);
-    string handleDoubleQuotedString(const string &source, size_t &idx, int &lineNumber);
-    void processIndentation(const string &source, size_t &i, int lineNumber,
+    void lexNumber(const SourceView &source, size_t &i, int lineNumber,
+                   vector<Token> &tokens, vector<Error> &errors);
+    string handleDoubleQuotedString(const SourceView &source, size_t &idx, int &lineNumber);
+    void processIndentation(const SourceView &source, size_t &i, int lineNumber,
                             vector<Token> &tokens, vector<Error> &errors);
     string getScope(const vector<ScopeInfo> &scopeStack);
 };
 
 // ----------------------------------------------
-// 6. Parser
+// 6. Token streaming
+// ----------------------------------------------
+// TokenQueue hands token blocks from a lexing thread to a parsing thread:
+// a bounded single-producer/single-consumer ring whose indices are atomics,
+// so a transfer takes no lock. A side only sleeps on the condition variable
+// when the ring is full (the lexer is ahead) or empty (the parser is), which
+// keeps the faster stage from running away with memory.
+class TokenQueue
+{
+public:
+    static constexpr size_t blockSize = 4096; // tokens per block, the last may be shorter
+
+    explicit TokenQueue(size_t capacity = 16); // in blocks
+
+    // Producer: waits while the ring is full; false if the queue was closed
+    bool push(vector<Token> &&block);
+    // Consumer: waits while the ring is empty; false once it is closed and drained
+    bool pop(vector<Token> &block);
+    // Either side: the producer at the end of input, the consumer to give up
+    void close();
+
+private:
+    unique_ptr<vector<Token>[]> slots;
+    size_t capacity;
+    alignas(64) atomic<size_t> head{0}; // next slot to pop, written by the consumer
+    alignas(64) atomic<size_t> tail{0}; // next slot to push, written by the producer
+    atomic<bool> closed{false};
+    atomic<int> sleepers{0};
+    mutex lock;
+    condition_variable wake;
+
+    template <typename Ready>
+    void waitUntil(Ready ready);
+    void notify();
+};
+
+// The tokens a Parser reads: a finished vector, the blocks of a TokenQueue
+// as they arrive, or a CompressedTokens store. Every queue block but the
+// last holds exactly TokenQueue::blockSize tokens, so indexing is a shift
+// and a mask, and a received block never moves its tokens, so a Token
+// reference stays good. A compressed store is read through a cache of
+// decoded blocks: a reference stays good until cachedBlocks other blocks
+// have been decoded, which is further than a Parser looks from a token it
+// holds. The cache is the stream's own, so threads need a stream each.
+class TokenStream
+{
+public:
+    static constexpr size_t cachedBlocks = 16;
+
+    TokenStream() = default;
+    explicit TokenStream(const vector<Token> &tokens);
+    explicit TokenStream(TokenQueue &queue);
+    explicit TokenStream(const CompressedTokens &store);
+
+    // Whether token i exists, waiting for it if it may still arrive
+    bool has(size_t i) { return i < available || receive(i); }
+    const Token &operator[](size_t i) const
+    {
+        if (whole)
+            return (*whole)[i];
+        if (!store)
+            return blocks[i / TokenQueue::blockSize][i % TokenQueue::blockSize];
+        return i - hotFirst < hotCount ? hot[i - hotFirst] : decode(i);
+    }
+    // Waits for the end of the stream
+    size_t size();
+    bool complete() const { return queue == nullptr; }
+    const CompressedTokens *compressed() const { return store; }
+    // Queue mode: waits for the end and moves every token out; otherwise a copy
+    vector<Token> take();
+
+private:
+    struct DecodedBlock
+    {
+        size_t block = SIZE_MAX;
+        uint64_t used = 0;
+        vector<Token> tokens;
+    };
+
+    const vector<Token> *whole = nullptr;
+    TokenQueue *queue = nullptr; // nullptr once every token has arrived
+    vector<vector<Token>> blocks;
+    size_t available = 0;
+
+    const CompressedTokens *store = nullptr;
+    mutable vector<DecodedBlock> decoded;
+    mutable uint64_t clock = 0;
+    // The block the last read came from
+    mutable const Token *hot = nullptr;
+    mutable size_t hotFirst = 0;
+    mutable size_t hotCount = 0;
+
+    bool receive(size_t i);
+    const Token &decode(size_t i) const;
+};
+
+// ----------------------------------------------
+// 7. Parser
 // ----------------------------------------------
 class Parser
 {
 public:
     Parser(const vector<Token> &tokens, SymbolTable &symTable);
+    // Tokens may still be arriving: parse() consumes them as they come
+    Parser(TokenStream &tokens, SymbolTable &symTable);
     void parse();
+    // Same result as parse(), with the top-level def/class bodies analysed
+    // on worker threads; threadCount 0 uses every hardware thread. It needs
+    // every token before it starts, so it cannot overlap lexing the way
+    // lexAndParse() does; see there for which the compilers use.
+    void parseParallel(unsigned threadCount = 0);
 
 private:
-    const vector<Token> &tokens;
+    // A top-level def/class body: tokens [begin, end) after the name
+    struct Unit
+    {
+        size_t name;
+        size_t begin;
+        size_t end;
+        uint32_t segment; // position among the parts of the file
+        bool isClass;
+    };
+
+    TokenStream wholeFile; // over the vector given to the first constructor
+    TokenStream &tokens;
     SymbolTable &symbolTable;
     string lastKeyword;
+    int parenDepth = 0;                       // open '(' in the current statement
+    size_t rangeEnd = 0;                      // end of the range parseRange() is in
+    const vector<size_t> *bodyEnds = nullptr; // for tracing def/class bodies
+
+    // A lambda whose body the statement loop is in, innermost last
+    struct Lambda
+    {
+        vector<uint32_t> parameters; // name ids
+        size_t end = 0;              // source offset where its body ends
+    };
+    vector<Lambda> lambdas;
+    SymbolTable::SymbolInfo lambdaParameter; // what resolveName() gives for one
 
-    pair<string, string> parseExpression(size_t &i);
-    pair<string, string> parseOperand(size_t &i);
+    void parseRange(size_t begin, size_t end);
+    void parseUnit(const Unit &unit);
+
+    void noteReference(const Token &tk, int entry, CrossReferenceIndex::Kind kind);
+    SymbolTable::SymbolInfo &bindName(const Token &tk, CrossReferenceIndex::Kind kind);
+    SymbolTable::SymbolInfo &resolveName(const Token &tk);
+    bool isAttributeName(size_t i) const;
+    bool isStringPrefix(size_t i);
+    SourceSpan span(size_t first, size_t end); // of tokens [first, end)
+    void parseParameters(size_t &i);
+    void parseLambdaParameters(size_t &i);
+    void leaveLambdas(size_t offset);
+    void parseImport(size_t &i);
+    // (type, value) of what starts at token i
+    pair<string, SourceSpan> parseExpression(size_t &i);
+    pair<string, SourceSpan> parseOperand(size_t &i);
     string unifyTypes(const string &t1, const string &t2);
 };
+
+// ----------------------------------------------
+// 8. Pipelined lexing and parsing
+// ----------------------------------------------
+// Lexes `source` on a second thread while this one parses, so the whole
+// takes about as long as the slower stage. The symbols are kept only if
+// lexing found no errors, as when parsing after tokenize(). Returns the
+// tokens; `lexMs` and `lexAllocations`, if given, receive the lexing
+// thread's time and the allocations it made, which that thread's counters
+// hold rather than the caller's.
+//
+// The GUI, LSP and CLI compile through this rather than tokenize() and
+// Parser::parseParallel(). The pipeline takes about as long as the slower
+// of lexing and parsing; lexing first and parsing on N threads takes all
+// of the lexing plus 1/N of the parsing and a merge, which only wins when
+// parsing is well over N/(N-1) times slower than lexing. The two are close
+// (58 against 43 ms on the bench corpus, 1.7 against 2.0 s at 40 MB), so
+// parseParallel() is left to callers that already hold the tokens.
+vector<Token> lexAndParse(const SourceView &source, vector<Error> &errors,
+                          SymbolTable &symbols, double *lexMs = nullptr,
+                          AllocationCounts *lexAllocations = nullptr);
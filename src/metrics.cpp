@@ -0,0 +1,103 @@
+// metrics.cpp
+#include "metrics.h"
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+// Trivially constructible, so access needs no TLS init guard and is safe
+// from inside operator new on any thread.
+thread_local AllocationCounts counts;
+}
+
+AllocationCounts threadAllocations()
+{
+    return counts;
+}
+
+size_t residentBytes()
+{
+#ifdef __linux__
+    // Second field: resident pages
+    FILE *statm = std::fopen("/proc/self/statm", "r");
+    if (!statm)
+        return 0;
+    unsigned long long size = 0, resident = 0;
+    int fields = std::fscanf(statm, "%llu %llu", &size, &resident);
+    std::fclose(statm);
+    return fields == 2 ? static_cast<size_t>(resident) * static_cast<size_t>(sysconf(_SC_PAGESIZE)) : 0;
+#else
+    return 0;
+#endif
+}
+
+size_t peakResidentBytes()
+{
+#ifndef _WIN32
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#ifdef __APPLE__
+    return static_cast<size_t>(usage.ru_maxrss); // bytes
+#else
+    return static_cast<size_t>(usage.ru_maxrss) * 1024; // kilobytes
+#endif
+#else
+    return 0;
+#endif
+}
+
+#ifndef COMPILER_NO_ALLOCATION_HOOK
+// The array and nothrow forms forward to these by default, so they are
+// counted as well.
+void *operator new(std::size_t size)
+{
+    counts.count++;
+    counts.bytes += size;
+    if (void *p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+#endif
+
+std::string CompileMetrics::toJson() const
+{
+    char buf[1024];
+    std::snprintf(buf, sizeof(buf),
+                  "{\n"
+                  "  \"phases_ms\": {\"load\": %.3f, \"lex\": %.3f, \"parse\": %.3f, \"report\": %.3f, \"total\": %.3f},\n"
+                  "  \"source_bytes\": %zu,\n"
+                  "  \"tokens\": %zu,\n"
+                  "  \"symbols\": %zu,\n"
+                  "  \"errors\": %zu,\n"
+                  "  \"allocations\": {\"count\": %llu, \"bytes\": %llu},\n"
+                  "  \"memory\": {\"budget\": %zu, \"peak_resident\": %zu},\n"
+                  "  \"spill\": {\"bytes_written\": %llu, \"writes\": %llu, \"blocks\": %llu, \"symbols\": %llu, \"reads\": %llu, "
+                  "\"window_maps\": %llu, \"bytes_mapped\": %llu}\n"
+                  "}\n",
+                  loadMs, lexMs, parseMs, reportMs, totalMs(), sourceBytes, tokens, symbols, errors,
+                  static_cast<unsigned long long>(allocations.count),
+                  static_cast<unsigned long long>(allocations.bytes), memoryBudget, peakResidentBytes,
+                  static_cast<unsigned long long>(spill.bytesWritten), static_cast<unsigned long long>(spill.writes),
+                  static_cast<unsigned long long>(spill.blocks), static_cast<unsigned long long>(spill.symbols),
+                  static_cast<unsigned long long>(spill.reads),
+                  static_cast<unsigned long long>(spill.windowMaps),
+                  static_cast<unsigned long long>(spill.bytesMapped));
+    return buf;
+}
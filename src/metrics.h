@@ -0,0 +1,87 @@
+// metrics.h
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// ----------------------------------------------
+// Allocation counting
+// ----------------------------------------------
+// metrics.cpp replaces the global operator new/delete with versions that
+// bump two thread-local counters before forwarding to malloc/free. That is
+// a couple of adds per allocation with no locking, so it stays enabled in
+// release builds; define COMPILER_NO_ALLOCATION_HOOK to leave the standard
+// operators in place (the counters then read zero).
+struct AllocationCounts
+{
+    uint64_t count = 0; // calls to operator new on this thread
+    uint64_t bytes = 0; // bytes requested by those calls
+};
+
+// Totals for the calling thread since it started
+AllocationCounts threadAllocations();
+
+// The process's resident set now and at its peak, in bytes; 0 where the
+// platform doesn't say (residentBytes() reads /proc, so Linux only)
+size_t residentBytes();
+size_t peakResidentBytes();
+
+// ----------------------------------------------
+// Spill statistics
+// ----------------------------------------------
+// What a memory-budgeted compile wrote to its spill file, and what reading
+// it back cost (see SpillFile)
+struct SpillStats
+{
+    uint64_t bytesWritten = 0;
+    uint64_t writes = 0;
+    uint64_t blocks = 0;      // token blocks that went to the file
+    uint64_t symbols = 0;     // symbol records that did
+    uint64_t reads = 0;       // token blocks, scopes and records read back
+    uint64_t windowMaps = 0;  // times a window of the file was mapped
+    uint64_t bytesMapped = 0; // total size of those windows
+};
+
+// ----------------------------------------------
+// Per-compile metrics
+// ----------------------------------------------
+struct CompileMetrics
+{
+    // Wall time per phase, in milliseconds
+    double loadMs = 0;   // gathering the source text for the Lexer
+    double lexMs = 0;    // Lexer::tokenize
+    double parseMs = 0;  // Parser::parse
+    double reportMs = 0; // building the symbol records and token entries
+
+    size_t sourceBytes = 0;
+    size_t tokens = 0;
+    size_t symbols = 0;
+    size_t errors = 0;
+
+    AllocationCounts allocations; // made by the compile, the lexer's thread included
+
+    // Memory-budgeted compiles only
+    size_t memoryBudget = 0; // bytes; 0 is unlimited
+    size_t peakResidentBytes = 0;
+    SpillStats spill;
+
+    double totalMs() const { return loadMs + lexMs + parseMs + reportMs; }
+    std::string toJson() const;
+};
+
+// Milliseconds since construction or the last lap()
+class PhaseTimer
+{
+public:
+    double lap()
+    {
+        auto now = std::chrono::steady_clock::now();
+        double ms = std::chrono::duration<double, std::milli>(now - start).count();
+        start = now;
+        return ms;
+    }
+
+private:
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+};
@@ -0,0 +1,339 @@
+// search.cpp
+#include "search.h"
+#include <algorithm>
+#include <cstring>
+#include "main.h"
+#include "trace.h"
+#include "utils.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+size_t findSubstring(std::string_view haystack, std::string_view needle, size_t from)
+{
+    const size_t n = haystack.size();
+    const size_t k = needle.size();
+    if (k == 0)
+        return from <= n ? from : std::string_view::npos;
+    if (k > n || from > n - k)
+        return std::string_view::npos;
+    const char *p = haystack.data();
+    const size_t last = n - k; // the last position a match can start at
+    size_t i = from;
+#if defined(__SSE2__)
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i final = _mm_set1_epi8(needle[k - 1]);
+    // Starts i..i+15 are all in range, so both loads stay inside the text
+    for (; i + 16 <= last + 1; i += 16)
+    {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + i + k - 1));
+        unsigned mask = static_cast<unsigned>(
+            _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, final))));
+        while (mask != 0)
+        {
+            size_t at = i + static_cast<size_t>(__builtin_ctz(mask));
+            if (k <= 2 || memcmp(p + at + 1, needle.data() + 1, k - 2) == 0)
+                return at;
+            mask &= mask - 1;
+        }
+    }
+#endif
+    while (i <= last)
+    {
+        const void *hit = memchr(p + i, needle[0], last - i + 1);
+        if (!hit)
+            break;
+        i = static_cast<size_t>(static_cast<const char *>(hit) - p);
+        if (p[i + k - 1] == needle[k - 1] && memcmp(p + i, needle.data(), k) == 0)
+            return i;
+        i++;
+    }
+    return std::string_view::npos;
+}
+
+namespace
+{
+// Smaller files are read: mapping and unmapping cost more than the copy
+constexpr size_t mapThreshold = 64 * 1024;
+
+// A file's bytes, mapped when it is large. A mapped file that is truncated
+// while it is searched would fault, so only sizes from fstat are trusted
+// and the mapping lives no longer than the scan of that file.
+class FileText
+{
+public:
+    explicit FileText(const std::string &path)
+    {
+#ifndef _WIN32
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+        {
+            size_t size = static_cast<size_t>(st.st_size);
+            if (size >= mapThreshold)
+            {
+                void *p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (p != MAP_FAILED)
+                {
+                    madvise(p, size, MADV_SEQUENTIAL);
+                    mapping = p;
+                    mappedSize = size;
+                }
+            }
+            if (!mapping)
+            {
+                bytes.resize(size);
+                size_t got = 0;
+                while (got < size)
+                {
+                    ssize_t r = ::read(fd, &bytes[got], size - got);
+                    if (r <= 0)
+                        break;
+                    got += static_cast<size_t>(r);
+                }
+                bytes.resize(got);
+            }
+        }
+        ::close(fd);
+#else
+        try
+        {
+            bytes = readFile(path);
+        }
+        catch (const std::exception &)
+        {
+            // Unreadable: searched as empty
+        }
+#endif
+    }
+
+    ~FileText()
+    {
+#ifndef _WIN32
+        if (mapping)
+            munmap(mapping, mappedSize);
+#endif
+    }
+
+    FileText(const FileText &) = delete;
+    FileText &operator=(const FileText &) = delete;
+
+    std::string_view text() const
+    {
+        if (mapping)
+            return std::string_view(static_cast<const char *>(mapping), mappedSize);
+        return bytes;
+    }
+
+private:
+    void *mapping = nullptr;
+    size_t mappedSize = 0;
+    std::string bytes;
+};
+
+// End of the string literal whose opening quote is at `start`: just past
+// the closing quote, or where an unterminated one stops
+size_t stringLiteralEnd(std::string_view text, size_t start)
+{
+    const char quote = text[start];
+    const bool triple = start + 2 < text.size() && text[start + 1] == quote && text[start + 2] == quote;
+    for (size_t i = start + (triple ? 3 : 1); i < text.size(); i++)
+    {
+        if (text[i] == '\\')
+        {
+            i++;
+            continue;
+        }
+        if (!triple && text[i] == '\n')
+            return i;
+        if (text[i] != quote)
+            continue;
+        if (!triple)
+            return i + 1;
+        if (i + 2 < text.size() && text[i + 1] == quote && text[i + 2] == quote)
+            return i + 3;
+    }
+    return text.size();
+}
+
+// Keeps the hits that lie wholly inside a token of the class. Both the hits
+// and the tokens are in offset order, so one pass over each does it.
+std::vector<size_t> inTokens(std::string_view text, const std::vector<size_t> &hits, size_t length,
+                             TextSearch::TokenClass tokenClass)
+{
+    StringPool local;
+    std::vector<Error> errors;
+    std::vector<Token> tokens = Lexer(local).tokenize(SourceView(text), errors);
+    const TokenType wanted = tokenClass == TextSearch::TokenClass::Identifier ? TokenType::IDENTIFIER
+                                                                              : TokenType::STRING_LITERAL;
+    std::vector<size_t> kept;
+    size_t h = 0;
+    for (const Token &token : tokens)
+    {
+        if (h == hits.size())
+            break;
+        if (token.type != wanted)
+            continue;
+        size_t start = token.offset;
+        size_t end = wanted == TokenType::IDENTIFIER ? start + token.lexeme.size()
+                                                     : stringLiteralEnd(text, start);
+        while (h < hits.size() && hits[h] < start)
+            h++;
+        for (; h < hits.size() && hits[h] + length <= end; h++)
+            kept.push_back(hits[h]);
+    }
+    return kept;
+}
+} // namespace
+
+// ----------------------------------------------
+// TextSearch
+// ----------------------------------------------
+TextSearch::~TextSearch()
+{
+    cancel();
+}
+
+void TextSearch::start(std::vector<Source> searchSources, std::string text, TokenClass tokens, unsigned threads)
+{
+    cancel();
+    sources = std::move(searchSources);
+    needle = std::move(text);
+    tokenClass = tokens;
+    next = 0;
+    searched = 0;
+    matchCount = 0;
+    truncated = false;
+    stopping = false;
+    if (needle.empty() || sources.empty())
+        return;
+
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t count = std::min<size_t>(threads, sources.size());
+    active = static_cast<unsigned>(count);
+    for (size_t w = 0; w < count; w++)
+        workers.emplace_back(&TextSearch::work, this);
+}
+
+void TextSearch::cancel()
+{
+    stopping = true;
+    for (std::thread &worker : workers)
+        worker.join();
+    workers.clear();
+    std::lock_guard<std::mutex> hold(pendingLock);
+    pending.clear();
+}
+
+void TextSearch::take(std::vector<Match> &out)
+{
+    std::lock_guard<std::mutex> hold(pendingLock);
+    if (pending.empty())
+        return;
+    out.insert(out.end(), std::make_move_iterator(pending.begin()), std::make_move_iterator(pending.end()));
+    pending.clear();
+}
+
+TextSearch::Status TextSearch::status() const
+{
+    Status status;
+    status.searched = searched;
+    status.total = sources.size();
+    status.matches = std::min(matchCount.load(), maxMatches);
+    status.running = active > 0;
+    status.truncated = truncated;
+    return status;
+}
+
+void TextSearch::work()
+{
+    setTraceThreadName("search worker");
+    for (size_t k; !stopping && (k = next.fetch_add(1)) < sources.size();)
+    {
+        search(sources[k]);
+        searched++;
+    }
+    if (--active == 0 && onProgress)
+        onProgress();
+}
+
+void TextSearch::search(const Source &source)
+{
+    TraceScope trace("search", source.path);
+    std::unique_ptr<FileText> file;
+    std::string_view text;
+    if (source.text)
+    {
+        text = *source.text;
+    }
+    else
+    {
+        file.reset(new FileText(source.path));
+        text = file->text();
+    }
+
+    std::vector<size_t> hits;
+    for (size_t at = findSubstring(text, needle); at != std::string_view::npos;
+         at = findSubstring(text, needle, at + 1))
+        hits.push_back(at);
+    if (!hits.empty() && tokenClass != TokenClass::Any)
+        hits = inTokens(text, hits, needle.size(), tokenClass);
+    if (hits.empty())
+        return;
+
+    // Reserve this file's share of the cap before building its matches
+    size_t before = matchCount.fetch_add(hits.size());
+    if (before >= maxMatches)
+    {
+        truncated = true;
+        stopping = true;
+        return;
+    }
+    if (before + hits.size() > maxMatches)
+    {
+        hits.resize(maxMatches - before);
+        truncated = true;
+        stopping = true;
+    }
+
+    std::vector<Match> found;
+    found.reserve(hits.size());
+    int line = 1;
+    size_t lineStart = 0;
+    size_t counted = 0; // newlines before here are in `line`
+    for (size_t at : hits)
+    {
+        for (const char *nl; (nl = static_cast<const char *>(memchr(text.data() + counted, '\n', at - counted)));)
+        {
+            line++;
+            counted = static_cast<size_t>(nl - text.data()) + 1;
+            lineStart = counted;
+        }
+        counted = at;
+        size_t lineEnd = text.find('\n', lineStart);
+        std::string_view lineText = text.substr(lineStart, lineEnd == std::string_view::npos ? lineEnd : lineEnd - lineStart);
+        if (!lineText.empty() && lineText.back() == '\r')
+            lineText.remove_suffix(1);
+        found.push_back({source.path, static_cast<uint32_t>(at), line, static_cast<int>(at - lineStart) + 1,
+                         std::string(lineText.substr(0, contextLength))});
+    }
+
+    {
+        std::lock_guard<std::mutex> hold(pendingLock);
+        pending.insert(pending.end(), std::make_move_iterator(found.begin()), std::make_move_iterator(found.end()));
+    }
+    if (onProgress)
+        onProgress();
+}
@@ -0,0 +1,101 @@
+// search.h
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Offset of the first `needle` in `haystack` at or after `from`, or npos.
+// With SSE2, 16 candidate positions are tested at a time on the needle's
+// first and last bytes together, and only those that pass both are
+// compared in full; elsewhere memchr finds the first byte.
+size_t findSubstring(std::string_view haystack, std::string_view needle, size_t from = 0);
+
+// ----------------------------------------------
+// TextSearch: find-in-files on worker threads
+// ----------------------------------------------
+// start() hands the sources to a pool of workers that each take the next
+// file, map it and scan it with findSubstring. When the search is limited
+// to identifiers or string literals, a file with raw hits is lexed and only
+// the hits inside a token of that class are kept; a file without any is
+// never lexed. Matches are handed over per file as soon as it is done, so
+// take() sees them stream in while the rest of the files are searched.
+class TextSearch
+{
+public:
+    enum class TokenClass
+    {
+        Any,
+        Identifier,
+        String,
+    };
+
+    struct Source
+    {
+        std::string path;                        // empty for text that is not a file
+        std::shared_ptr<const std::string> text; // null: read the file at `path`
+    };
+
+    struct Match
+    {
+        std::string path; // Source::path
+        uint32_t offset;
+        int line;
+        int column;          // 1-based, in bytes
+        std::string context; // the line, cut to contextLength bytes
+    };
+
+    struct Status
+    {
+        size_t searched = 0; // sources
+        size_t total = 0;
+        size_t matches = 0;
+        bool running = false;
+        bool truncated = false; // stopped at maxMatches
+    };
+
+    static constexpr size_t maxMatches = 10000;
+    static constexpr size_t contextLength = 160;
+
+    TextSearch() = default;
+    ~TextSearch();
+    TextSearch(const TextSearch &) = delete;
+    TextSearch &operator=(const TextSearch &) = delete;
+
+    // Cancels the search in progress, drops its matches and looks for
+    // `needle` in `sources` with up to `threads` workers (0: one per core)
+    void start(std::vector<Source> sources, std::string needle, TokenClass tokens, unsigned threads = 0);
+    void cancel();
+    // Appends the matches found since the last call: a source's matches
+    // arrive together and in order, sources in the order they finish
+    void take(std::vector<Match> &out);
+    Status status() const;
+
+    // Called on a worker thread after each source with matches and when
+    // the search ends; set it before start()
+    std::function<void()> onProgress;
+
+private:
+    std::vector<Source> sources;
+    std::string needle;
+    TokenClass tokenClass = TokenClass::Any;
+
+    std::vector<std::thread> workers;
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> searched{0};
+    std::atomic<size_t> matchCount{0};
+    std::atomic<unsigned> active{0};
+    std::atomic<bool> stopping{false};
+    std::atomic<bool> truncated{false};
+
+    mutable std::mutex pendingLock;
+    std::vector<Match> pending;
+
+    void work();
+    void search(const Source &source);
+};
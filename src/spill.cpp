@@ -0,0 +1,115 @@
+// spill.cpp
+#include "spill.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+SpillFile::~SpillFile()
+{
+#ifndef _WIN32
+    unmapWindow();
+    if (fd >= 0)
+        ::close(fd);
+#endif
+}
+
+bool SpillFile::open()
+{
+#ifndef _WIN32
+    if (fd >= 0)
+        return true;
+    const char *dir = std::getenv("TMPDIR");
+    std::string path = std::string(dir && *dir ? dir : "/tmp") + "/compiler-spill-XXXXXX";
+    fd = mkstemp(&path[0]);
+    if (fd < 0)
+        return false;
+    ::unlink(path.c_str());
+    return true;
+#else
+    return false;
+#endif
+}
+
+uint64_t SpillFile::append(const void *data, size_t length)
+{
+    uint64_t at = written;
+#ifndef _WIN32
+    const char *p = static_cast<const char *>(data);
+    for (size_t done = 0; done < length;)
+    {
+        ssize_t w = ::write(fd, p + done, length - done);
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w <= 0)
+            throw std::runtime_error(std::string("Spill file: ") + (w < 0 ? std::strerror(errno) : "disk full"));
+        done += static_cast<size_t>(w);
+    }
+    written += length;
+    std::lock_guard<std::mutex> hold(lock);
+    spillStats.bytesWritten += length;
+    spillStats.writes++;
+#else
+    (void)data;
+    (void)length;
+    throw std::runtime_error("Spill file: not supported on this platform");
+#endif
+    return at;
+}
+
+void SpillFile::countSpilled(uint64_t blocks, uint64_t symbols)
+{
+    std::lock_guard<std::mutex> hold(lock);
+    spillStats.blocks += blocks;
+    spillStats.symbols += symbols;
+}
+
+void SpillFile::read(uint64_t offset, size_t length, void *out)
+{
+#ifndef _WIN32
+    std::lock_guard<std::mutex> hold(lock);
+    spillStats.reads++;
+    if (!window || offset < windowStart || offset + length > windowStart + windowLength)
+    {
+        unmapWindow();
+        static const uint64_t page = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+        windowStart = offset / page * page;
+        uint64_t end = std::min<uint64_t>(written, std::max<uint64_t>(windowStart + windowBytes, offset + length));
+        windowLength = static_cast<size_t>(end - windowStart);
+        void *p = mmap(nullptr, windowLength, PROT_READ, MAP_PRIVATE, fd, static_cast<off_t>(windowStart));
+        if (p == MAP_FAILED)
+            throw std::runtime_error(std::string("Spill file: ") + std::strerror(errno));
+        madvise(p, windowLength, MADV_SEQUENTIAL);
+        window = p;
+        spillStats.windowMaps++;
+        spillStats.bytesMapped += windowLength;
+    }
+    memcpy(out, static_cast<const char *>(window) + (offset - windowStart), length);
+#else
+    (void)offset;
+    (void)length;
+    (void)out;
+#endif
+}
+
+SpillStats SpillFile::stats()
+{
+    std::lock_guard<std::mutex> hold(lock);
+    return spillStats;
+}
+
+void SpillFile::unmapWindow()
+{
+#ifndef _WIN32
+    if (window)
+        munmap(window, windowLength);
+#endif
+    window = nullptr;
+    windowLength = 0;
+}
@@ -0,0 +1,55 @@
+// spill.h
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include "metrics.h"
+
+// ----------------------------------------------
+// SpillFile: scratch space on disk for a memory budget
+// ----------------------------------------------
+// An append-only temporary file, unlinked as soon as it is created so it
+// goes away with the process however that ends. Data is read back through
+// a single mapped window of windowBytes that moves to wherever the last
+// read was: the pages behind it are unmapped, so however much has spilled,
+// at most a window of it is resident. Reads are serialised and may come
+// from any thread; appends are the writer's alone.
+class SpillFile
+{
+public:
+    static constexpr size_t windowBytes = 4 << 20;
+
+    SpillFile() = default;
+    ~SpillFile();
+    SpillFile(const SpillFile &) = delete;
+    SpillFile &operator=(const SpillFile &) = delete;
+
+    // Creates the file in $TMPDIR (or /tmp). False if it can't, or on
+    // platforms without mmap; the caller then keeps its data in memory.
+    bool open();
+    bool isOpen() const { return fd >= 0; }
+
+    // Appends `length` bytes and returns where they start. Throws
+    // std::runtime_error if the disk refuses them.
+    uint64_t append(const void *data, size_t length);
+    // Copies [offset, offset + length) of what was appended into `out`
+    void read(uint64_t offset, size_t length, void *out);
+
+    uint64_t size() const { return written; }
+    SpillStats stats();
+    // For writers to record what their appends held
+    void countSpilled(uint64_t blocks, uint64_t symbols);
+
+private:
+    int fd = -1;
+    uint64_t written = 0;
+
+    std::mutex lock; // guards the window and the counters
+    void *window = nullptr;
+    uint64_t windowStart = 0;
+    size_t windowLength = 0;
+    SpillStats spillStats;
+
+    void unmapWindow();
+};
@@ -0,0 +1,250 @@
+// string_pool.cpp
+#include "string_pool.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+// ----------------------------------------------
+// wyhash
+// ----------------------------------------------
+// Wang Yi's wyhash (public domain), final version 4, with its default
+// secret: a 64x64->128-bit multiply folds eight bytes per step, and short
+// keys, the common case here, take a single round.
+namespace
+{
+constexpr uint64_t wyp[4] = {0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull,
+                             0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull};
+
+inline void wymum(uint64_t &a, uint64_t &b)
+{
+    __uint128_t r = static_cast<__uint128_t>(a) * b;
+    a = static_cast<uint64_t>(r);
+    b = static_cast<uint64_t>(r >> 64);
+}
+
+inline uint64_t wymix(uint64_t a, uint64_t b)
+{
+    wymum(a, b);
+    return a ^ b;
+}
+
+inline uint64_t wyr8(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+inline uint64_t wyr4(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+inline uint64_t wyr3(const uint8_t *p, size_t k)
+{
+    return (static_cast<uint64_t>(p[0]) << 16) | (static_cast<uint64_t>(p[k >> 1]) << 8) | p[k - 1];
+}
+
+uint64_t wyhash(const void *key, size_t len, uint64_t seed = 0)
+{
+    const uint8_t *p = static_cast<const uint8_t *>(key);
+    seed ^= wymix(seed ^ wyp[0], wyp[1]);
+    uint64_t a, b;
+    if (len <= 16)
+    {
+        if (len >= 4)
+        {
+            a = (wyr4(p) << 32) | wyr4(p + ((len >> 3) << 2));
+            b = (wyr4(p + len - 4) << 32) | wyr4(p + len - 4 - ((len >> 3) << 2));
+        }
+        else if (len > 0)
+        {
+            a = wyr3(p, len);
+            b = 0;
+        }
+        else
+        {
+            a = b = 0;
+        }
+    }
+    else
+    {
+        size_t i = len;
+        if (i > 48)
+        {
+            uint64_t see1 = seed, see2 = seed;
+            do
+            {
+                seed = wymix(wyr8(p) ^ wyp[1], wyr8(p + 8) ^ seed);
+                see1 = wymix(wyr8(p + 16) ^ wyp[2], wyr8(p + 24) ^ see1);
+                see2 = wymix(wyr8(p + 32) ^ wyp[3], wyr8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16)
+        {
+            seed = wymix(wyr8(p) ^ wyp[1], wyr8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = wyr8(p + i - 16);
+        b = wyr8(p + i - 8);
+    }
+    a ^= wyp[1];
+    b ^= seed;
+    wymum(a, b);
+    return wymix(a ^ wyp[0] ^ len, b ^ wyp[1]);
+}
+} // namespace
+
+// ----------------------------------------------
+// StringPool
+// ----------------------------------------------
+StringPool::StringPool()
+    : shards(new Shard[shardCount])
+{
+}
+
+StringPool::~StringPool() = default;
+
+StringPool &StringPool::global()
+{
+    static StringPool pool;
+    return pool;
+}
+
+InternedString StringPool::intern(std::string_view text)
+{
+    if (text.empty())
+        return InternedString();
+    if (text.size() > UINT32_MAX - 1)
+        throw std::length_error("StringPool: string over 4 GB");
+
+    uint64_t hash = wyhash(text.data(), text.size());
+    // The top bits pick the shard, the bottom ones the slot
+    size_t shardIndex = static_cast<size_t>(hash >> (64 - shardBits));
+    Shard &shard = shards[shardIndex];
+    std::lock_guard<std::mutex> hold(shard.lock);
+
+    if (shard.slots.empty())
+        shard.slots.resize(64);
+    size_t mask = shard.slots.size() - 1;
+    size_t at = static_cast<size_t>(hash) & mask;
+    for (;; at = (at + 1) & mask)
+    {
+        const Slot &slot = shard.slots[at];
+        if (slot.index == 0)
+            break;
+        if (slot.hash == static_cast<uint32_t>(hash) && shard.strings[slot.index - 1].view() == text)
+            return shard.strings[slot.index - 1];
+    }
+
+    if (shard.count + 1 >= (UINT32_MAX >> shardBits))
+        throw std::length_error("StringPool: too many strings");
+    uint32_t id = ((shard.count + 1) << shardBits) | static_cast<uint32_t>(shardIndex);
+    InternedString added(store(text), static_cast<uint32_t>(text.size()), id);
+    shard.strings.push_back(added);
+    shard.count++;
+    const Slot slot{static_cast<uint32_t>(hash), shard.count};
+
+    if (2 * shard.count > shard.slots.size())
+    {
+        // Grow at half full; the new slot goes in with the rest. Slots
+        // keep the hash's low 32 bits, enough to place them in a table of
+        // up to 2^32.
+        std::vector<Slot> old(shard.slots.size() * 2);
+        old.swap(shard.slots);
+        mask = shard.slots.size() - 1;
+        old.push_back(slot);
+        for (const Slot &moved : old)
+        {
+            if (moved.index == 0)
+                continue;
+            size_t to = moved.hash & mask;
+            while (shard.slots[to].index != 0)
+                to = (to + 1) & mask;
+            shard.slots[to] = moved;
+        }
+    }
+    else
+    {
+        shard.slots[at] = slot;
+    }
+    return added;
+}
+
+// Copies `text` NUL-terminated into the arena. Blocks start at 4 KB and
+// double up to 1 MB; a string too big for a quarter block gets its own.
+const char *StringPool::store(std::string_view text)
+{
+    constexpr size_t firstBlock = 4096;
+    constexpr size_t largestBlock = size_t(1) << 20;
+
+    std::lock_guard<std::mutex> hold(arenaLock);
+    size_t need = text.size() + 1;
+    char *out;
+    if (need <= room)
+    {
+        out = next;
+        next += need;
+        room -= need;
+    }
+    else
+    {
+        size_t size = blocks.empty() ? firstBlock : std::min(largestBlock, 2 * blockBytes);
+        size = std::max(size, firstBlock);
+        if (need > size / 4)
+        {
+            // The current block keeps its room for the strings to come
+            blocks.emplace_back(new char[need]);
+            blockBytes += need;
+            out = blocks.back().get();
+        }
+        else
+        {
+            blocks.emplace_back(new char[size]);
+            blockBytes += size;
+            out = blocks.back().get();
+            next = out + need;
+            room = size - need;
+        }
+    }
+    memcpy(out, text.data(), text.size());
+    out[text.size()] = '\0';
+    return out;
+}
+
+size_t StringPool::size() const
+{
+    size_t total = 0;
+    for (size_t s = 0; s < shardCount; s++)
+    {
+        std::lock_guard<std::mutex> hold(shards[s].lock);
+        total += shards[s].count;
+    }
+    return total;
+}
+
+size_t StringPool::bytes() const
+{
+    std::lock_guard<std::mutex> hold(arenaLock);
+    return blockBytes;
+}
+
+void StringPool::clear()
+{
+    for (size_t s = 0; s < shardCount; s++)
+    {
+        shards[s].slots.clear();
+        shards[s].strings.clear();
+        shards[s].count = 0;
+    }
+    blocks.clear();
+    next = nullptr;
+    room = 0;
+    blockBytes = 0;
+}
@@ -0,0 +1,112 @@
+// string_pool.h
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// ----------------------------------------------
+// InternedString: a handle to text kept by a StringPool
+// ----------------------------------------------
+// 16 bytes: the pool's 32-bit id for the text plus a pointer to it, so
+// reading the text never goes back to the pool. Two handles from the same
+// pool are equal exactly when their ids are, which makes comparing them and
+// keying maps by them integer work; comparing with plain text compares the
+// text. A default handle is the empty string, id 0 in every pool.
+class InternedString
+{
+public:
+    InternedString() = default;
+
+    uint32_t id() const { return key; }
+    std::string_view view() const { return {text, length}; }
+    operator std::string_view() const { return view(); }
+    const char *c_str() const { return text; } // the pool NUL-terminates
+    const char *data() const { return text; }
+    size_t size() const { return length; }
+    bool empty() const { return length == 0; }
+    char operator[](size_t i) const { return text[i]; }
+    std::string str() const { return std::string(text, length); }
+
+    friend bool operator==(InternedString a, InternedString b) { return a.key == b.key; }
+    friend bool operator!=(InternedString a, InternedString b) { return a.key != b.key; }
+    friend bool operator==(InternedString a, std::string_view b) { return a.view() == b; }
+    friend bool operator!=(InternedString a, std::string_view b) { return a.view() != b; }
+    friend std::ostream &operator<<(std::ostream &out, InternedString s) { return out << s.view(); }
+
+private:
+    friend class StringPool;
+    InternedString(const char *text, uint32_t length, uint32_t key)
+        : text(text), length(length), key(key) {}
+
+    const char *text = "";
+    uint32_t length = 0;
+    uint32_t key = 0;
+};
+
+// ----------------------------------------------
+// StringPool: one copy of each distinct string
+// ----------------------------------------------
+// Identifiers, literals and scope names repeat all over a file, so tokens
+// and symbols hold InternedStrings and the text lives here once, packed
+// into arena blocks that never move or shrink until clear(). Lookups hash
+// with wyhash and probe an open-addressed table; the tables are split into
+// independently locked shards, as in ConcurrentSymbolTable, so a lexer and
+// parser threads can intern at the same time. Ids are only comparable
+// within one pool: the tokens feeding one SymbolTable must share a pool.
+class StringPool
+{
+public:
+    StringPool();
+    ~StringPool();
+    StringPool(const StringPool &) = delete;
+    StringPool &operator=(const StringPool &) = delete;
+
+    // The pool a Lexer or SymbolTable uses when given none. It is never
+    // cleared, so its handles stay valid for the life of the program.
+    static StringPool &global();
+
+    // The handle for `text`, copying it in on first sight. Thread-safe.
+    InternedString intern(std::string_view text);
+
+    size_t size() const;  // distinct strings, not counting the empty one
+    size_t bytes() const; // arena bytes allocated
+    // Drops every string, invalidating all handles. Not thread-safe.
+    void clear();
+
+private:
+    // 8 bytes, so a table of millions of identifiers stays small: the
+    // handle itself is kept once, in the shard's list
+    struct Slot
+    {
+        uint32_t hash = 0;  // low bits of the full hash, which place the slot
+        uint32_t index = 0; // into strings, plus one; 0: free
+    };
+
+    struct alignas(64) Shard
+    {
+        std::mutex lock;
+        std::vector<Slot> slots;            // power-of-two size, at most half full
+        std::deque<InternedString> strings; // in id order; grows without copying
+        uint32_t count = 0;
+    };
+
+    static constexpr unsigned shardBits = 4;
+    static constexpr size_t shardCount = size_t(1) << shardBits;
+
+    std::unique_ptr<Shard[]> shards;
+
+    // Arena, taken only when a string is new
+    mutable std::mutex arenaLock;
+    std::vector<std::unique_ptr<char[]>> blocks;
+    char *next = nullptr;
+    size_t room = 0;
+    size_t blockBytes = 0; // total allocated
+
+    const char *store(std::string_view text);
+};
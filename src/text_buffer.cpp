@@ -0,0 +1,446 @@
+// text_buffer.cpp
+#include "text_buffer.h"
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+size_t countNewlines(std::string_view text)
+{
+    return static_cast<size_t>(std::count(text.begin(), text.end(), '\n'));
+}
+}
+
+// ----------------------------------------------
+// Tree helpers
+// ----------------------------------------------
+uint32_t TextBuffer::nextPriority()
+{
+    // xorshift32: cheap and deterministic, good enough for treap balance
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+TextBuffer::NodePtr TextBuffer::makeNode(const Piece &piece, uint32_t priority,
+                                         NodePtr left, NodePtr right) const
+{
+    auto node = std::make_shared<Node>();
+    node->piece = piece;
+    node->priority = priority;
+    node->length = piece.length + (left ? left->length : 0) + (right ? right->length : 0);
+    node->newlines = piece.newlines + (left ? left->newlines : 0) + (right ? right->newlines : 0);
+    node->left = std::move(left);
+    node->right = std::move(right);
+    return node;
+}
+
+TextBuffer::NodePtr TextBuffer::merge(const NodePtr &a, const NodePtr &b) const
+{
+    if (!a)
+        return b;
+    if (!b)
+        return a;
+    if (a->priority > b->priority)
+        return makeNode(a->piece, a->priority, a->left, merge(a->right, b));
+    return makeNode(b->piece, b->priority, merge(a, b->left), b->right);
+}
+
+void TextBuffer::split(NodePtr node, size_t pos, NodePtr &left, NodePtr &right)
+{
+    if (!node)
+    {
+        left = right = nullptr;
+        return;
+    }
+    size_t leftLength = node->left ? node->left->length : 0;
+    if (pos <= leftLength)
+    {
+        NodePtr l, r;
+        split(node->left, pos, l, r);
+        left = l;
+        right = makeNode(node->piece, node->priority, r, node->right);
+    }
+    else if (pos >= leftLength + node->piece.length)
+    {
+        NodePtr l, r;
+        split(node->right, pos - leftLength - node->piece.length, l, r);
+        left = makeNode(node->piece, node->priority, node->left, l);
+        right = r;
+    }
+    else
+    {
+        // Cut the piece itself; pieces are capped at maxPieceLength so the
+        // newline recount here is bounded.
+        size_t cut = pos - leftLength;
+        Piece head = node->piece;
+        head.length = cut;
+        head.newlines = countNewlines(head.text());
+        Piece tail = node->piece;
+        tail.offset += cut;
+        tail.length -= cut;
+        tail.newlines = node->piece.newlines - head.newlines;
+        left = makeNode(head, node->priority, node->left, nullptr);
+        right = makeNode(tail, node->priority, nullptr, node->right);
+    }
+}
+
+TextBuffer::NodePtr TextBuffer::buildPieces(std::string_view text)
+{
+    if (text.empty())
+        return nullptr;
+
+    if (!addBlock || addCapacity - addUsed < text.size())
+    {
+        addCapacity = std::max(addBlockSize, text.size());
+        addBlock = std::shared_ptr<char[]>(new char[addCapacity]);
+        addUsed = 0;
+    }
+    std::memcpy(addBlock.get() + addUsed, text.data(), text.size());
+
+    NodePtr result;
+    for (size_t done = 0; done < text.size(); done += maxPieceLength)
+    {
+        Piece piece;
+        piece.block = addBlock;
+        piece.offset = addUsed + done;
+        piece.length = std::min(maxPieceLength, text.size() - done);
+        piece.newlines = countNewlines(piece.text());
+        result = merge(result, makeNode(piece, nextPriority(), nullptr, nullptr));
+    }
+    addUsed += text.size();
+    return result;
+}
+
+// Extends the rightmost piece in place when it ends exactly where the add
+// block's free space begins, so typing a run of characters stays one piece.
+TextBuffer::NodePtr TextBuffer::appendToLast(const NodePtr &node, std::string_view text, bool &appended)
+{
+    if (!node)
+        return node;
+    if (node->right)
+    {
+        NodePtr right = appendToLast(node->right, text, appended);
+        return appended ? makeNode(node->piece, node->priority, node->left, right) : node;
+    }
+
+    const Piece &last = node->piece;
+    if (last.block != addBlock || last.offset + last.length != addUsed ||
+        addCapacity - addUsed < text.size() || last.length + text.size() > maxPieceLength)
+    {
+        return node;
+    }
+
+    std::memcpy(addBlock.get() + addUsed, text.data(), text.size());
+    addUsed += text.size();
+    Piece extended = last;
+    extended.length += text.size();
+    extended.newlines += countNewlines(text);
+    appended = true;
+    return makeNode(extended, node->priority, node->left, nullptr);
+}
+
+void TextBuffer::pushHistory()
+{
+    undoStack.push_back(root);
+    if (undoStack.size() > maxHistory)
+        undoStack.pop_front();
+    redoStack.clear();
+}
+
+// ----------------------------------------------
+// Editing
+// ----------------------------------------------
+TextBuffer::TextBuffer(std::string_view text)
+{
+    assign(text);
+}
+
+void TextBuffer::assign(std::string_view text)
+{
+    addBlock.reset();
+    addUsed = addCapacity = 0;
+    root = buildPieces(text);
+    undoStack.clear();
+    redoStack.clear();
+}
+
+void TextBuffer::insert(size_t pos, std::string_view text)
+{
+    replace(pos, 0, text);
+}
+
+void TextBuffer::erase(size_t pos, size_t count)
+{
+    replace(pos, count, std::string_view());
+}
+
+void TextBuffer::replace(size_t pos, size_t count, std::string_view text)
+{
+    pos = std::min(pos, size());
+    count = std::min(count, size() - pos);
+    if (count == 0 && text.empty())
+        return;
+    pushHistory();
+
+    NodePtr left, middle, right;
+    split(root, pos, left, middle);
+    split(middle, count, middle, right);
+    if (!text.empty())
+    {
+        bool appended = false;
+        left = appendToLast(left, text, appended);
+        if (!appended)
+            left = merge(left, buildPieces(text));
+    }
+    root = merge(left, right);
+}
+
+bool TextBuffer::reconcile(std::string_view text, Edit *edit)
+{
+    std::vector<std::string_view> pieces;
+    for (ChunkIterator it(root); !it.done(); ++it)
+        pieces.push_back(*it);
+
+    size_t oldSize = size();
+    size_t limit = std::min(oldSize, text.size());
+
+    // Common prefix
+    size_t prefix = 0;
+    for (size_t p = 0; p < pieces.size() && prefix < limit; p++)
+    {
+        std::string_view chunk = pieces[p].substr(0, limit - prefix);
+        if (std::memcmp(chunk.data(), text.data() + prefix, chunk.size()) == 0)
+        {
+            prefix += chunk.size();
+            continue;
+        }
+        size_t k = 0;
+        while (chunk[k] == text[prefix + k])
+            k++;
+        prefix += k;
+        break;
+    }
+    if (prefix == oldSize && prefix == text.size())
+        return false;
+
+    // Common suffix, not overlapping the prefix
+    size_t suffix = 0;
+    size_t suffixLimit = limit - prefix;
+    for (size_t p = pieces.size(); p-- > 0 && suffix < suffixLimit;)
+    {
+        std::string_view chunk = pieces[p];
+        size_t n = std::min(chunk.size(), suffixLimit - suffix);
+        const char *a = chunk.data() + chunk.size() - n;
+        const char *b = text.data() + text.size() - suffix - n;
+        if (std::memcmp(a, b, n) == 0)
+        {
+            suffix += n;
+            continue;
+        }
+        size_t k = 0;
+        while (a[n - 1 - k] == b[n - 1 - k])
+            k++;
+        suffix += k;
+        break;
+    }
+
+    replace(prefix, oldSize - prefix - suffix,
+            text.substr(prefix, text.size() - prefix - suffix));
+    if (edit)
+        *edit = {prefix, oldSize - prefix - suffix, text.size() - prefix - suffix};
+    return true;
+}
+
+bool TextBuffer::undo()
+{
+    if (undoStack.empty())
+        return false;
+    redoStack.push_back(root);
+    root = undoStack.back();
+    undoStack.pop_back();
+    return true;
+}
+
+bool TextBuffer::redo()
+{
+    if (redoStack.empty())
+        return false;
+    undoStack.push_back(root);
+    root = redoStack.back();
+    redoStack.pop_back();
+    return true;
+}
+
+// ----------------------------------------------
+// Snapshot / ChunkIterator
+// ----------------------------------------------
+TextBuffer::ChunkIterator::ChunkIterator(const NodePtr &root)
+{
+    pushLeft(root.get());
+}
+
+void TextBuffer::ChunkIterator::pushLeft(const Node *node)
+{
+    while (node)
+    {
+        stack.push_back(node);
+        node = node->left.get();
+    }
+}
+
+TextBuffer::ChunkIterator &TextBuffer::ChunkIterator::operator++()
+{
+    const Node *node = stack.back();
+    stack.pop_back();
+    pushLeft(node->right.get());
+    return *this;
+}
+
+std::string TextBuffer::Snapshot::toString() const
+{
+    std::string text;
+    text.reserve(size());
+    for (ChunkIterator it(root); !it.done(); ++it)
+        text.append(*it);
+    return text;
+}
+
+namespace
+{
+// Appends the part of [from, to) held by the subtree at `node`, whose text
+// starts at document offset `base`
+void appendRange(const TextBuffer::Node *node, size_t base, size_t from, size_t to, std::string &out)
+{
+    while (node && from < to)
+    {
+        size_t pieceStart = base + (node->left ? node->left->length : 0);
+        size_t pieceEnd = pieceStart + node->piece.length;
+        if (from < pieceStart)
+            appendRange(node->left.get(), base, from, std::min(to, pieceStart), out);
+        if (from < pieceEnd && to > pieceStart)
+        {
+            size_t a = std::max(from, pieceStart);
+            size_t b = std::min(to, pieceEnd);
+            out.append(node->piece.text().substr(a - pieceStart, b - a));
+        }
+        if (to <= pieceEnd)
+            return;
+        from = std::max(from, pieceEnd);
+        base = pieceEnd;
+        node = node->right.get();
+    }
+}
+} // namespace
+
+std::string TextBuffer::Snapshot::substr(size_t pos, size_t count) const
+{
+    std::string text;
+    if (pos >= size())
+        return text;
+    count = std::min(count, size() - pos);
+    text.reserve(count);
+    appendRange(root.get(), 0, pos, pos + count, text);
+    return text;
+}
+
+size_t TextBuffer::Snapshot::offsetOfLine(size_t line) const
+{
+    if (line == 0)
+        return 0;
+    if (!root || line > root->newlines)
+        return size();
+
+    // Find the line-th newline; the line starts just after it.
+    size_t base = 0;
+    const Node *node = root.get();
+    while (node)
+    {
+        size_t leftNewlines = node->left ? node->left->newlines : 0;
+        size_t leftLength = node->left ? node->left->length : 0;
+        if (line <= leftNewlines)
+        {
+            node = node->left.get();
+            continue;
+        }
+        line -= leftNewlines;
+        if (line <= node->piece.newlines)
+        {
+            std::string_view text = node->piece.text();
+            for (size_t k = 0; k < text.size(); k++)
+            {
+                if (text[k] == '\n' && --line == 0)
+                    return base + leftLength + k + 1;
+            }
+        }
+        line -= node->piece.newlines;
+        base += leftLength + node->piece.length;
+        node = node->right.get();
+    }
+    return size();
+}
+
+// ----------------------------------------------
+// SourceView
+// ----------------------------------------------
+SourceView::SourceView(const std::string &text)
+    : chunks{{0, std::string_view(text)}}, total(text.size())
+{
+}
+
+SourceView::SourceView(std::string_view text)
+    : chunks{{0, text}}, total(text.size())
+{
+}
+
+SourceView::SourceView(const TextBuffer::Snapshot &snapshot)
+    : snapshot(snapshot)
+{
+    for (auto it = snapshot.chunks(); !it.done(); ++it)
+    {
+        chunks.push_back({total, *it});
+        total += (*it).size();
+    }
+    if (chunks.empty())
+        chunks.push_back({0, std::string_view()});
+}
+
+char SourceView::slowAt(size_t i) const
+{
+    if (i >= total)
+        return '\0';
+    auto it = std::upper_bound(chunks.begin(), chunks.end(), i,
+                               [](size_t pos, const Chunk &c)
+                               { return pos < c.start; });
+    current = static_cast<size_t>(it - chunks.begin()) - 1;
+    const Chunk &c = chunks[current];
+    return c.text[i - c.start];
+}
+
+std::string_view SourceView::contiguous(size_t pos) const
+{
+    if (pos >= total)
+        return {};
+    (*this)[pos]; // position `current` on the chunk holding pos
+    const Chunk &c = chunks[current];
+    return c.text.substr(pos - c.start);
+}
+
+std::string SourceView::substr(size_t pos, size_t count) const
+{
+    pos = std::min(pos, total);
+    count = std::min(count, total - pos);
+    std::string out;
+    out.reserve(count);
+    while (count > 0)
+    {
+        (*this)[pos]; // position `current` on the chunk holding pos
+        const Chunk &c = chunks[current];
+        size_t n = std::min(count, c.text.size() - (pos - c.start));
+        out.append(c.text.data() + (pos - c.start), n);
+        pos += n;
+        count -= n;
+    }
+    return out;
+}
@@ -0,0 +1,168 @@
+// text_buffer.h
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// ----------------------------------------------
+// TextBuffer: piece table document model
+// ----------------------------------------------
+// Text lives in immutable, shared blocks (the loaded file plus append-only
+// blocks for typed text). The document is a sequence of pieces pointing into
+// those blocks, kept in a persistent treap keyed by byte offset. Edits copy
+// only the O(log n) nodes on the path they touch, so a Snapshot is just a
+// root pointer: it is O(1) to take, never changes, and can be read from
+// another thread while the editor keeps modifying the buffer.
+class TextBuffer
+{
+public:
+    struct Piece
+    {
+        std::shared_ptr<const char[]> block; // keeps the bytes alive
+        size_t offset = 0;
+        size_t length = 0;
+        size_t newlines = 0;
+
+        std::string_view text() const { return {block.get() + offset, length}; }
+    };
+
+    struct Node;
+    using NodePtr = std::shared_ptr<const Node>;
+
+    struct Node
+    {
+        Piece piece;
+        uint32_t priority;
+        size_t length;   // bytes in this subtree
+        size_t newlines; // '\n' characters in this subtree
+        NodePtr left;
+        NodePtr right;
+    };
+
+    // Walks the pieces of a snapshot in document order.
+    class ChunkIterator
+    {
+    public:
+        explicit ChunkIterator(const NodePtr &root);
+        bool done() const { return stack.empty(); }
+        std::string_view operator*() const { return stack.back()->piece.text(); }
+        ChunkIterator &operator++();
+
+    private:
+        void pushLeft(const Node *node);
+        std::vector<const Node *> stack;
+    };
+
+    class Snapshot
+    {
+    public:
+        Snapshot() = default;
+        explicit Snapshot(NodePtr root) : root(std::move(root)) {}
+
+        size_t size() const { return root ? root->length : 0; }
+        size_t lineCount() const { return (root ? root->newlines : 0) + 1; }
+        ChunkIterator chunks() const { return ChunkIterator(root); }
+        std::string toString() const;
+        // Byte offset where 0-based line `line` starts (size() past the end).
+        size_t offsetOfLine(size_t line) const;
+        // The bytes in [pos, pos + count), visiting only the pieces they span
+        std::string substr(size_t pos, size_t count) const;
+
+    private:
+        NodePtr root;
+    };
+
+    TextBuffer() = default;
+    explicit TextBuffer(std::string_view text);
+
+    void assign(std::string_view text); // also clears undo history
+    void insert(size_t pos, std::string_view text);
+    void erase(size_t pos, size_t count);
+    void replace(size_t pos, size_t count, std::string_view text);
+    // Describes one replace: `removed` bytes at `offset` became `inserted` bytes
+    struct Edit
+    {
+        size_t offset = 0;
+        size_t removed = 0;
+        size_t inserted = 0;
+    };
+
+    // Applies the single replace that turns the document into `text` and
+    // reports it through `edit`. Returns false when the two were already equal.
+    bool reconcile(std::string_view text, Edit *edit = nullptr);
+
+    bool undo();
+    bool redo();
+    bool canUndo() const { return !undoStack.empty(); }
+    bool canRedo() const { return !redoStack.empty(); }
+
+    Snapshot snapshot() const { return Snapshot(root); }
+    size_t size() const { return root ? root->length : 0; }
+    std::string toString() const { return snapshot().toString(); }
+
+private:
+    static constexpr size_t maxPieceLength = 64 * 1024;
+    static constexpr size_t addBlockSize = 64 * 1024;
+    static constexpr size_t maxHistory = 1000;
+
+    NodePtr root;
+    std::deque<NodePtr> undoStack;
+    std::vector<NodePtr> redoStack;
+
+    std::shared_ptr<char[]> addBlock; // current append-only block
+    size_t addUsed = 0;
+    size_t addCapacity = 0;
+    uint32_t seed = 0x9E3779B9u;
+
+    uint32_t nextPriority();
+    NodePtr makeNode(const Piece &piece, uint32_t priority, NodePtr left, NodePtr right) const;
+    NodePtr merge(const NodePtr &a, const NodePtr &b) const;
+    void split(NodePtr node, size_t pos, NodePtr &left, NodePtr &right);
+    NodePtr buildPieces(std::string_view text);
+    NodePtr appendToLast(const NodePtr &node, std::string_view text, bool &appended);
+    void pushHistory();
+};
+
+// ----------------------------------------------
+// SourceView: read-only random access over chunks
+// ----------------------------------------------
+// Lets the Lexer walk either a plain string or a TextBuffer snapshot without
+// flattening it first. Sequential access stays O(1) by remembering the last
+// chunk hit; reads past the end return '\0' like std::string::operator[].
+class SourceView
+{
+public:
+    SourceView(const std::string &text);
+    explicit SourceView(std::string_view text); // e.g. a mapped file
+    explicit SourceView(const TextBuffer::Snapshot &snapshot);
+
+    size_t size() const { return total; }
+    char operator[](size_t i) const
+    {
+        const Chunk &c = chunks[current];
+        if (i - c.start < c.text.size())
+            return c.text[i - c.start];
+        return slowAt(i);
+    }
+    std::string substr(size_t pos, size_t count = std::string::npos) const;
+    // The text from `pos` to the end of the chunk holding it; empty at the end
+    std::string_view contiguous(size_t pos) const;
+
+private:
+    struct Chunk
+    {
+        size_t start;
+        std::string_view text;
+    };
+
+    char slowAt(size_t i) const;
+
+    TextBuffer::Snapshot snapshot; // keeps snapshot blocks alive
+    std::vector<Chunk> chunks;
+    size_t total = 0;
+    mutable size_t current = 0;
+};
@@ -0,0 +1,291 @@
+// token_store.cpp
+#include "token_store.h"
+#include <algorithm>
+#include <cstring>
+#include "metrics.h"
+#include "spill.h"
+#include "utils.h"
+
+namespace
+{
+// Nibble codes 0..14, commonest first; 15 escapes to a kind byte
+constexpr TokenType commonKinds[] = {
+    TokenType::IDENTIFIER, TokenType::OPERATOR, TokenType::Comma, TokenType::LeftParenthesis,
+    TokenType::RightParenthesis, TokenType::Dot, TokenType::NUMBER, TokenType::STRING_LITERAL,
+    TokenType::Colon, TokenType::LeftBracket, TokenType::RightBracket, TokenType::LeftBrace,
+    TokenType::RightBrace, TokenType::INDENT, TokenType::DEDENT};
+constexpr uint8_t escapeNibble = 0xF;
+static_assert(sizeof(commonKinds) / sizeof(commonKinds[0]) == escapeNibble, "one nibble code per common kind");
+
+constexpr size_t kindCount = static_cast<size_t>(TokenType::DEDENT) + 1;
+
+// Residency is checked, and data spilled, in steps of at least this much
+constexpr uint64_t spillStep = 1 << 20;
+
+constexpr std::array<uint8_t, kindCount> nibbleCodes()
+{
+    std::array<uint8_t, kindCount> codes{};
+    for (size_t k = 0; k < kindCount; k++)
+        codes[k] = escapeNibble;
+    for (size_t c = 0; c < escapeNibble; c++)
+        codes[static_cast<size_t>(commonKinds[c])] = static_cast<uint8_t>(c);
+    return codes;
+}
+constexpr std::array<uint8_t, kindCount> nibbleOf = nibbleCodes();
+
+uint64_t zigzag(int64_t v)
+{
+    return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+}
+
+int64_t unzigzag(uint64_t v)
+{
+    return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+}
+
+uint64_t readVarint(const uint8_t *&p)
+{
+    uint64_t v = *p++;
+    if (v < 0x80)
+        return v; // most deltas and indices fit in a byte
+    v &= 0x7F;
+    for (int shift = 7;; shift += 7)
+    {
+        uint8_t byte = *p++;
+        v |= uint64_t(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return v;
+    }
+}
+} // namespace
+
+// ----------------------------------------------
+// Encoding
+// ----------------------------------------------
+void CompressedTokens::putVarint(uint64_t v)
+{
+    while (v >= 0x80)
+    {
+        data.push_back(static_cast<uint8_t>(v | 0x80));
+        v >>= 7;
+    }
+    data.push_back(static_cast<uint8_t>(v));
+}
+
+uint32_t CompressedTokens::slot(InternedString s)
+{
+    if (stringSlot.empty() && !strings.empty())
+    {
+        // Appending after finish()
+        for (size_t k = 0; k < strings.size(); k++)
+            slotOf(strings[k]) = static_cast<uint32_t>(k);
+    }
+    uint32_t &index = slotOf(s);
+    if (index == none)
+    {
+        index = static_cast<uint32_t>(strings.size());
+        strings.push_back(s);
+    }
+    return index;
+}
+
+uint32_t &CompressedTokens::slotOf(InternedString s)
+{
+    if (s.id() >= stringSlot.size())
+        stringSlot.resize(std::max<size_t>(s.id() + 1, stringSlot.size() * 2), none);
+    return stringSlot[s.id()];
+}
+
+void CompressedTokens::push_back(const Token &token)
+{
+    if (count % blockSize == 0)
+    {
+        index.push_back({spilled + data.size(), token.offset, token.lineNumber});
+        lastLine = token.lineNumber;
+        lastOffset = token.offset;
+        lastScope = none;
+        lastLexeme.fill(none);
+    }
+
+    const size_t kind = static_cast<size_t>(token.type);
+    const uint8_t nibble = nibbleOf[kind];
+    if (count % 2 == 0)
+        kinds.push_back(nibble);
+    else
+        kinds.back() |= static_cast<uint8_t>(nibble << 4);
+    if (nibble == escapeNibble)
+        data.push_back(static_cast<uint8_t>(kind));
+
+    putVarint(zigzag(token.lineNumber - lastLine));
+    putVarint(zigzag(static_cast<int64_t>(token.offset - lastOffset)));
+    lastLine = token.lineNumber;
+    lastOffset = token.offset;
+
+    uint32_t lexeme = slot(token.lexeme);
+    putVarint(lexeme == lastLexeme[kind] ? 0 : uint64_t(lexeme) + 1);
+    lastLexeme[kind] = lexeme;
+
+    // 0: no scope, 1: the last scope in this block, else the index + 2
+    if (token.scope.empty())
+    {
+        putVarint(0);
+    }
+    else
+    {
+        uint32_t scope = slot(token.scope);
+        putVarint(scope == lastScope ? 1 : uint64_t(scope) + 2);
+        lastScope = scope;
+    }
+
+    if (token.type == TokenType::NUMBER)
+    {
+        data.push_back(static_cast<uint8_t>(token.numberKind));
+        if (token.numberKind == NumberKind::Integer)
+        {
+            putVarint(zigzag(token.intValue));
+        }
+        else if (token.numberKind == NumberKind::Float || token.numberKind == NumberKind::Imaginary)
+        {
+            uint8_t bytes[sizeof(double)];
+            memcpy(bytes, &token.floatValue, sizeof(bytes));
+            data.insert(data.end(), bytes, bytes + sizeof(bytes));
+        }
+    }
+    count++;
+}
+
+void CompressedTokens::append(const std::vector<Token> &tokens)
+{
+    for (const Token &token : tokens)
+        push_back(token);
+    if (spill)
+        spillCompleteBlocks();
+}
+
+void CompressedTokens::spillTo(SpillFile &file, size_t limit, MappedFile *lexedFrom)
+{
+    spill = &file;
+    spillAt = limit;
+    source = lexedFrom;
+}
+
+void CompressedTokens::spillCompleteBlocks()
+{
+    const uint64_t streamSize = spilled + data.size();
+    if (streamSize - checkedAt < spillStep)
+        return;
+    checkedAt = streamSize;
+    if (residentBytes() < spillAt)
+        return;
+    if (source)
+        source->release(lastOffset);
+    const size_t complete = count / blockSize;
+    const uint64_t end = complete < index.size() ? index[complete].position : streamSize;
+    if (end - spilled < spillStep)
+        return;
+
+    const size_t length = static_cast<size_t>(end - spilled);
+    spill->append(data.data(), length);
+    spill->countSpilled(complete - spilledBlocks, 0);
+    // A fresh vector, so the memory goes back rather than staying as capacity
+    std::vector<uint8_t> rest(data.begin() + static_cast<std::ptrdiff_t>(length), data.end());
+    rest.reserve(2 * spillStep);
+    data.swap(rest);
+    spilled = end;
+    spilledBlocks = complete;
+}
+
+void CompressedTokens::finish()
+{
+    std::vector<uint32_t>().swap(stringSlot);
+    kinds.shrink_to_fit();
+    data.shrink_to_fit();
+    index.shrink_to_fit();
+    strings.shrink_to_fit();
+}
+
+size_t CompressedTokens::bytes() const
+{
+    return kinds.capacity() + data.capacity() + index.capacity() * sizeof(Block) +
+           strings.capacity() * sizeof(InternedString) + stringSlot.capacity() * sizeof(uint32_t);
+}
+
+// ----------------------------------------------
+// Decoding
+// ----------------------------------------------
+void CompressedTokens::decodeBlock(size_t block, std::vector<Token> &out) const
+{
+    out.clear();
+    const Block &start = index[block];
+    const size_t first = block * blockSize;
+    const size_t n = std::min(blockSize, count - first);
+    out.reserve(n);
+
+    const uint8_t *p;
+    std::vector<uint8_t> paged;
+    if (block < spilledBlocks)
+    {
+        uint64_t end = block + 1 < index.size() ? index[block + 1].position : spilled;
+        paged.resize(static_cast<size_t>(end - start.position));
+        spill->read(start.position, paged.size(), paged.data());
+        p = paged.data();
+    }
+    else
+    {
+        p = data.data() + (start.position - spilled);
+    }
+    int64_t line = start.line;
+    uint64_t offset = start.offset;
+    uint32_t scope = none;
+    std::array<uint32_t, kindCount> lexemes;
+    lexemes.fill(none);
+
+    for (size_t t = first; t < first + n; t++)
+    {
+        uint8_t nibble = (kinds[t / 2] >> (t % 2 * 4)) & 0xF;
+        TokenType type = nibble == escapeNibble ? static_cast<TokenType>(*p++) : commonKinds[nibble];
+        line += unzigzag(readVarint(p));
+        offset += static_cast<uint64_t>(unzigzag(readVarint(p)));
+
+        uint32_t &lexeme = lexemes[static_cast<size_t>(type)];
+        uint64_t code = readVarint(p);
+        if (code != 0)
+            lexeme = static_cast<uint32_t>(code - 1);
+
+        InternedString scopeText;
+        code = readVarint(p);
+        if (code >= 2)
+            scope = static_cast<uint32_t>(code - 2);
+        if (code != 0)
+            scopeText = strings[scope];
+
+        Token &token = out.emplace_back(type, strings[lexeme], static_cast<int>(line), static_cast<size_t>(offset),
+                                        scopeText);
+        if (type == TokenType::NUMBER)
+        {
+            token.numberKind = static_cast<NumberKind>(*p++);
+            if (token.numberKind == NumberKind::Integer)
+            {
+                token.intValue = unzigzag(readVarint(p));
+            }
+            else if (token.numberKind == NumberKind::Float || token.numberKind == NumberKind::Imaginary)
+            {
+                memcpy(&token.floatValue, p, sizeof(double));
+                p += sizeof(double);
+            }
+        }
+    }
+}
+
+std::vector<Token> CompressedTokens::decodeAll() const
+{
+    std::vector<Token> all;
+    all.reserve(count);
+    std::vector<Token> block;
+    for (size_t b = 0; b < index.size(); b++)
+    {
+        decodeBlock(b, block);
+        all.insert(all.end(), block.begin(), block.end());
+    }
+    return all;
+}
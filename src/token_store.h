@@ -0,0 +1,100 @@
+// token_store.h
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "main.h"
+
+class MappedFile;
+class SpillFile;
+
+// ----------------------------------------------
+// CompressedTokens: a token array at a few bytes a token
+// ----------------------------------------------
+// For generated inputs of 100 MB and more, where even 64-byte Tokens add
+// up to gigabytes. Tokens are packed in blocks of blockSize, each of which
+// decodes on its own:
+//
+//   kinds  a nibble per token: the 15 commonest kinds have codes of their
+//          own, the rest (mostly keywords) escape to a byte in the data
+//   data   per token, varints: line and offset as zigzag deltas from the
+//          token before, lexeme and scope as indices into the store's
+//          dictionary of strings (0 repeats the last of that kind in the
+//          block), then numberKind and the value for NUMBER tokens
+//   index  per block: where its data starts, and its first line and offset
+//
+// Reading token i decodes the block holding it, so random access costs one
+// block and sequential reads a varint walk per token; TokenStream keeps
+// recently decoded blocks for the Parser. Typical code takes 4 to 6 bytes a
+// token. The tokens must all come from one StringPool, and non-NUMBER
+// tokens are assumed to have NumberKind::None, as the Lexer makes them.
+//
+// Under a memory budget the data of completed blocks can move to a
+// SpillFile as it is appended, leaving the kinds, the index and the
+// dictionary in memory; decodeBlock reads spilled blocks back through the
+// file's window. Decoding must not overlap appending.
+class CompressedTokens
+{
+public:
+    static constexpr size_t blockSize = 128;
+
+    void push_back(const Token &token);
+    void append(const std::vector<Token> &tokens);
+    // Drops what only appending needs; appending again rebuilds it
+    void finish();
+    // Once the process's resident set reaches `spillAt` bytes, append()
+    // moves the data of completed blocks to `file`, and gives back the pages
+    // of `source`, if given, that the tokens so far were lexed from. Both
+    // must outlive the store.
+    void spillTo(SpillFile &file, size_t spillAt, MappedFile *source = nullptr);
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    size_t blockCount() const { return index.size(); }
+    // Heap bytes held, for comparison with size() * sizeof(Token)
+    size_t bytes() const;
+    uint64_t spilledBytes() const { return spilled; }
+
+    // Tokens of `block` into `out`, replacing its contents
+    void decodeBlock(size_t block, std::vector<Token> &out) const;
+    std::vector<Token> decodeAll() const;
+
+private:
+    static constexpr size_t kindCount = static_cast<size_t>(TokenType::DEDENT) + 1;
+    static constexpr uint32_t none = UINT32_MAX;
+
+    struct Block
+    {
+        uint64_t position; // of its first token in data
+        uint64_t offset;   // of its first token in the source
+        int64_t line;      // of its first token
+    };
+
+    std::vector<uint8_t> kinds; // two tokens a byte, the earlier in the low nibble
+    std::vector<uint8_t> data;
+    std::vector<Block> index;
+    std::vector<InternedString> strings; // the dictionary
+    std::vector<uint32_t> stringSlot;    // by pool id (dense, as StringPool hands them out): index in strings
+    size_t count = 0;
+
+    // Spilling: data holds the stream from byte `spilled` on; blocks
+    // before spilledBlocks are wholly in the file
+    SpillFile *spill = nullptr;
+    MappedFile *source = nullptr;
+    size_t spillAt = 0;
+    uint64_t spilled = 0;
+    size_t spilledBlocks = 0;
+    uint64_t checkedAt = 0; // stream size when residency was last checked
+
+    // Encoder state, reset at each block
+    int64_t lastLine = 0;
+    uint64_t lastOffset = 0;
+    uint32_t lastScope = none;
+    std::array<uint32_t, kindCount> lastLexeme{};
+
+    uint32_t slot(InternedString s);
+    uint32_t &slotOf(InternedString s);
+    void putVarint(uint64_t v);
+    void spillCompleteBlocks();
+};
@@ -0,0 +1,176 @@
+// trace.cpp
+#include "trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "json.h"
+
+std::atomic<bool> traceFlag{false};
+
+namespace
+{
+struct TraceEvent
+{
+    const char *name;
+    char detail[64]; // NUL-terminated, truncated copy
+    uint64_t startNs;
+    uint64_t endNs;
+};
+
+// Events are stored in fixed chunks that never move, so the exporter can
+// read a prefix while the owner keeps appending past it.
+struct ThreadBuffer
+{
+    static constexpr size_t chunkSize = 4096;
+    static constexpr size_t maxChunks = 256; // about a million spans per thread
+
+    int tid = 0;
+    std::atomic<const char *> name{nullptr};
+    std::atomic<size_t> count{0};
+    std::atomic<TraceEvent *> chunks[maxChunks] = {};
+
+    ~ThreadBuffer()
+    {
+        for (auto &chunk : chunks)
+            delete[] chunk.load();
+    }
+};
+
+// Buffers outlive their threads so a trace can be exported after a worker
+// exits. The mutex is only taken the first time a thread records a span.
+struct TraceRegistry
+{
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+    std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+};
+
+TraceRegistry &registry()
+{
+    static TraceRegistry instance;
+    return instance;
+}
+
+thread_local ThreadBuffer *localBuffer = nullptr;
+thread_local const char *localThreadName = nullptr;
+
+ThreadBuffer &threadBuffer()
+{
+    if (!localBuffer)
+    {
+        TraceRegistry &reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        reg.buffers.push_back(std::make_unique<ThreadBuffer>());
+        localBuffer = reg.buffers.back().get();
+        localBuffer->tid = static_cast<int>(reg.buffers.size());
+        localBuffer->name = localThreadName;
+    }
+    return *localBuffer;
+}
+}
+
+void setTraceEnabled(bool enabled)
+{
+    registry(); // fix the epoch before the first span
+    traceFlag.store(enabled, std::memory_order_relaxed);
+}
+
+void setTraceThreadName(const char *name)
+{
+    localThreadName = name;
+    if (localBuffer)
+        localBuffer->name = name;
+}
+
+uint64_t traceNow()
+{
+    auto elapsed = std::chrono::steady_clock::now() - registry().epoch;
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+}
+
+void traceRecord(const char *name, std::string_view detail, uint64_t startNs, uint64_t endNs)
+{
+    ThreadBuffer &buf = threadBuffer();
+    size_t index = buf.count.load(std::memory_order_relaxed);
+    size_t chunkIndex = index / ThreadBuffer::chunkSize;
+    if (chunkIndex >= ThreadBuffer::maxChunks)
+        return; // full: later spans on this thread are discarded
+    TraceEvent *chunk = buf.chunks[chunkIndex].load(std::memory_order_relaxed);
+    if (!chunk)
+    {
+        chunk = new TraceEvent[ThreadBuffer::chunkSize];
+        buf.chunks[chunkIndex].store(chunk, std::memory_order_relaxed);
+    }
+
+    TraceEvent &ev = chunk[index % ThreadBuffer::chunkSize];
+    ev.name = name;
+    size_t length = std::min(detail.size(), sizeof(ev.detail) - 1);
+    if (length)
+        memcpy(ev.detail, detail.data(), length); // an empty view may be null
+    ev.detail[length] = '\0';
+    ev.startNs = startNs;
+    ev.endNs = endNs;
+    buf.count.store(index + 1, std::memory_order_release);
+}
+
+void clearTrace()
+{
+    TraceRegistry &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    for (auto &buf : reg.buffers)
+        buf->count.store(0, std::memory_order_relaxed);
+}
+
+bool writeTraceJson(const std::string &path)
+{
+    std::string out = "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    bool first = true;
+    auto separator = [&]
+    {
+        if (!first)
+            out += ",\n";
+        first = false;
+    };
+
+    TraceRegistry &reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    for (const auto &buf : reg.buffers)
+    {
+        size_t count = buf->count.load(std::memory_order_acquire);
+        const char *threadName = buf->name.load();
+        if (threadName)
+        {
+            separator();
+            out += "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " + std::to_string(buf->tid) +
+                   ", \"args\": {\"name\": ";
+            appendJsonString(out, threadName);
+            out += "}}";
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            const TraceEvent &ev = buf->chunks[i / ThreadBuffer::chunkSize].load(std::memory_order_relaxed)[i % ThreadBuffer::chunkSize];
+            std::string name = ev.name;
+            if (ev.detail[0])
+                name = name + " " + ev.detail;
+
+            char timing[96];
+            snprintf(timing, sizeof(timing), ", \"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": %d}",
+                     ev.startNs / 1e3, (ev.endNs - ev.startNs) / 1e3, buf->tid);
+            separator();
+            out += "{\"name\": ";
+            appendJsonString(out, name);
+            out += ", \"cat\": \"compiler\", \"ph\": \"X\"";
+            out += timing;
+        }
+    }
+    out += "\n]}\n";
+
+    std::ofstream file(path, std::ios::binary);
+    file.write(out.data(), static_cast<std::streamsize>(out.size()));
+    return static_cast<bool>(file);
+}
@@ -0,0 +1,64 @@
+// trace.h
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// ----------------------------------------------
+// Trace spans in Chrome trace_event format
+// ----------------------------------------------
+// Each thread appends completed spans to its own buffer; only the owning
+// thread writes it and a release store on the event count publishes the
+// entries, so recording takes no locks. writeTraceJson() produces a file
+// that chrome://tracing and Perfetto open directly.
+//
+// While tracing is off a TraceScope costs one relaxed load and a branch on
+// entry, plus a branch on a local when it goes out of scope.
+
+extern std::atomic<bool> traceFlag;
+
+inline bool traceEnabled()
+{
+    return traceFlag.load(std::memory_order_relaxed);
+}
+
+void setTraceEnabled(bool enabled);
+// Labels the calling thread's track; `name` must be a string literal
+void setTraceThreadName(const char *name);
+// Drops recorded spans; other threads must not be recording meanwhile
+void clearTrace();
+bool writeTraceJson(const std::string &path);
+
+uint64_t traceNow(); // nanoseconds since the process started tracing
+// Records a finished span; `name` must be a string literal, `detail` is copied
+void traceRecord(const char *name, std::string_view detail, uint64_t startNs, uint64_t endNs);
+
+class TraceScope
+{
+public:
+    explicit TraceScope(const char *name, std::string_view detail = {})
+    {
+        if (traceEnabled())
+        {
+            this->name = name;
+            this->detail = detail;
+            start = traceNow();
+        }
+    }
+    ~TraceScope() { end(); }
+    // Records the span now rather than at the end of the C++ scope
+    void end()
+    {
+        if (name)
+            traceRecord(name, detail, start, traceNow());
+        name = nullptr;
+    }
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+
+private:
+    const char *name = nullptr;
+    std::string_view detail; // must outlive the scope
+    uint64_t start = 0;
+};
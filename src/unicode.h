@@ -0,0 +1,62 @@
+// unicode.h
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// ----------------------------------------------
+// UTF-8 and identifier characters
+// ----------------------------------------------
+// Python source is UTF-8 and identifiers may use any letters, as in PEP
+// 3131: a first character with the XID_Start property, then XID_Continue
+// ones. ASCII bytes are classified by table, without the locale lookups of
+// isalpha; only bytes from 0x80 up are decoded and checked against the
+// Unicode ranges, so ASCII-heavy code pays nothing for the rest.
+namespace unicode
+{
+// What decodeUtf8 returns for a malformed sequence
+constexpr char32_t invalid = 0xFFFFFFFF;
+
+namespace detail
+{
+struct AsciiClasses
+{
+    bool identifierStart[128] = {};
+    bool identifierContinue[128] = {};
+
+    constexpr AsciiClasses()
+    {
+        for (int c = 0; c < 128; c++)
+        {
+            bool letter = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+            identifierStart[c] = letter;
+            identifierContinue[c] = letter || (c >= '0' && c <= '9');
+        }
+    }
+};
+constexpr AsciiClasses ascii;
+} // namespace detail
+
+// For bytes below 0x80; false for every byte above
+inline bool isAsciiIdentifierStart(unsigned char c)
+{
+    return c < 128 && detail::ascii.identifierStart[c];
+}
+inline bool isAsciiIdentifierContinue(unsigned char c)
+{
+    return c < 128 && detail::ascii.identifierContinue[c];
+}
+
+// For code points from 0x80 up (Unicode 14.0)
+bool isXidStart(char32_t c);
+bool isXidContinue(char32_t c);
+
+// Decodes the sequence at the start of the `available` bytes at `p` and
+// sets `length` to its size. Overlong forms, surrogates, values past
+// U+10FFFF and cut-off sequences give `invalid` with a length of 1.
+char32_t decodeUtf8(const unsigned char *p, size_t available, size_t &length);
+
+// Length of the leading run of bytes below 0x80, checked 32 bytes at a
+// time with SSE2 where the target has it and 8 at a time elsewhere
+size_t asciiPrefix(std::string_view text);
+} // namespace unicode
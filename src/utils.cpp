@@ -1,16 +1,100 @@
 // utils.cpp
 #include "utils.h"
+#include "trace.h"
+#include <algorithm>
 #include <fstream>
 #include <sstream>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 std::string readFile(const std::string &filename)
 {
+    TraceScope trace("readFile", filename);
     std::ifstream fileStream(filename);
     if (!fileStream.is_open())
     {
         throw std::runtime_error("Could not open file: " + filename);
     }
+    // Read straight into a string of the file's size: going through a
+    // stringstream holds the text two or three times over at the peak
+    fileStream.seekg(0, std::ios::end);
+    std::streamoff size = fileStream.tellg();
+    fileStream.seekg(0, std::ios::beg);
+    if (size >= 0 && fileStream)
+    {
+        std::string text(static_cast<size_t>(size), '\0');
+        fileStream.read(&text[0], size);
+        text.resize(static_cast<size_t>(fileStream.gcount())); // shorter where text mode drops \r
+        return text;
+    }
+    fileStream.clear();
     std::stringstream buffer;
     buffer << fileStream.rdbuf();
     return buffer.str();
-}
\ No newline at end of file
+}
+
+// ----------------------------------------------
+// MappedFile
+// ----------------------------------------------
+MappedFile::MappedFile(const std::string &path)
+{
+    TraceScope trace("MappedFile", path);
+#ifndef _WIN32
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("Could not open file: " + path);
+    struct stat st;
+    bool empty = false;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+    {
+        empty = st.st_size == 0;
+        void *p = empty ? MAP_FAILED : mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED)
+        {
+            madvise(p, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+            mapping = p;
+            size = static_cast<size_t>(st.st_size);
+        }
+    }
+    ::close(fd);
+    if (mapping || empty)
+        return;
+#endif
+    bytes = readFile(path);
+    size = bytes.size();
+}
+
+MappedFile::~MappedFile()
+{
+#ifndef _WIN32
+    if (mapping)
+        munmap(mapping, size);
+#endif
+}
+
+std::string_view MappedFile::text() const
+{
+    if (mapping)
+        return std::string_view(static_cast<const char *>(mapping), size);
+    return bytes;
+}
+
+void MappedFile::release(size_t offset)
+{
+#ifndef _WIN32
+    if (!mapping)
+        return;
+    const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t length = std::min(offset, size) / page * page;
+    if (length > 0)
+        madvise(mapping, length, MADV_DONTNEED);
+#else
+    (void)offset;
+#endif
+}
@@ -1,5 +1,31 @@
 // utils.h
 #pragma once
+#include <cstddef>
 #include <string>
+#include <string_view>
 
-std::string readFile(const std::string &filename);
\ No newline at end of file
+std::string readFile(const std::string &filename);
+
+// A file's bytes, mapped read-only where the platform has mmap and read
+// with readFile() elsewhere. Mapped pages are the file's own, so they can
+// be given back and are read in again if touched: a memory-budgeted
+// compile holds only the part of the source it is working on.
+class MappedFile
+{
+public:
+    // Throws std::runtime_error if the file can't be opened
+    explicit MappedFile(const std::string &path);
+    ~MappedFile();
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    std::string_view text() const;
+    // Gives back the resident pages wholly before `offset`; a no-op for a
+    // file that was read rather than mapped
+    void release(size_t offset);
+
+private:
+    void *mapping = nullptr;
+    size_t size = 0;
+    std::string bytes; // where not mapped
+};
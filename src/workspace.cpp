@@ -0,0 +1,528 @@
+// workspace.cpp
+#include "workspace.h"
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <system_error>
+#include <unordered_set>
+#include "trace.h"
+#include "utils.h"
+
+#ifdef __linux__
+#include <cerrno>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace
+{
+constexpr auto rescanInterval = std::chrono::seconds(2); // without inotify
+constexpr int quietMs = 50;                             // ends a batch of events
+constexpr int idleMs = 200;                             // how often close() is noticed
+
+// Version control, caches and virtual environments hold no workspace code
+bool skippedDirectory(const fs::path &dir)
+{
+    std::string name = dir.filename().string();
+    return (!name.empty() && name[0] == '.') || name == "__pycache__";
+}
+
+bool isPythonFile(const fs::path &path)
+{
+    return path.extension() == ".py";
+}
+
+struct Found
+{
+    std::string path;
+    fs::file_time_type modified;
+    uintmax_t size;
+};
+
+// The .py files under `root`, leaving out what cannot be read
+std::vector<Found> listPythonFiles(const std::string &root)
+{
+    std::vector<Found> found;
+    std::error_code ec;
+    fs::recursive_directory_iterator it(root, fs::directory_options::skip_permission_denied, ec);
+    for (; !ec && it != fs::recursive_directory_iterator(); it.increment(ec))
+    {
+        const fs::directory_entry &entry = *it;
+        std::error_code statError;
+        if (entry.is_directory(statError))
+        {
+            if (skippedDirectory(entry.path()))
+                it.disable_recursion_pending();
+            continue;
+        }
+        if (!isPythonFile(entry.path()) || !entry.is_regular_file(statError))
+            continue;
+        Found file{entry.path().string(), entry.last_write_time(statError), entry.file_size(statError)};
+        if (!statError)
+            found.push_back(std::move(file));
+    }
+    return found;
+}
+
+// ----------------------------------------------
+// TreeWatcher: change notifications for a directory tree
+// ----------------------------------------------
+// inotify watches single directories, so every directory gets its own
+// watch, including ones created later. start() fails where there is no
+// inotify, or when the tree needs more watches than the system allows;
+// the caller then falls back to rescanning.
+class TreeWatcher
+{
+public:
+    ~TreeWatcher()
+    {
+#ifdef __linux__
+        if (fd >= 0)
+            ::close(fd);
+#endif
+    }
+
+    bool start(const std::string &root)
+    {
+#ifdef __linux__
+        fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd >= 0 && watch(root, nullptr, true))
+            return true;
+        if (fd >= 0)
+            ::close(fd);
+        fd = -1;
+#else
+        (void)root;
+#endif
+        return false;
+    }
+
+    // Waits up to `timeoutMs` for events and adds the paths they touch to
+    // `pending`: .py files, and directories that went away. Returns whether
+    // anything arrived; `overflow` means events were lost.
+    bool wait(int timeoutMs, std::unordered_set<std::string> &pending, bool &overflow)
+    {
+#ifdef __linux__
+        pollfd ready{fd, POLLIN, 0};
+        if (poll(&ready, 1, timeoutMs) <= 0)
+            return false;
+        alignas(inotify_event) char buffer[16384];
+        bool any = false;
+        ssize_t got;
+        while ((got = read(fd, buffer, sizeof(buffer))) > 0)
+        {
+            any = true;
+            for (char *at = buffer; at < buffer + got;)
+            {
+                const inotify_event *event = reinterpret_cast<const inotify_event *>(at);
+                at += sizeof(inotify_event) + event->len;
+                handle(*event, pending, overflow);
+            }
+        }
+        return any;
+#else
+        (void)timeoutMs;
+        (void)pending;
+        (void)overflow;
+        return false;
+#endif
+    }
+
+private:
+#ifdef __linux__
+    int fd = -1;
+    std::unordered_map<int, std::string> directories; // by watch descriptor
+
+    // Watches `dir` and the directories below it. New .py files found on
+    // the way go into `files`. Like listPythonFiles, only the root may be
+    // reached through a symlink: links below it are not descended into,
+    // so a link back up the tree cannot make the walk endless.
+    bool watch(const std::string &dir, std::unordered_set<std::string> *files, bool root = false)
+    {
+        const uint32_t mask = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                              IN_MOVED_TO | IN_ONLYDIR | (root ? 0 : IN_DONT_FOLLOW);
+        int wd = inotify_add_watch(fd, dir.c_str(), mask);
+        if (wd < 0)
+            return errno != ENOSPC; // out of watches: give up on inotify
+        directories[wd] = dir;
+
+        std::error_code ec;
+        for (fs::directory_iterator it(dir, fs::directory_options::skip_permission_denied, ec), end;
+             !ec && it != end; it.increment(ec))
+        {
+            std::error_code statError;
+            if (it->is_symlink(statError) && it->is_directory(statError))
+                continue;
+            if (it->is_directory(statError))
+            {
+                if (!skippedDirectory(it->path()) && !watch(it->path().string(), files))
+                    return false;
+            }
+            else if (files && isPythonFile(it->path()))
+            {
+                files->insert(it->path().string());
+            }
+        }
+        return true;
+    }
+
+    void handle(const inotify_event &event, std::unordered_set<std::string> &pending, bool &overflow)
+    {
+        if (event.mask & IN_Q_OVERFLOW)
+        {
+            overflow = true;
+            return;
+        }
+        if (event.mask & IN_IGNORED)
+        {
+            directories.erase(event.wd);
+            return;
+        }
+        auto dir = directories.find(event.wd);
+        if (dir == directories.end() || event.len == 0)
+            return;
+        std::string path = dir->second + "/" + event.name;
+        if (event.mask & IN_ISDIR)
+        {
+            if (skippedDirectory(path))
+                return;
+            if (event.mask & (IN_CREATE | IN_MOVED_TO))
+            {
+                if (!watch(path, &pending))
+                    overflow = true; // out of watches; a rescan still sees it
+            }
+            else
+            {
+                pending.insert(path); // deleted or moved away, files and all
+            }
+        }
+        else if (isPythonFile(path))
+        {
+            pending.insert(path);
+        }
+    }
+#endif
+};
+} // namespace
+
+// ----------------------------------------------
+// WorkspaceIndex
+// ----------------------------------------------
+WorkspaceIndex::~WorkspaceIndex()
+{
+    close();
+}
+
+bool WorkspaceIndex::open(const std::string &root, unsigned threads)
+{
+    close();
+    std::error_code ec;
+    fs::path dir = fs::absolute(root, ec).lexically_normal();
+    if (ec || !fs::is_directory(dir, ec))
+        return false;
+    if (!dir.has_filename())
+        dir = dir.parent_path(); // "src/" -> "src"
+    rootPath = dir.string();
+    threadCount = threads ? threads : std::max(1u, std::thread::hardware_concurrency());
+    watcher = std::thread([this]
+                          { run(); });
+    return true;
+}
+
+void WorkspaceIndex::close()
+{
+    if (!watcher.joinable())
+        return;
+    stopping = true;
+    watcher.join();
+    stopping = false;
+
+    std::unique_lock<std::shared_mutex> hold(lock);
+    files.clear();
+    fileIds.clear();
+    byName.clear();
+    definitionCount = 0;
+    strings.clear(); // nothing outside holds its handles: find() copies
+    rootPath.clear();
+    generation++;
+}
+
+std::vector<WorkspaceIndex::Location> WorkspaceIndex::find(std::string_view name) const
+{
+    std::vector<Location> found;
+    {
+        std::shared_lock<std::shared_mutex> hold(lock);
+        auto it = byName.find(name);
+        if (it == byName.end())
+            return found;
+        found.reserve(it->second.size());
+        for (const Entry &entry : it->second)
+        {
+            const File &file = files[entry.file];
+            const Definition &def = file.definitions[entry.index];
+            found.push_back({file.path, def.scope.str(), def.type, def.line, def.offset});
+        }
+    }
+    std::sort(found.begin(), found.end(),
+              [](const Location &a, const Location &b)
+              { return a.path != b.path ? a.path < b.path : a.line < b.line; });
+    return found;
+}
+
+std::vector<std::string> WorkspaceIndex::filesDefining(std::string_view name) const
+{
+    std::vector<std::string> paths;
+    for (Location &location : find(name))
+    {
+        if (paths.empty() || paths.back() != location.path)
+            paths.push_back(std::move(location.path));
+    }
+    return paths;
+}
+
+std::vector<std::string> WorkspaceIndex::paths() const
+{
+    std::vector<std::string> paths;
+    std::shared_lock<std::shared_mutex> hold(lock);
+    for (const File &file : files)
+    {
+        if (file.live)
+            paths.push_back(file.path);
+    }
+    std::sort(paths.begin(), paths.end());
+    return paths;
+}
+
+WorkspaceIndex::Status WorkspaceIndex::status() const
+{
+    Status status;
+    std::shared_lock<std::shared_mutex> hold(lock);
+    for (const File &file : files)
+        status.files += file.live;
+    status.definitions = definitionCount;
+    status.scanning = scanning;
+    status.generation = generation;
+    return status;
+}
+
+// The indexing thread: watch first, so nothing changes unseen during the
+// first scan, then index changes in batches until close()
+void WorkspaceIndex::run()
+{
+    setTraceThreadName("workspace");
+    TreeWatcher tree;
+    bool watching = tree.start(rootPath);
+
+    scanning = true;
+    scan();
+    scanning = false;
+    changed();
+
+    std::unordered_set<std::string> pending;
+    while (!stopping)
+    {
+        if (!watching)
+        {
+            auto due = std::chrono::steady_clock::now() + rescanInterval;
+            while (!stopping && std::chrono::steady_clock::now() < due)
+                std::this_thread::sleep_for(std::chrono::milliseconds(idleMs));
+            if (!stopping)
+                scan();
+            continue;
+        }
+
+        // A batch ends after a quiet spell, so an editor that writes a
+        // file several times on save gets it indexed once
+        bool overflow = false;
+        bool events = tree.wait(pending.empty() ? idleMs : quietMs, pending, overflow);
+        if (overflow)
+        {
+            pending.clear();
+            scan();
+            continue;
+        }
+        if (events || pending.empty())
+            continue;
+
+        std::vector<std::string> updated;
+        for (const std::string &path : pending)
+        {
+            std::error_code ec;
+            if (fs::is_regular_file(path, ec))
+                updated.push_back(path);
+            else
+                remove(path);
+        }
+        pending.clear();
+        indexFiles(updated);
+        changed();
+    }
+}
+
+// Brings the index in line with the tree: indexes files that are new or
+// whose time or size changed, and drops the ones that are gone
+void WorkspaceIndex::scan()
+{
+    TraceScope trace("workspace scan", rootPath);
+    std::vector<Found> found = listPythonFiles(rootPath);
+    std::vector<std::string> stale;
+    std::vector<std::string> gone;
+    {
+        std::shared_lock<std::shared_mutex> hold(lock);
+        std::unordered_set<std::string_view> present;
+        present.reserve(found.size());
+        for (const Found &f : found)
+        {
+            present.insert(f.path);
+            auto it = fileIds.find(f.path);
+            if (it == fileIds.end() || !files[it->second].live ||
+                files[it->second].modified != f.modified || files[it->second].size != f.size)
+                stale.push_back(f.path);
+        }
+        for (const File &file : files)
+        {
+            if (file.live && !present.count(file.path))
+                gone.push_back(file.path);
+        }
+    }
+    for (const std::string &path : gone)
+        remove(path);
+    indexFiles(stale);
+    if (!stale.empty() || !gone.empty())
+        changed();
+}
+
+void WorkspaceIndex::indexFiles(const std::vector<std::string> &paths)
+{
+    std::atomic<size_t> next{0};
+    auto work = [&]
+    {
+        setTraceThreadName("index worker");
+        for (size_t k; !stopping && (k = next.fetch_add(1)) < paths.size();)
+            indexFile(paths[k]);
+    };
+    std::vector<std::thread> workers;
+    size_t count = std::min<size_t>(threadCount, paths.size());
+    for (size_t w = 1; w < count; w++)
+        workers.emplace_back(work);
+    work();
+    for (std::thread &worker : workers)
+        worker.join();
+}
+
+// Lexes and parses one file into its definitions. A file that does not
+// lex cleanly, e.g. while it is being edited, keeps its last definitions.
+void WorkspaceIndex::indexFile(const std::string &path)
+{
+    TraceScope trace("index file", path);
+    std::error_code ec;
+    fs::file_time_type modified = fs::last_write_time(path, ec);
+    uintmax_t size = ec ? 0 : fs::file_size(path, ec);
+    if (ec)
+    {
+        remove(path); // gone since it was listed
+        return;
+    }
+
+    std::vector<Definition> definitions;
+    bool parsed = false;
+    try
+    {
+        std::string text = readFile(path);
+        StringPool local;
+        std::vector<Error> errors;
+        std::vector<Token> tokens = Lexer(local).tokenize(text, errors);
+        if (errors.empty())
+        {
+            SymbolTable table(local);
+            Parser(tokens, table).parse();
+            for (const SymbolTable::SymbolRecord &rec : table.records())
+            {
+                const CrossReferenceIndex::Reference *def = table.references.definition(rec.info.entry);
+                if (!def || def->kind == CrossReferenceIndex::Kind::Use)
+                    continue;
+                if (def->kind == CrossReferenceIndex::Kind::Assignment && rec.info.scope != "global")
+                    continue;
+                definitions.push_back({strings.intern(rec.name), strings.intern(rec.info.scope),
+                                       rec.info.type, def->line, def->offset});
+            }
+            parsed = true;
+        }
+    }
+    catch (const std::exception &)
+    {
+        // Unreadable or unparsable: treated like a lexing error
+    }
+
+    std::unique_lock<std::shared_mutex> hold(lock);
+    auto [it, added] = fileIds.try_emplace(path, static_cast<uint32_t>(files.size()));
+    if (added)
+    {
+        files.emplace_back();
+        files.back().path = path;
+    }
+    uint32_t id = it->second;
+    File &file = files[id];
+    file.modified = modified;
+    file.size = size;
+    file.live = true;
+    if (!parsed)
+        return;
+    unlink(id);
+    file.definitions = std::move(definitions);
+    for (uint32_t d = 0; d < file.definitions.size(); d++)
+        byName[file.definitions[d].name.view()].push_back({id, d});
+    definitionCount += file.definitions.size();
+}
+
+// Drops a file, or every file under a directory that went away
+void WorkspaceIndex::remove(const std::string &path)
+{
+    std::unique_lock<std::shared_mutex> hold(lock);
+    auto it = fileIds.find(path);
+    if (it != fileIds.end())
+    {
+        unlink(it->second);
+        files[it->second].live = false;
+        return;
+    }
+    const std::string prefix = path + "/";
+    for (uint32_t id = 0; id < files.size(); id++)
+    {
+        if (files[id].live && files[id].path.compare(0, prefix.size(), prefix) == 0)
+        {
+            unlink(id);
+            files[id].live = false;
+        }
+    }
+}
+
+void WorkspaceIndex::unlink(uint32_t id)
+{
+    File &file = files[id];
+    for (const Definition &def : file.definitions)
+    {
+        auto it = byName.find(def.name.view());
+        if (it == byName.end())
+            continue; // a name the file defines twice, already handled
+        std::vector<Entry> &entries = it->second;
+        entries.erase(std::remove_if(entries.begin(), entries.end(),
+                                     [id](const Entry &e)
+                                     { return e.file == id; }),
+                      entries.end());
+        if (entries.empty())
+            byName.erase(it);
+    }
+    definitionCount -= file.definitions.size();
+    file.definitions.clear();
+}
+
+void WorkspaceIndex::changed()
+{
+    generation++;
+    if (onUpdate)
+        onUpdate();
+}
@@ -0,0 +1,121 @@
+// workspace.h
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "main.h"
+
+// ----------------------------------------------
+// WorkspaceIndex: where names are defined across a directory of .py files
+// ----------------------------------------------
+// open() indexes every .py file under a directory on a background thread:
+// the files are lexed and parsed by a pool of workers, and each one keeps
+// only what it defines, so the index stays small however much code there is.
+// Every name then maps to its definitions across the workspace, and a query
+// is one hash lookup. The same thread keeps watching the tree (inotify on
+// Linux, a modification-time rescan every few seconds elsewhere) and
+// re-indexes just the files that changed. Queries may come from any thread
+// while that happens.
+class WorkspaceIndex
+{
+public:
+    struct Location
+    {
+        std::string path;
+        std::string scope; // as the lexer names it: "global", "f", "g@f", ...
+        std::string type;  // "function", "class", "int", ...
+        int line;
+        uint32_t offset; // of the name, in bytes
+    };
+
+    struct Status
+    {
+        size_t files = 0;
+        size_t definitions = 0;
+        bool scanning = false;   // the first pass over the tree is running
+        uint64_t generation = 0; // changes whenever the index does
+    };
+
+    WorkspaceIndex() = default;
+    ~WorkspaceIndex();
+    WorkspaceIndex(const WorkspaceIndex &) = delete;
+    WorkspaceIndex &operator=(const WorkspaceIndex &) = delete;
+
+    // Closes the current workspace and starts indexing `root` with up to
+    // `threads` workers (0: one per core). False if `root` is no directory.
+    bool open(const std::string &root, unsigned threads = 0);
+    void close();
+    bool isOpen() const { return watcher.joinable(); }
+    const std::string &root() const { return rootPath; }
+
+    // Where `name` is defined: def and class names at any depth, and names
+    // bound at module level. Ordered by path, then line.
+    std::vector<Location> find(std::string_view name) const;
+    // The files among those, each once
+    std::vector<std::string> filesDefining(std::string_view name) const;
+    // Every .py file in the index, sorted
+    std::vector<std::string> paths() const;
+    Status status() const;
+
+    // Called on the indexing thread after each batch of changes; set it
+    // before open()
+    std::function<void()> onUpdate;
+
+private:
+    struct Definition
+    {
+        InternedString name;
+        InternedString scope;
+        std::string type;
+        int line;
+        uint32_t offset;
+    };
+
+    struct File
+    {
+        std::string path;
+        std::filesystem::file_time_type modified;
+        uintmax_t size = 0;
+        bool live = false; // false once deleted; ids are never reused
+        std::vector<Definition> definitions;
+    };
+
+    // One definition: files[file].definitions[index]
+    struct Entry
+    {
+        uint32_t file;
+        uint32_t index;
+    };
+
+    // Definition names and scopes; the text of everything else a file holds
+    // goes into a pool that is dropped after the file is parsed
+    StringPool strings;
+
+    mutable std::shared_mutex lock; // guards files, fileIds, byName, definitionCount
+    std::vector<File> files;
+    std::unordered_map<std::string, uint32_t> fileIds;
+    std::unordered_map<std::string_view, std::vector<Entry>> byName; // views into `strings`
+    size_t definitionCount = 0;
+    std::atomic<uint64_t> generation{0};
+    std::atomic<bool> scanning{false};
+
+    std::string rootPath;
+    unsigned threadCount = 1;
+    std::thread watcher;
+    std::atomic<bool> stopping{false};
+
+    void run();
+    void scan();
+    void indexFiles(const std::vector<std::string> &paths);
+    void indexFile(const std::string &path);
+    void remove(const std::string &path);
+    void unlink(uint32_t id); // drops files[id]'s entries from byName
+    void changed();
+};
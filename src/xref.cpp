@@ -0,0 +1,96 @@
+// xref.cpp
+#include "xref.h"
+#include <algorithm>
+
+void CrossReferenceIndex::clear()
+{
+    bySymbol.clear();
+    symbolStart.clear();
+    definitionOf.clear();
+    byOffset.clear();
+}
+
+void CrossReferenceIndex::add(int symbol, int line, size_t offset, size_t length, Kind kind)
+{
+    if (symbol <= 0)
+        return;
+    bySymbol.push_back({symbol, line, static_cast<uint32_t>(offset), static_cast<uint32_t>(length), kind});
+}
+
+void CrossReferenceIndex::append(const CrossReferenceIndex &other, const std::vector<int> &entryOf)
+{
+    bySymbol.reserve(bySymbol.size() + other.bySymbol.size());
+    for (const Reference &ref : other.bySymbol)
+    {
+        Reference copy = ref;
+        copy.symbol = entryOf[ref.symbol];
+        bySymbol.push_back(copy);
+    }
+}
+
+void CrossReferenceIndex::finalize()
+{
+    // The parser adds in near source order, so this sort is mostly a merge
+    std::stable_sort(bySymbol.begin(), bySymbol.end(),
+                     [](const Reference &a, const Reference &b)
+                     { return a.symbol != b.symbol ? a.symbol < b.symbol : a.offset < b.offset; });
+
+    int maxSymbol = bySymbol.empty() ? 0 : bySymbol.back().symbol;
+    symbolStart.assign(static_cast<size_t>(maxSymbol) + 2, 0);
+    for (const Reference &ref : bySymbol)
+        symbolStart[ref.symbol + 1]++;
+    for (size_t s = 1; s < symbolStart.size(); s++)
+        symbolStart[s] += symbolStart[s - 1];
+
+    definitionOf.assign(static_cast<size_t>(maxSymbol) + 1, 0);
+    for (int s = 1; s <= maxSymbol; s++)
+    {
+        uint32_t best = symbolStart[s];
+        for (uint32_t i = symbolStart[s]; i < symbolStart[s + 1]; i++)
+        {
+            if (bySymbol[i].kind > bySymbol[best].kind)
+                best = i; // Definition beats Assignment beats Use; ties keep the earliest
+        }
+        definitionOf[s] = best;
+    }
+
+    byOffset.resize(bySymbol.size());
+    for (size_t i = 0; i < byOffset.size(); i++)
+        byOffset[i] = static_cast<uint32_t>(i);
+    std::sort(byOffset.begin(), byOffset.end(),
+              [&](uint32_t a, uint32_t b)
+              { return bySymbol[a].offset < bySymbol[b].offset; });
+}
+
+const CrossReferenceIndex::Reference *CrossReferenceIndex::begin(int symbol) const
+{
+    if (symbol <= 0 || static_cast<size_t>(symbol) + 1 >= symbolStart.size())
+        return nullptr;
+    return bySymbol.data() + symbolStart[symbol];
+}
+
+const CrossReferenceIndex::Reference *CrossReferenceIndex::end(int symbol) const
+{
+    if (symbol <= 0 || static_cast<size_t>(symbol) + 1 >= symbolStart.size())
+        return nullptr;
+    return bySymbol.data() + symbolStart[symbol + 1];
+}
+
+const CrossReferenceIndex::Reference *CrossReferenceIndex::definition(int symbol) const
+{
+    if (begin(symbol) == end(symbol))
+        return nullptr;
+    return bySymbol.data() + definitionOf[symbol];
+}
+
+const CrossReferenceIndex::Reference *CrossReferenceIndex::at(size_t offset) const
+{
+    // Last reference starting at or before `offset`
+    auto it = std::upper_bound(byOffset.begin(), byOffset.end(), offset,
+                               [&](size_t value, uint32_t index)
+                               { return value < bySymbol[index].offset; });
+    if (it == byOffset.begin())
+        return nullptr;
+    const Reference &ref = bySymbol[*(it - 1)];
+    return offset <= static_cast<size_t>(ref.offset) + ref.length ? &ref : nullptr;
+}
@@ -0,0 +1,61 @@
+// xref.h
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// ----------------------------------------------
+// CrossReferenceIndex: every identifier occurrence the parser resolves
+// ----------------------------------------------
+// The Parser appends one compact entry per resolved identifier while it
+// walks the tokens; finalize() then sorts them once. References are grouped
+// by symbol entry number with a start index per symbol, so the references
+// to a symbol are a contiguous range found in O(1), and so is its
+// definition. A second, offset-ordered permutation serves as the interval
+// index for "which symbol is at this position" in O(log n). Identifiers
+// never span lines, so a line:column query is an offset query once the
+// caller maps it through its line table.
+class CrossReferenceIndex
+{
+public:
+    enum class Kind : uint8_t
+    {
+        Use,
+        Assignment, // name bound by `=`
+        Definition  // def/class name
+    };
+
+    struct Reference
+    {
+        int symbol;      // SymbolInfo::entry
+        int line;
+        uint32_t offset; // source byte offset of the identifier
+        uint32_t length;
+        Kind kind;
+    };
+
+    void clear();
+    void add(int symbol, int line, size_t offset, size_t length, Kind kind);
+    // add()s the references of a not yet finalized index, renumbering
+    // symbol s as entryOf[s]
+    void append(const CrossReferenceIndex &other, const std::vector<int> &entryOf);
+    // Sorts and builds the lookup tables; call once after the last add()
+    void finalize();
+
+    size_t size() const { return bySymbol.size(); }
+
+    // References to `symbol` in source order; empty if it has none
+    const Reference *begin(int symbol) const;
+    const Reference *end(int symbol) const;
+    // The def/class site, else the first assignment, else the first use
+    const Reference *definition(int symbol) const;
+    // The reference whose identifier covers `offset` (its end included, so
+    // a caret just after a name still finds it), or nullptr
+    const Reference *at(size_t offset) const;
+
+private:
+    std::vector<Reference> bySymbol;    // sorted by (symbol, offset)
+    std::vector<uint32_t> symbolStart;  // symbolStart[s]..symbolStart[s + 1] in bySymbol
+    std::vector<uint32_t> definitionOf; // per symbol, index of definition() in bySymbol
+    std::vector<uint32_t> byOffset;     // indices into bySymbol, sorted by offset
+};